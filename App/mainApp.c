@@ -1,6 +1,9 @@
 #include "mainApp.h"
 #include "MemFlash.h"
 #include "ufs.h"
+#if UFS_KERNEL_BENCH == UFS_OK
+#include "ufs_kernel.h"
+#endif
 #include "usb_device.h"
 #define PORT_FILE_PARTNER	54
 
@@ -45,7 +48,7 @@ void mainApp(void)
 
 	usb_send = newFifo(0xFF);
 
-	xTaskCreate(FileMng_Task, "file_manager", 2048, NULL, 7, &FileMng_handler);
+	xTaskCreate(FileMng_Task, "file_manager", 1280, NULL, 7, &FileMng_handler);	// UFS sector buffers come from its scratch pool, not this stack
 	xTaskCreate(LLnet_Task, "ROUTER", 1024, NULL, 7, &MCP_handler);
 	xTaskCreate(USB_Task, "USB", 1024, NULL, 8, &USB_handler);
 
@@ -107,6 +110,10 @@ Fifo *file_cmdMess;
 
 uint16_t numberitem;
 
+#if UFS_KERNEL_BENCH == UFS_OK
+ufs_KernelBench_Type KernelBench;	// Cycles per KB of the kernels, read it with the debugger
+#endif
+
 LiteLink_Service *File_service;
 Fifo * Fifo_File;
 
@@ -117,6 +124,10 @@ void FileMng_Task (void *pvParameters)
 	LiteLink_onMessage(File_service, File_service_onMess);
 	Fifo_File = newFifo(50);
 
+#if UFS_KERNEL_BENCH == UFS_OK
+	ufs_KernelBench(Ufs_Cycles, 4096, &KernelBench);
+#endif
+
 	FileMng_init();
 
 	respond_addEvent(Send_respond);
@@ -136,6 +147,10 @@ void FileMng_Task (void *pvParameters)
 			free(data);
 			data = NULL;
 		}
+		else
+		{
+			FileMng_Idle();
+		}
 
 
 		vTaskDelay(1);
@@ -5,13 +5,16 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
-../Middle/ufs/ufs.c 
+../Middle/ufs/ufs.c \
+../Middle/ufs/ufs_kernel.c 
 
 OBJS += \
-./Middle/ufs/ufs.o 
+./Middle/ufs/ufs.o \
+./Middle/ufs/ufs_kernel.o 
 
 C_DEPS += \
-./Middle/ufs/ufs.d 
+./Middle/ufs/ufs.d \
+./Middle/ufs/ufs_kernel.d 
 
 
 # Each subdirectory must supply rules for building sources it contributes
@@ -21,7 +24,7 @@ Middle/ufs/%.o Middle/ufs/%.su Middle/ufs/%.cyclo: ../Middle/ufs/%.c Middle/ufs/
 clean: clean-Middle-2f-ufs
 
 clean-Middle-2f-ufs:
-	-$(RM) ./Middle/ufs/ufs.cyclo ./Middle/ufs/ufs.d ./Middle/ufs/ufs.o ./Middle/ufs/ufs.su
+	-$(RM) ./Middle/ufs/ufs.cyclo ./Middle/ufs/ufs.d ./Middle/ufs/ufs.o ./Middle/ufs/ufs.su ./Middle/ufs/ufs_kernel.cyclo ./Middle/ufs/ufs_kernel.d ./Middle/ufs/ufs_kernel.o ./Middle/ufs/ufs_kernel.su
 
 .PHONY: clean-Middle-2f-ufs
 
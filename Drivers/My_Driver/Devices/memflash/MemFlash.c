@@ -14,12 +14,38 @@ Std_ReturnType MemFlash_WriteSector(uint16_t SectorNumb, uint8_t *SectorData, ui
 	return E_OK;
 }
 
+Std_ReturnType MemFlash_WritePartial(uint16_t SectorNumb, uint32_t Offset, uint8_t *Data, uint16_t Size)
+{
+	if(Size == 0)
+	{
+		return E_OK;
+	}
+	W25qxx_WriteSector(Data, SectorNumb, Offset, Size);
+	return E_OK;
+}
+
 Std_ReturnType MemFlash_ReadSector(uint16_t SectorNumb, uint8_t *SectorData, uint16_t SectorSize)
 {
 	W25qxx_ReadSector(SectorData, SectorNumb, 0, SectorSize);
 	return E_OK;
 }
 
+Std_ReturnType MemFlash_ReadRange(uint16_t SectorNumb, uint32_t Offset, uint8_t *Data, uint32_t Size)
+{
+	uint32_t Address = SectorNumb * w25qxx.SectorSize + Offset;
+
+	// The SPI receive length is 16-bit, long ranges are split
+	while(Size > 0)
+	{
+		uint32_t Chunk = (Size > MEMFLASH_READ_CHUNK) ? MEMFLASH_READ_CHUNK : Size;
+		W25qxx_ReadBytes(Data, Address, Chunk);
+		Address += Chunk;
+		Data += Chunk;
+		Size -= Chunk;
+	}
+	return E_OK;
+}
+
 Std_ReturnType MemFlash_EraseSector(uint16_t SectorNumb)
 {
 	W25qxx_EraseSector(SectorNumb);
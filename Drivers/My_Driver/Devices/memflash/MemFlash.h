@@ -14,7 +14,9 @@ extern "C"
 extern Std_ReturnType MemFlash_Init(uint8_t *Id);
 extern Std_ReturnType MemFlash_ReadID(uint8_t *data, uint16_t length);
 extern Std_ReturnType MemFlash_WriteSector(uint16_t SectorNumb, uint8_t *SectorData, uint16_t SectorSize);
+extern Std_ReturnType MemFlash_WritePartial(uint16_t SectorNumb, uint32_t Offset, uint8_t *Data, uint16_t Size);
 extern Std_ReturnType MemFlash_ReadSector(uint16_t SectorNumb, uint8_t *SectorData, uint16_t SectorSize);
+extern Std_ReturnType MemFlash_ReadRange(uint16_t SectorNumb, uint32_t Offset, uint8_t *Data, uint32_t Size);
 extern Std_ReturnType MemFlash_EraseSector(uint16_t SectorNumb);
 extern Std_ReturnType MemFlash_EraseBlock(uint16_t BlockNumb);
 extern Std_ReturnType MemFlash_EraseChip();
@@ -26,6 +26,8 @@ extern SPI_HandleTypeDef hspi1;
 #define W25QXX_CS_ON()                            HAL_GPIO_WritePin(GPIOB,GPIO_PIN_14,GPIO_PIN_SET)
 #endif
 
+#define MEMFLASH_READ_CHUNK                       0x8000   // Largest single read transfer in bytes
+
 #ifdef __cplusplus
 }
 #endif
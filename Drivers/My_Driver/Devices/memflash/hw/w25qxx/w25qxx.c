@@ -364,7 +364,7 @@ bool 	W25qxx_IsEmptyPage(uint32_t Page_Address,uint32_t OffsetInByte,uint32_t Nu
 	W25qxx_Delay(100);
 	uint32_t	StartTime=HAL_GetTick();
 	#endif		
-	uint8_t	pBuffer[32];
+	__ALIGNED(4) uint8_t	pBuffer[32];
 	uint32_t	WorkAddress;
 	uint32_t	i;
 	for(i=OffsetInByte; i<w25qxx.PageSize; i+=sizeof(pBuffer))
@@ -380,9 +380,10 @@ bool 	W25qxx_IsEmptyPage(uint32_t Page_Address,uint32_t OffsetInByte,uint32_t Nu
 		W25qxx_Spi(0);
 		W25QXX_READ(pBuffer,sizeof(pBuffer),100);
 		W25QXX_CS_ON();
-		for(uint8_t x=0;x<sizeof(pBuffer);x++)
+		// Check a word at a time
+		for(uint8_t x=0;x<sizeof(pBuffer)/sizeof(uint32_t);x++)
 		{
-			if(pBuffer[x]!=0xFF)
+			if(((uint32_t *)pBuffer)[x]!=0xFFFFFFFF)
 				goto NOT_EMPTY;		
 		}			
 	}	
@@ -433,7 +434,7 @@ bool 	W25qxx_IsEmptySector(uint32_t Sector_Address,uint32_t OffsetInByte,uint32_
 	W25qxx_Delay(100);
 	uint32_t	StartTime=HAL_GetTick();
 	#endif		
-	uint8_t	pBuffer[32];
+	__ALIGNED(4) uint8_t	pBuffer[32];
 	uint32_t	WorkAddress;
 	uint32_t	i;
 	for(i=OffsetInByte; i<w25qxx.SectorSize; i+=sizeof(pBuffer))
@@ -449,9 +450,10 @@ bool 	W25qxx_IsEmptySector(uint32_t Sector_Address,uint32_t OffsetInByte,uint32_
 		W25qxx_Spi(0);
 		W25QXX_READ(pBuffer,sizeof(pBuffer),100);
 		W25QXX_CS_ON();
-		for(uint8_t x=0;x<sizeof(pBuffer);x++)
+		// Check a word at a time
+		for(uint8_t x=0;x<sizeof(pBuffer)/sizeof(uint32_t);x++)
 		{
-			if(pBuffer[x]!=0xFF)
+			if(((uint32_t *)pBuffer)[x]!=0xFFFFFFFF)
 				goto NOT_EMPTY;		
 		}			
 	}	
@@ -502,7 +504,7 @@ bool 	W25qxx_IsEmptyBlock(uint32_t Block_Address,uint32_t OffsetInByte,uint32_t
 	W25qxx_Delay(100);
 	uint32_t	StartTime=HAL_GetTick();
 	#endif		
-	uint8_t	pBuffer[32];
+	__ALIGNED(4) uint8_t	pBuffer[32];
 	uint32_t	WorkAddress;
 	uint32_t	i;
 	for(i=OffsetInByte; i<w25qxx.BlockSize; i+=sizeof(pBuffer))
@@ -518,9 +520,10 @@ bool 	W25qxx_IsEmptyBlock(uint32_t Block_Address,uint32_t OffsetInByte,uint32_t
 		W25qxx_Spi(0);
 		W25QXX_READ(pBuffer,sizeof(pBuffer),100);
 		W25QXX_CS_ON();
-		for(uint8_t x=0;x<sizeof(pBuffer);x++)
+		// Check a word at a time
+		for(uint8_t x=0;x<sizeof(pBuffer)/sizeof(uint32_t);x++)
 		{
-			if(pBuffer[x]!=0xFF)
+			if(((uint32_t *)pBuffer)[x]!=0xFFFFFFFF)
 				goto NOT_EMPTY;		
 		}			
 	}	
@@ -2,6 +2,7 @@
 #include "stdlib.h"
 #include "string.h"
 #include "flash.h"
+#include "ufs_kernel.h"
 #include <time.h>
 void Respond(uint8_t *data, uint16_t len);
 
@@ -24,6 +25,8 @@ void Service_RealName(void);
 void Service_WriteFlash(void);
 void jumb(void);
 
+#define WRITE_FLASH_CRC_FAIL	0xFF	// Progress value sent when the programmed image does not match the file
+
 Service_Funct Service[12] = {Service_Handshake, Service_Listfile, Service_AccessFolder,
 							Service_OpenFile, Service_WriteFirstPacket,
 							Service_WriteContinue, Service_ReadFile, Service_ReadAllfile,
@@ -32,38 +35,93 @@ Service_Funct Service[12] = {Service_Handshake, Service_Listfile, Service_Access
 HandShake_p Handshake_infor;
 FileCmd_t Filecmd;
 UFS * Ufs;
-ufs_Item_Type item;
+ufs_Item_Type *item = NULL;
+ufs_Stream_Type stream;
 ufs_ItemInfo_Type item_info[10];
 uint32_t datafile[200] = {0};
+uint8_t protocol = FILE_SQ_PROTOCOL_BASE;	// Version agreed with the host in the last Handshake
 
 void FileMng_init(void)
 {
 	Ufs = newUFS(&Ufs_Cfg);
 //	ufs_FastFormat(Ufs);
-	Handshake_infor.param.memSize = Ufs->conf->api->u32numberSectorOfDevice * Ufs->conf->api->u16numberByteOfSector;
-	Handshake_infor.param.maxLen = Ufs->conf->api->u16numberByteOfSector ;
+	Handshake_infor.param.memSize = 0;
+	Handshake_infor.param.maxLen = 0;
 	Handshake_infor.param.tineWrite = 0;
 
+	// Without a file system every command is dropped by ServiceHandle
+	if(Ufs != NULL)
+	{
+		Handshake_infor.param.memSize = Ufs->conf->api->u32numberSectorOfDevice * Ufs->conf->api->u16numberByteOfSector;
+		Handshake_infor.param.maxLen = Ufs->conf->api->u16numberByteOfSector ;
+	}
+
 	Filecmd.data = NULL;
 	Filecmd.dataLen = 0;
+	protocol = FILE_SQ_PROTOCOL_BASE;
 }
 
 void ServiceHandle(uint8_t *data, uint16_t length)
 {
+	if(Ufs == NULL)
+	{
+		return;
+	}
+
 	Filecmd.Cmd_id = data[0];
 	Filecmd.dataLen = length - 1;
 	Filecmd.data = &data[1];
 
+	// An upload ends as soon as another command arrives
+	if(stream.file != NULL && Service[Filecmd.Cmd_id] != Service_WriteContinue)
+	{
+		ufs_StreamClose(&stream);
+	}
+
 	Service[Filecmd.Cmd_id]();
 //	Filecmd.data = NULL;
 }
 
+void FileMng_Idle(void)
+{
+	// Serve requests queued by other tasks and program buffered upload data first, then release
+	// deleted files and erase freed clusters while no command is pending, so uploads are
+	// acknowledged without waiting for the flash
+	if(Ufs != NULL && ufs_Serve(Ufs, 1) == 0 && ufs_Drain(Ufs, 1) == 0)
+	{
+		ufs_Reclaim(Ufs);
+		ufs_PreErase(Ufs, 1);
+	}
+}
+
 void Service_Handshake(void)
 {
+	uint8_t Ret[9];
 
-	Handshake_infor.param.memSize = Handshake_infor.param.memSize - ufs_GetUsedSize(Ufs);
+	Handshake_infor.param.memSize = ufs_GetFreeSize(Ufs);
 	Handshake_infor.param.state = UFS_OK;
-	Respond(Handshake_infor.raw, 8);
+	memcpy(Ret, Handshake_infor.raw, 8);
+
+	// An empty Handshake comes from a host of the first protocol, it gets the original replies
+	if(Filecmd.dataLen == 0)
+	{
+		protocol = FILE_SQ_PROTOCOL_BASE;
+		Respond(Ret, 8);
+		return;
+	}
+
+	// Newer hosts send their version and get back the version both sides speak
+	protocol = Filecmd.data[0];
+	if(protocol > FILE_SQ_PROTOCOL_VERSION)
+	{
+		protocol = FILE_SQ_PROTOCOL_VERSION;
+	}
+	else if(protocol < FILE_SQ_PROTOCOL_BASE)
+	{
+		protocol = FILE_SQ_PROTOCOL_BASE;
+	}
+	Ret[8] = protocol;
+	Respond(Ret, 9);
 }
 
 void Service_AccessFolder(void)
@@ -82,26 +140,43 @@ void Service_AccessFolder(void)
 
 void Service_OpenFile(void)
 {
-	uint8_t Ret[5] = {UFS_NOT_OK};
+	uint8_t Ret[9] = {UFS_NOT_OK};
+	uint32_t crc = 0;
 
 	uint8_t lenname = Filecmd.data[0];
 	uint8_t nameFile[16] = {0};
 	memcpy(nameFile, &Filecmd.data[1], lenname);
 
-	if(ufs_OpenItem(Ufs, nameFile , &item) == UFS_OK)
+	// Keep the previous file among the recently closed ones
+	ufs_FileClose(item);
+	item = ufs_FileOpen(Ufs, nameFile);
+	if(item != NULL)
 	{
 		Ret[0] = UFS_OK;
+		Ret[1] = item->info.comp.size & 0xFF;
+		Ret[2] = (item->info.comp.size >> 8) & 0xFF;
+		Ret[3] = (item->info.comp.size >> 16) & 0xFF;
+		Ret[4] = item->info.comp.size >> 24;
+
+		// CRC32 of the content, the host checks its copy without reading the file back. An unknown
+		// CRC is computed by reading the file, only for hosts that asked for it
+		if(protocol >= FILE_SQ_PROTOCOL_CRC)
+		{
+			ufs_GetFileCrc(item, &crc);
+			Ret[5] = crc & 0xFF;
+			Ret[6] = (crc >> 8) & 0xFF;
+			Ret[7] = (crc >> 16) & 0xFF;
+			Ret[8] = crc >> 24;
+		}
 	}
-	Ret[1] = item.info.comp.size & 0xFF;
-	Ret[2] = (item.info.comp.size >> 8) & 0xFF;
-	Ret[3] = (item.info.comp.size >> 16) & 0xFF;
-	Ret[4] = item.info.comp.size >> 24;
 
-	Respond(Ret, 5);
+	// Hosts of the first protocol expect the 5 byte reply
+	Respond(Ret, (protocol >= FILE_SQ_PROTOCOL_CRC) ? 9 : 5);
 }
 
 double time_spent[2];
 uint16_t stt = 0;
+uint16_t numbPack = 0;
 
 void Service_WriteFirstPacket(void)
 {
@@ -110,10 +185,25 @@ void Service_WriteFirstPacket(void)
 	infor_write.head = (WriteFile_head*)Filecmd.data;
 	infor_write.data = &Filecmd.data[7];
 	stt = 0;
+	numbPack = infor_write.head->param.NumbPack;
 
-	if(ufs_WriteFile(&item, infor_write.data, infor_write.head->param.dataLen, CHECKSUM_ENABLE) != UFS_OK)
+	if(item == NULL)
 	{
-		Ret = item.err;
+		Ret = UFS_NOT_OK;
+		Respond(&Ret, 1);
+		return;
+	}
+
+	if(ufs_StreamOpen(&stream, item, CHECKSUM_ENABLE) != UFS_OK ||
+	   ufs_StreamFeed(&stream, infor_write.data, infor_write.head->param.dataLen) != UFS_OK)
+	{
+		Ret = item->err;
+	}
+
+	// Single packet upload: commit the file now
+	if(numbPack <= 1 && ufs_StreamClose(&stream) != UFS_OK)
+	{
+		Ret = item->err;
 	}
 
 	Respond(&Ret, 1);
@@ -127,9 +217,15 @@ void Service_WriteContinue(void)
 	infor_write.data = &Filecmd.data[5];
 	if( ++ stt == infor_write.head->param.stt)
 	{
-		if(ufs_WriteAppendFile(&item, infor_write.data, infor_write.head->param.dataLen, CHECKSUM_ENABLE) != UFS_OK)
+		if(ufs_StreamFeed(&stream, infor_write.data, infor_write.head->param.dataLen) != UFS_OK)
+		{
+			Ret = (item != NULL) ? item->err : UFS_NOT_OK;
+		}
+
+		// Last packet of the upload: commit the file
+		if(stt + 1 >= numbPack && ufs_StreamClose(&stream) != UFS_OK)
 		{
-			Ret = item.err;
+			Ret = (item != NULL) ? item->err : UFS_NOT_OK;
 		}
 	}
 	Respond(&Ret, 1);
@@ -144,7 +240,14 @@ void Service_ReadFile(void)
 	data[0] = UFS_OK;
 
 
-	reallen_read = ufs_ReadFile(&item, InforRead->offset, &data[5], InforRead->length);
+	if(item == NULL)
+	{
+		data[0] = UFS_NOT_OK;
+	}
+	else if(ufs_FileSeek(item, InforRead->offset) == UFS_OK)
+	{
+		reallen_read = ufs_FileRead(item, &data[5], InforRead->length);
+	}
 	data[1] = reallen_read >> 24;
 	data[2] = (reallen_read >> 16) & 0xFF;
 	data[3] = (reallen_read >> 8) & 0xFF;
@@ -162,36 +265,49 @@ void Service_ReadAllfile(void)
 {
 	Readfile_t *InforRead = (Readfile_t *)Filecmd.data;
 
-//	uint8_t *data = (uint8_t *)malloc(Handshake_infor.param.maxLen + 2);
-	uint8_t data[4096];
+	uint8_t *data = (uint8_t *)malloc(Handshake_infor.param.maxLen + 2);
+	if(data == NULL)
+	{
+		return;
+	}
 	data[0] = UFS_OK;
 
-	if(ufs_OpenItem(Ufs, InforRead->name , &item) != UFS_OK)
+	// A file read again and again is reopened from the open-file table without flash reads
+	ufs_Item_Type *file = ufs_FileOpen(Ufs, InforRead->name);
+	if(file == NULL)
 	{
 		data[0] = UFS_NOT_OK;
 		Respond(data, 1);
+		free(data);
+		return;
 	}
 
-	uint16_t numpack = item.info.comp.size / Handshake_infor.param.maxLen;
-	uint16_t lastlen = item.info.comp.size - numpack * Handshake_infor.param.maxLen;
+	uint16_t numpack = file->info.comp.size / Handshake_infor.param.maxLen;
+	uint16_t lastlen = file->info.comp.size - numpack * Handshake_infor.param.maxLen;
 
-	if(lastlen > 0)
+	if(lastlen > 0 || numpack == 0)
 	{
 		numpack ++;
 	}
-	for(uint16_t count = 0; count < numpack - 1; count ++)
+	else
+	{
+		lastlen = Handshake_infor.param.maxLen;
+	}
+	// Packets are read front to back from the cursor, so the read-ahead window serves them
+	ufs_FileSeek(file, 0);
+	for(uint16_t count = 0; count + 1 < numpack; count ++)
 	{
 		data[1] = count;
-		ufs_ReadFile(&item, count * Handshake_infor.param.maxLen, &data[2], count * Handshake_infor.param.maxLen + Handshake_infor.param.maxLen);
+		ufs_FileRead(file, &data[2], Handshake_infor.param.maxLen);
 		Respond(data, Handshake_infor.param.maxLen + 2);
 	}
 	data[0] = UFS_NOT_OK;
 	data[1] = numpack - 1;
-	ufs_ReadFile(&item, (numpack - 1) * Handshake_infor.param.maxLen, &data[2], (numpack - 1) * Handshake_infor.param.maxLen + lastlen);
+	ufs_FileRead(file, &data[2], lastlen);
 	Respond(data, lastlen + 2);
 
-//	free(data);
-//	data = NULL;
+	ufs_FileClose(file);
+	free(data);
 }
 
 
@@ -237,11 +353,21 @@ void Service_DeleteFile(void)
 	uint8_t lenname = Filecmd.data[0];
 	uint8_t nameFile[16] = {0};
 	memcpy(nameFile, &Filecmd.data[1], lenname);
-	if(ufs_OpenItem(Ufs, nameFile , &item) == UFS_OK)
+	ufs_Item_Type *file = ufs_FileOpen(Ufs, nameFile);
+	if(file != NULL)
 	{
-		if(ufs_DeleteItem(&item) == UFS_OK)
+		// Deleting the item also releases its handle, a busy file keeps it
+		Ret[0] = ufs_DeleteItem(file);
+		if(Ret[0] == UFS_OK)
 		{
-			Ret[0] = UFS_OK;
+			if(file == item)
+			{
+				item = NULL;
+			}
+		}
+		else
+		{
+			ufs_FileClose(file);
 		}
 	}
 
@@ -257,12 +383,14 @@ void Service_RealName(void)
 
 	memcpy(nameFile, &Filecmd.data[1], len_nameFile);
 	memcpy(newName, &Filecmd.data[len_nameFile + 2], len_newName);
-	if(ufs_OpenItem(Ufs, nameFile , &item) == UFS_OK)
+	ufs_Item_Type *file = ufs_FileOpen(Ufs, nameFile);
+	if(file != NULL)
 	{
-		if(ufs_RenameItem(&item, newName) == UFS_OK)
+		if(ufs_RenameItem(file, newName) == UFS_OK)
 		{
 			Ret[0] = UFS_OK;
 		}
+		ufs_FileClose(file);
 	}
 	Respond(Ret, 1);
 }
@@ -272,14 +400,18 @@ void Service_WriteFlash(void)
 {
 	uint8_t data[2048];
 	uint8_t percent = 0;
-	uint32_t total_len = item.info.comp.size;
+	uint32_t total_len = (item != NULL) ? item->info.comp.size : 0;
 	uint32_t lenRead = 2048;
 	uint32_t lenWrite = 0;
 	uint32_t offset = 0;
 	uint32_t addr_write = ADDR_START;
+	if(total_len == 0)
+	{
+		return;
+	}
 	Flash_erase(SECTOR_START);
 	do{
-		lenWrite = ufs_ReadFile(&item, offset, data, lenRead);
+		lenWrite = ufs_ReadFile(item, offset, data, lenRead);
 		Flash_Write(addr_write, data, lenWrite);
 		addr_write += lenWrite;
 		offset += lenWrite;
@@ -290,6 +422,15 @@ void Service_WriteFlash(void)
 		percent = (offset * 100 )/ total_len;
 		Respond(&percent, 1);
 	}while(offset != total_len);
+
+	// Check the programmed image against the CRC of the file, a bad image is not left behind
+	uint32_t crc = 0;
+	if(ufs_GetFileCrc(item, &crc) != UFS_OK || crc != ufs_KernelCrc32(0, (const uint8_t *)ADDR_START, total_len))
+	{
+		Flash_erase(SECTOR_START);
+		percent = WRITE_FLASH_CRC_FAIL;
+		Respond(&percent, 1);
+	}
 }
 
 void jumb(void)
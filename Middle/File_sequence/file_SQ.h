@@ -11,6 +11,11 @@ extern "C"
 
 
 
+// Protocol versions, a host announces its version in the Handshake command
+#define FILE_SQ_PROTOCOL_BASE		1	// Hosts that send an empty Handshake
+#define FILE_SQ_PROTOCOL_CRC		2	// The OpenFile reply also carries the CRC32 of the file
+#define FILE_SQ_PROTOCOL_VERSION	FILE_SQ_PROTOCOL_CRC	// Highest version this firmware speaks
+
 typedef struct
 {
 	uint8_t 	Cmd_id;
@@ -87,6 +92,7 @@ typedef void (*SendPacket)(uint8_t *data, uint16_t length);
 
 void FileMng_init(void);
 void ServiceHandle(uint8_t *data, uint16_t length);
+void FileMng_Idle(void);
 void respond_addEvent(SendPacket callback);
 
 #ifdef __cplusplus
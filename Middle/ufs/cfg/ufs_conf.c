@@ -1,6 +1,32 @@
 
 #include "ufs_conf.h"
 #include "MemFlash.h"
+#include "stm32f4xx_hal.h"
+#include "cmsis_os.h"
+
+/**
+ * @brief Sleeps one tick while a file lock is held by another task.
+ */
+static void Ufs_Yield(void)
+{
+    osDelay(1);
+}
+
+#if UFS_KERNEL_BENCH == UFS_OK
+/**
+ * @brief Reads the DWT cycle counter of the core, the counter is started on the first call.
+ */
+uint32_t Ufs_Cycles(void)
+{
+    if ((DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk) == 0)
+    {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CYCCNT = 0;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    }
+    return DWT->CYCCNT;
+}
+#endif
 
 /**
  * @brief List of supported file extensions for encoding.
@@ -24,11 +50,15 @@ ufs_Api_Type Api_Mapping =
 {
     .Init              = (ufs_Init *)MemFlash_Init,               /**< Initialization function */
     .WriteSector       = (ufs_WriteSector *)MemFlash_WriteSector, /**< Function to write data to a sector */
+    .WritePartial      = (ufs_WritePartial *)MemFlash_WritePartial, /**< Function to program a byte range of a sector */
     .ReadSector        = (ufs_ReadSector *)MemFlash_ReadSector,   /**< Function to read data from a sector */
+    .ReadRange         = (ufs_ReadRange *)MemFlash_ReadRange,     /**< Function to read a byte range across sectors */
     .EraseSector       = (ufs_EraseSector *)MemFlash_EraseSector, /**< Function to erase a sector */
 	.EraseBlock		   = (ufs_EraseSector *)MemFlash_EraseBlock,  /**< Function to erase a block */
     .EraseChip         = (ufs_EraseChip *)MemFlash_EraseChip,     /**< Function to erase the entire chip */
     .ReadUniqueID      = (ufs_ReadUniqueID *)MemFlash_ReadID,     /**< Function to read the unique ID of the device */
+    .GetTick           = (ufs_GetTick *)HAL_GetTick,              /**< Millisecond tick used by the metadata commit threshold */
+    .Yield             = Ufs_Yield,                               /**< Sleep while a file lock is busy */
     .u16numberByteOfSector   = 4096,                                /**< Number of bytes per sector */
 	.u16numberSectorOfBlock  = 16,                                /**< Number of sector per Block */
     .u32numberSectorOfDevice = 4096                                /**< Total number of sectors in the device */
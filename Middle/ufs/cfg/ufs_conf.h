@@ -25,6 +25,151 @@ extern "C" {
  */
 #define UFS_NUMB_OF_ENCODE_EXTENSION   3
 
+/**
+ * @brief Number of cluster mapping sectors kept in RAM.
+ *        Each slot costs one sector of heap. Dirty slots are written back on
+ *        eviction, ufs_CloseItem(), ufs_Sync() and ufs_Unmount().
+ */
+#define UFS_MAP_CACHE_SLOTS            2
+
+/**
+ * @brief Number of hash buckets of the in-RAM item index.
+ *        Items are hashed on (parent id, name, extension).
+ */
+#define UFS_ITEM_INDEX_BUCKETS         32
+
+/**
+ * @brief Number of extents added to the cluster list of a file each time it grows.
+ *        A file whose clusters are contiguous needs a single extent.
+ */
+#define UFS_EXTENT_GROW                4
+
+/**
+ * @brief Number of handles in the open-file table.
+ */
+#define UFS_OPEN_FILES                 4
+
+/**
+ * @brief Number of closed files whose location and cluster extents are kept for a fast reopen.
+ */
+#define UFS_RECENT_FILES               4
+
+/**
+ * @brief Number of sectors per cluster used by ufs_FastFormat(). Small files take
+ *        one cluster, so small clusters let many of them share the device.
+ *        0 rounds the cluster up to one erase block. A device keeps the cluster
+ *        size it was formatted with.
+ */
+#define UFS_SECTORS_PER_CLUSTER        1
+
+/**
+ * @brief Number of erase blocks worth of clusters a stream allocates at once when it runs out of space.
+ *        Clusters left unused are released by ufs_StreamClose().
+ */
+#define UFS_STREAM_BLOCKS_AHEAD        2
+
+/**
+ * @brief Number of full sectors a stream keeps in RAM before programming them.
+ *        ufs_StreamFeed() only copies data into the ring and returns, the sectors are
+ *        programmed by ufs_Drain(), ufs_Sync() or ufs_StreamClose(), or by the feed
+ *        itself once the ring is full. Each open stream takes this many sectors of RAM,
+ *        plus the one being staged.
+ *        0 programs every sector as soon as it is full.
+ */
+#define UFS_WRITE_BEHIND_SECTORS       4
+
+/**
+ * @brief Largest number of bytes a queued read or write request moves per ufs_Serve() step.
+ *        A longer request is put back in the queue after each step, behind the requests
+ *        of the same or a higher priority, so a small request does not wait for a bulk
+ *        transfer to finish. 0 serves each request in one step.
+ */
+#define UFS_REQUEST_SLICE_BYTES        16384
+
+/**
+ * @brief Number of sector buffers in the scratch pool of each UFS instance, from 1 to 8.
+ *        UFS functions borrow their sector buffers from the pool instead of the stack, a
+ *        borrow finding the pool empty allocates from the heap instead. A call holds at
+ *        most two buffers at once (a write committing item metadata), so two cover one
+ *        task and each other task calling UFS at the same time may add one.
+ */
+#define UFS_SCRATCH_SECTORS            2
+
+/**
+ * @brief Number of deleted file chains queued before they are released.
+ *        ufs_DeleteItem() and ufs_DeleteFolder() only queue the first cluster of each
+ *        chain, the chains are released in one batch by ufs_Reclaim(), ufs_Sync(), when
+ *        the queue is full or when an allocation runs out of free clusters.
+ */
+#define UFS_RECLAIM_QUEUE              16
+
+/**
+ * @brief Number of bytes written to files after which pending item metadata is committed.
+ *        Size and first cluster changes made by ufs_WriteFile() and ufs_WriteAppendFile()
+ *        are kept in RAM and written to the item zone on ufs_CloseItem(), ufs_Sync() or once
+ *        this many bytes were written. 0 commits after every write.
+ */
+#define UFS_ITEM_COMMIT_BYTES          16384
+
+/**
+ * @brief Age in milliseconds after which pending item metadata is committed by the next write.
+ *        Only used when the api provides GetTick. 0 disables the time threshold.
+ */
+#define UFS_ITEM_COMMIT_MS             1000
+
+/**
+ * @brief Build UFS for a single flash geometry known at compile time.
+ *        With UFS_OK the sector size and the block size are the constants below
+ *        instead of fields read from the api, so the sector arithmetic on the hot
+ *        paths reduces to shifts and masks. newUFS() rejects an api that does not
+ *        match the profile. The cluster size is still read from the boot sector, a
+ *        device formatted with any cluster size mounts.
+ *        UFS_NOT_OK keeps the geometry a runtime parameter.
+ */
+#define UFS_GEOMETRY_FIXED             UFS_OK
+
+/**
+ * @brief Number of bytes per sector of the fixed geometry profile, must be a power of two.
+ */
+#define UFS_FIXED_BYTES_PER_SECTOR     4096
+
+/**
+ * @brief Number of sectors per erase block of the fixed geometry profile, must be a power of two.
+ */
+#define UFS_FIXED_SECTORS_PER_BLOCK    16
+
+/**
+ * @brief Implementation of the checksum, codec, compare and blank-check kernels.
+ *        UFS_KERNEL_REFERENCE works one byte at a time, UFS_KERNEL_WORD four bytes per
+ *        32-bit word and UFS_KERNEL_SIMD uses the Cortex-M4 SIMD instructions. UFS_KERNEL_SIMD
+ *        falls back to UFS_KERNEL_WORD when the core has no SIMD instructions.
+ */
+#define UFS_KERNEL                     UFS_KERNEL_SIMD
+
+/**
+ * @brief Build ufs_KernelBench(), which times the kernels against byte-at-a-time loops.
+ *        UFS_OK adds the routine, the byte loops it compares with and Ufs_Cycles(), the
+ *        DWT cycle counter of the core. Leave UFS_NOT_OK in production builds.
+ */
+#define UFS_KERNEL_BENCH               UFS_NOT_OK
+
+/**
+ * @brief Verification of the data programmed by writes and streams made with CHECKSUM_ENABLE.
+ *        UFS_VERIFY_NONE reads nothing back. UFS_VERIFY_PROGRAMMED reads back only the
+ *        bytes just programmed, right after each program, and compares them with the data
+ *        written. UFS_VERIFY_DEFERRED programs first and reads back afterwards: a write
+ *        checks its sectors after the last one is programmed, a stream checks them by
+ *        batches of UFS_VERIFY_BATCH_SECTORS and on ufs_StreamClose(). A sector failing
+ *        the check marks its cluster bad with every policy but UFS_VERIFY_NONE.
+ */
+#define UFS_WRITE_VERIFY               UFS_VERIFY_PROGRAMMED
+
+/**
+ * @brief Number of sectors a stream programs before verifying them with UFS_VERIFY_DEFERRED.
+ *        Each open stream keeps a one-byte checksum per sector waiting to be verified.
+ */
+#define UFS_VERIFY_BATCH_SECTORS       16
+
 /**
  * @brief UFS configuration structure.
  *        This structure contains all configuration settings and API mappings for UFS.
@@ -32,6 +177,13 @@ extern "C" {
  */
 extern ufs_Cfg_Type Ufs_Cfg;
 
+#if UFS_KERNEL_BENCH == UFS_OK
+/**
+ * @brief Cycle counter used by ufs_KernelBench(), defined in the system configuration.
+ */
+uint32_t Ufs_Cycles(void);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,4 +1,5 @@
 #include "ufs.h"
+#include "ufs_kernel.h"
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
@@ -11,6 +12,33 @@
 
 #define BYTE_CODEC_DEFAULT  0xAA   // byte use to decode / encode
 
+#define ITEM_LAYOUT_MARK    0x80   // set in the name length of item entries written in the current layout
+
+#define UFS_CLUSTERS_ALL    0xFFFFFFFF   // resolve the whole cluster chain of a file
+
+// Flash geometry accessors, constants under the fixed profile so divides become shifts
+// The cluster size is always the one recorded on the device, so any formatted volume mounts
+#if UFS_GEOMETRY_FIXED == UFS_OK
+#if (UFS_FIXED_BYTES_PER_SECTOR & (UFS_FIXED_BYTES_PER_SECTOR - 1)) != 0 || \
+    (UFS_FIXED_SECTORS_PER_BLOCK & (UFS_FIXED_SECTORS_PER_BLOCK - 1)) != 0
+#error "UFS fixed geometry sizes must be powers of two"
+#endif
+
+#define UFS_SECTOR_SIZE(ufs)      ((uint16_t)UFS_FIXED_BYTES_PER_SECTOR)
+#define UFS_BLOCK_SECTORS(ufs)    ((uint16_t)UFS_FIXED_SECTORS_PER_BLOCK)
+#else
+#define UFS_SECTOR_SIZE(ufs)      ((ufs)->conf->api->u16numberByteOfSector)
+#define UFS_BLOCK_SECTORS(ufs)    ((ufs)->conf->api->u16numberSectorOfBlock)
+#endif
+#define UFS_CLUSTER_SECTORS(ufs)  ((ufs)->NumberSectorOfCluster)
+
+// Verification of a write made with sumEnable, as selected by UFS_WRITE_VERIFY
+#define UFS_VERIFY_NOW(sum)    (UFS_WRITE_VERIFY == UFS_VERIFY_PROGRAMMED && (sum) == CHECKSUM_ENABLE)
+#define UFS_VERIFY_LATER(sum)  (UFS_WRITE_VERIFY == UFS_VERIFY_DEFERRED && (sum) == CHECKSUM_ENABLE)
+
+// Used by the allocator before the item zone helpers are defined
+static void ufs_ReclaimFor(UFS *ufs, uint16_t count);
+
 /**
  * @brief   Compares two byte arrays for equality.
  *
@@ -25,18 +53,8 @@
  */
 ufs_ReturnType ufs_BytesCmp(uint8_t *pSrcData, uint8_t *pDesData, uint16_t u16NumbOfByte)
 {
-    // Iterate over each byte and compare
-    for (uint16_t countByte = 0; countByte < u16NumbOfByte; countByte++)
-    {
-        // If any byte is different, return E_NOT_OK
-        if (pSrcData[countByte] != pDesData[countByte])
-        {
-            return UFS_NOT_OK;
-        }
-    }
-
-    // If all bytes are equal, return E_OK
-    return UFS_OK;
+    // Compare a word at a time
+    return ufs_KernelCompare(pSrcData, pDesData, u16NumbOfByte);
 }
 
 /**
@@ -52,15 +70,8 @@ ufs_ReturnType ufs_BytesCmp(uint8_t *pSrcData, uint8_t *pDesData, uint16_t u16Nu
  */
 static uint8_t ufs_CheckSum(uint8_t *data, uint32_t len)
 {
-    uint8_t checksum = 0;
-
-    // Sum each byte in the array
-    for (uint32_t i = 0; i < len; i++)
-    {
-        checksum += data[i];
-    }
-
-    return checksum ^ BYTE_CODEC_DEFAULT;
+    // Sum the bytes a word at a time
+    return ufs_KernelSum(data, len) ^ BYTE_CODEC_DEFAULT;
 }
 
 /**
@@ -139,1762 +150,5088 @@ static void ufs_ParseNameFile(uint8_t *name, ufs_Name_Type *name_parser)
 }
 
 /**
- * @brief   Retrieves the list of clusters associated with a file.
- *
- * This function reads the cluster chain for the given file, starting from
- * the first cluster and following the chain until the end. It updates the
- * cluster array in the `item` structure.
+ * @brief   Writes one dirty cluster mapping sector back to the UFS.
  *
- * @param[in]   ufs   Pointer to the UFS structure.
- * @param[in]   item  Pointer to the UFS item structure that contains file information.
+ * When every changed entry only clears bits of its value on the device and
+ * the device supports WritePartial, only the changed entries are programmed
+ * in place. Otherwise the sector is erased and rewritten.
  *
- * @return      ufs_ReturnType    UFS_OK on success, UFS_NOT_OK on failure.
+ * @param[in]   ufs    Pointer to the UFS structure.
+ * @param[in]   slot   Pointer to the cache slot to write back.
  */
-static ufs_ReturnType ufs_GetListCluster(UFS *ufs, ufs_Item_Type *item)
+static void ufs_MapCacheWriteBack(UFS *ufs, ufs_MapCache_Type *slot)
 {
-    uint16_t *valueSlot;
-    uint16_t idSector = 0;
-    uint16_t idSector_old = 0;
-    uint16_t position = 0;
-
-    // Allocate memory for reading data from one sector
-    uint8_t data_sector[ufs->conf->api->u16numberByteOfSector];
-
-    // Calculate the number of clusters needed based on the file size
-    uint32_t file_size_in_bytes = item->info.comp.size;
-    uint32_t cluster_size_in_bytes = ufs->conf->api->u16numberByteOfSector * ufs->NumberSectorOfCluster;
-    item->clusters.length = (file_size_in_bytes + cluster_size_in_bytes - 1) / cluster_size_in_bytes + 1;
+    if (slot->sector_id == 0xFFFF || slot->dirty == 0)
+    {
+        return;
+    }
 
-    if(file_size_in_bytes == 0)
+    // Setting a bit back to 1 can only be done by erasing the sector
+    for (uint8_t countEntry = 0; countEntry < slot->journalLength; countEntry++)
     {
-    	item->clusters.length ++;
+        uint16_t value = ((uint16_t *)slot->data)[slot->journalPosition[countEntry]];
+        if ((slot->journalValue[countEntry] & value) != value)
+        {
+            slot->needErase = 1;
+        }
     }
 
-    // Reallocate memory for the clusters array
-    item->clusters.value = (uint16_t *)realloc(item->clusters.value, item->clusters.length * sizeof(uint16_t));
-    if (item->clusters.value == NULL)
+    if (slot->needErase == 0 && ufs->conf->api->WritePartial != NULL)
+    {
+        // Only 1 -> 0 transitions: program the touched entries
+        ufs->conf->api->WritePartial(ufs->ClusterMappingZoneFirstSector + slot->sector_id, slot->dirtyFirst * 2,
+                                     &slot->data[slot->dirtyFirst * 2], (slot->dirtyLast - slot->dirtyFirst + 1) * 2);
+        ufs->stats.MapSectorProgram++;
+    }
+    else
     {
-        return UFS_NOT_OK;   // Memory allocation failure
+        ufs->conf->api->EraseSector(ufs->ClusterMappingZoneFirstSector + slot->sector_id);
+        ufs->conf->api->WriteSector(ufs->ClusterMappingZoneFirstSector + slot->sector_id, slot->data, UFS_SECTOR_SIZE(ufs));
+        ufs->stats.MapSectorErase++;
+        ufs->stats.MapSectorWrite++;
     }
-    // Initialize the clusters array to invalid values (0xFFFF)
-    memset(item->clusters.value, 0xFF, item->clusters.length * sizeof(uint16_t));
 
-    // Set the first cluster of the file from the file metadata
-    item->clusters.value[0] = (item->info.comp.first_cluster.sector_id *
-                               (ufs->conf->api->u16numberByteOfSector / 2)) +
-                               item->info.comp.first_cluster.position;
+    slot->dirty = 0;
+    slot->needErase = 0;
+    slot->journalLength = 0;
+    slot->dirtyFirst = 0xFFFF;
+    slot->dirtyLast = 0;
+}
 
-    // Get the initial sector and position for the first cluster
-    idSector = item->clusters.value[0] / (ufs->conf->api->u16numberByteOfSector / 2);
-    position = item->clusters.value[0] % (ufs->conf->api->u16numberByteOfSector / 2);
-    idSector_old = idSector;
+/**
+ * @brief   Returns the cache slot holding a sector of the cluster mapping zone.
+ *
+ * On a miss the least recently used slot is written back (if dirty) and
+ * reloaded with the requested sector.
+ *
+ * @param[in]   ufs        Pointer to the UFS structure.
+ * @param[in]   idSector   Sector index inside the cluster mapping zone.
+ *
+ * @return      ufs_MapCache_Type*  Slot holding the sector.
+ */
+static ufs_MapCache_Type *ufs_MapCacheLoad(UFS *ufs, uint16_t idSector)
+{
+    ufs_MapCache_Type *victim = &ufs->MapCache[0];
 
-    // Read the initial sector
-    ufs->conf->api->ReadSector(ufs->ClusterMappingZoneFirstSector + idSector, data_sector, ufs->conf->api->u16numberByteOfSector);
+    ufs->MapCacheTick++;
 
-    // Iterate through the clusters and build the cluster chain
-    for (uint16_t countSlot = 1; countSlot < item->clusters.length; countSlot++)
+    for (uint8_t countSlot = 0; countSlot < UFS_MAP_CACHE_SLOTS; countSlot++)
     {
-        // Update sector and position for the current cluster
-        idSector = item->clusters.value[countSlot - 1] / (ufs->conf->api->u16numberByteOfSector / 2);
-        position = item->clusters.value[countSlot - 1] % (ufs->conf->api->u16numberByteOfSector / 2);
+        ufs_MapCache_Type *slot = &ufs->MapCache[countSlot];
 
-        // If the sector has changed, read the new sector
-        if (idSector_old != idSector)
+        if (slot->sector_id == idSector)
         {
-            idSector_old = idSector;
-            ufs->conf->api->ReadSector(ufs->ClusterMappingZoneFirstSector + idSector, data_sector, ufs->conf->api->u16numberByteOfSector);
+            slot->age = ufs->MapCacheTick;
+            ufs->stats.MapCacheHit++;
+            return slot;
         }
 
-        // Get the value of the next cluster in the chain
-        valueSlot = (uint16_t *)&data_sector[position * 2];
-        item->clusters.value[countSlot] = *valueSlot;
-
-        // Handle different cluster states
-        if (item->clusters.value[countSlot] == UFS_CLUSTER_END)
-        {
-            return UFS_OK;
-        }
-        else if (item->clusters.value[countSlot] == UFS_CLUSTER_FREE)
-        {
-            // If a free cluster is found, mark it as the end of the chain
-            item->clusters.value[countSlot] = UFS_CLUSTER_END;
-            return UFS_OK;
-        }
-        else if (item->clusters.value[countSlot] == UFS_CLUSTER_BAD)
+        // Prefer an empty slot, otherwise the oldest one
+        if (victim->sector_id != 0xFFFF && (slot->sector_id == 0xFFFF || slot->age < victim->age))
         {
-            // If a bad cluster is encountered, set an error in the item
-            item->err = UFS_ERROR_MEM_SECTOR_BAD;
-            return UFS_NOT_OK;
+            victim = slot;
         }
     }
 
-    // Ensure the last cluster in the list is marked as the end of the chain
-    item->clusters.value[item->clusters.length - 1] = UFS_CLUSTER_END;
+    ufs_MapCacheWriteBack(ufs, victim);
 
-    return UFS_OK;
+    ufs->conf->api->ReadSector(ufs->ClusterMappingZoneFirstSector + idSector, victim->data, UFS_SECTOR_SIZE(ufs));
+    victim->sector_id = idSector;
+    victim->dirty = 0;
+    victim->needErase = 0;
+    victim->journalLength = 0;
+    victim->dirtyFirst = 0xFFFF;
+    victim->dirtyLast = 0;
+    victim->age = ufs->MapCacheTick;
+    ufs->stats.MapCacheMiss++;
+
+    return victim;
 }
 
 /**
- * @brief   Frees the list of clusters associated with a file.
+ * @brief   Writes every dirty cluster mapping sector back to the UFS.
  *
- * This function marks all clusters in the list as free and updates
- * the cluster mapping accordingly. The clusters are processed in reverse
- * order, and the corresponding sectors are written back to the UFS.
- *
- * @param[in]   ufs       Pointer to the UFS structure.
- * @param[in]   clusters  Pointer to the list of cluster IDs.
- * @param[in]   length    Number of clusters in the list.
+ * @param[in]   ufs   Pointer to the UFS structure.
+ */
+static void ufs_MapCacheFlush(UFS *ufs)
+{
+    for (uint8_t countSlot = 0; countSlot < UFS_MAP_CACHE_SLOTS; countSlot++)
+    {
+        ufs_MapCacheWriteBack(ufs, &ufs->MapCache[countSlot]);
+    }
+}
+
+/**
+ * @brief   Drops every cached cluster mapping sector without writing it back.
  *
- * @return      ufs_ReturnType    UFS_OK on success, UFS_NOT_OK on failure.
+ * @param[in]   ufs   Pointer to the UFS structure.
  */
-static ufs_ReturnType ufs_CleanClusters(UFS *ufs, uint16_t *clusters, uint16_t length)
+static void ufs_MapCacheInvalidate(UFS *ufs)
 {
-    // If the cluster list is too short, there's nothing to clean
-    if (length < 2)
+    for (uint8_t countSlot = 0; countSlot < UFS_MAP_CACHE_SLOTS; countSlot++)
     {
-        return UFS_NOT_OK;
+        ufs->MapCache[countSlot].sector_id = 0xFFFF;
+        ufs->MapCache[countSlot].dirty = 0;
+        ufs->MapCache[countSlot].needErase = 0;
+        ufs->MapCache[countSlot].journalLength = 0;
+        ufs->MapCache[countSlot].dirtyFirst = 0xFFFF;
+        ufs->MapCache[countSlot].dirtyLast = 0;
+        ufs->MapCache[countSlot].age = 0;
     }
+}
+
+/**
+ * @brief   Reads one entry of the cluster map.
+ *
+ * @param[in]   ufs       Pointer to the UFS structure.
+ * @param[in]   cluster   Index of the cluster.
+ *
+ * @return      uint16_t  Value stored for the cluster (next cluster or ufs_LUTClusterStatus).
+ */
+static uint16_t ufs_MapGetEntry(UFS *ufs, uint16_t cluster)
+{
+    uint16_t numberSlotOfSector = UFS_SECTOR_SIZE(ufs) / 2;
+    ufs_MapCache_Type *slot = ufs_MapCacheLoad(ufs, cluster / numberSlotOfSector);
 
-    uint16_t idSector = 0, idSector_old = 0, position = 0;
-    uint16_t *valueSlot;
+    return ((uint16_t *)slot->data)[cluster % numberSlotOfSector];
+}
 
-    // Allocate memory for sector data
-    uint8_t data_sector[ufs->conf->api->u16numberByteOfSector];
+/**
+ * @brief   Updates one entry of the cluster map in the cache.
+ *
+ * @param[in]   ufs       Pointer to the UFS structure.
+ * @param[in]   cluster   Index of the cluster.
+ * @param[in]   value     New value of the entry.
+ */
+static void ufs_MapSetEntry(UFS *ufs, uint16_t cluster, uint16_t value)
+{
+    uint16_t numberSlotOfSector = UFS_SECTOR_SIZE(ufs) / 2;
+    ufs_MapCache_Type *slot = ufs_MapCacheLoad(ufs, cluster / numberSlotOfSector);
+    uint16_t position = cluster % numberSlotOfSector;
+    uint16_t *entry = &((uint16_t *)slot->data)[position];
 
-    // Start with the second-to-last cluster
-    idSector = clusters[length - 2] / (ufs->conf->api->u16numberByteOfSector / 2);
-    position = clusters[length - 2] % (ufs->conf->api->u16numberByteOfSector / 2);
-    idSector_old = idSector;
+    if (*entry != value)
+    {
+        // Remember the value on the device the first time the entry changes
+        uint8_t countEntry = 0;
+        while (countEntry < slot->journalLength && slot->journalPosition[countEntry] != position)
+        {
+            countEntry++;
+        }
+        if (countEntry == slot->journalLength)
+        {
+            if (slot->journalLength < UFS_MAP_JOURNAL_LENGTH)
+            {
+                slot->journalPosition[countEntry] = position;
+                slot->journalValue[countEntry] = *entry;
+                slot->journalLength++;
+            }
+            else
+            {
+                slot->needErase = 1;  // Too many changes to check, rewrite the sector
+            }
+        }
+        if (position < slot->dirtyFirst)
+        {
+            slot->dirtyFirst = position;
+        }
+        if (position > slot->dirtyLast)
+        {
+            slot->dirtyLast = position;
+        }
 
-    // Read the corresponding sector for the second-to-last cluster
-    ufs->conf->api->ReadSector(ufs->ClusterMappingZoneFirstSector + idSector, data_sector, ufs->conf->api->u16numberByteOfSector);
+        *entry = value;
+        slot->dirty = 1;
+    }
 
-    // Loop through clusters in reverse order, freeing them
-    for (int16_t countSlot = length - 1; countSlot > 0; countSlot--)
+    // Keep the free bitmap and the used space in step with the map
+    if (ufs->FreeBitmap != NULL && cluster < ufs->NumberCluster)
     {
-        // Calculate the sector and position of the current cluster
-        idSector = clusters[countSlot - 1] / (ufs->conf->api->u16numberByteOfSector / 2);
-        position = clusters[countSlot - 1] % (ufs->conf->api->u16numberByteOfSector / 2);
+        uint32_t mask = 1UL << (cluster & 0x1F);
+        uint32_t cluster_size = UFS_SECTOR_SIZE(ufs) * UFS_CLUSTER_SECTORS(ufs);
 
-        // If the sector changes, write the previous sector and read the new one
-        if (idSector_old != idSector)
+        if (value == UFS_CLUSTER_FREE)
         {
-            // Write the modified sector back to the UFS
-        	ufs->conf->api->EraseSector(ufs->ClusterMappingZoneFirstSector + idSector_old);
-            ufs->conf->api->WriteSector(ufs->ClusterMappingZoneFirstSector + idSector_old, data_sector, ufs->conf->api->u16numberByteOfSector);
+            if ((ufs->FreeBitmap[cluster >> 5] & mask) == 0)
+            {
+                ufs->UsedSize -= cluster_size;
+            }
+            ufs->FreeBitmap[cluster >> 5] |= mask;
 
-            // Read the new sector
-            idSector_old = idSector;
-            ufs->conf->api->ReadSector(ufs->ClusterMappingZoneFirstSector + idSector, data_sector, ufs->conf->api->u16numberByteOfSector);
+            // A released cluster still holds its data, it has to be erased again
+            if (ufs->CleanBitmap != NULL)
+            {
+                ufs->CleanBitmap[cluster >> 5] &= ~mask;
+            }
         }
-
-        // Mark the cluster as free
-        valueSlot = (uint16_t *)&data_sector[position * 2];
-        if(*valueSlot != UFS_CLUSTER_BAD)
+        else
         {
-        	*valueSlot = UFS_CLUSTER_FREE;
+            if ((ufs->FreeBitmap[cluster >> 5] & mask) != 0)
+            {
+                ufs->UsedSize += cluster_size;
+            }
+            ufs->FreeBitmap[cluster >> 5] &= ~mask;
         }
+    }
+}
+
+/**
+ * @brief   Builds the in-RAM free cluster bitmap from the cluster map.
+ *
+ * One bit is kept per cluster of the data zone, set when the cluster is free.
+ * The bitmap is built once at mount/format and then kept up to date by
+ * ufs_MapSetEntry(), so allocations never have to scan the map sectors.
+ * The clean bitmap is reset along with it, the erase state of free clusters
+ * is unknown until ufs_PreErase() visits them.
+ *
+ * @param[in]   ufs   Pointer to the UFS structure.
+ *
+ * @return      ufs_ReturnType    UFS_OK on success, UFS_NOT_OK on allocation failure.
+ */
+static ufs_ReturnType ufs_BuildFreeBitmap(UFS *ufs)
+{
+    ufs->NumberCluster = (ufs->conf->api->u32numberSectorOfDevice - ufs->ClusterDataZoneFirstSector) / UFS_CLUSTER_SECTORS(ufs);
+
+    uint16_t numberWord = (ufs->NumberCluster + 31) >> 5;
+    uint32_t *bitmap = (uint32_t *)realloc(ufs->FreeBitmap, numberWord * sizeof(uint32_t));
+    if (bitmap == NULL)
+    {
+        return UFS_NOT_OK;
+    }
+    memset(bitmap, 0x00, numberWord * sizeof(uint32_t));
+    ufs->FreeBitmap = bitmap;
+
+    uint32_t *clean = (uint32_t *)realloc(ufs->CleanBitmap, numberWord * sizeof(uint32_t));
+    if (clean == NULL)
+    {
+        return UFS_NOT_OK;
+    }
+    memset(clean, 0x00, numberWord * sizeof(uint32_t));
+    ufs->CleanBitmap = clean;
+    ufs->CleanCursor = 0;
 
-        // Update the used size
-        ufs->UsedSize -= ufs->conf->api->u16numberByteOfSector * ufs->NumberSectorOfCluster;
-        if(ufs->UsedSize < 0)
+    uint16_t numberFree = 0;
+    for (uint16_t cluster = 0; cluster < ufs->NumberCluster; cluster++)
+    {
+        if (ufs_MapGetEntry(ufs, cluster) == UFS_CLUSTER_FREE)
         {
-        	ufs->UsedSize = 0;
+            bitmap[cluster >> 5] |= (1UL << (cluster & 0x1F));
+            numberFree++;
         }
     }
 
-    // Write the last modified sector back to the UFS
-    ufs->conf->api->EraseSector(ufs->ClusterMappingZoneFirstSector + idSector);
-    ufs->conf->api->WriteSector(ufs->ClusterMappingZoneFirstSector + idSector, data_sector, ufs->conf->api->u16numberByteOfSector);
+    // Seed the used space, ufs_MapSetEntry() keeps it up to date from now on
+    ufs->UsedSize = (int32_t)(ufs->NumberCluster - numberFree) * UFS_SECTOR_SIZE(ufs) * UFS_CLUSTER_SECTORS(ufs);
 
     return UFS_OK;
 }
 
 /**
- * @brief   Orders and allocates clusters in the UFS.
+ * @brief   Finds a free cluster using the free cluster bitmap.
  *
- * This function finds free clusters in the UFS, orders them, and writes the
- * necessary mapping to the cluster mapping zone. It updates the latest cluster
- * information and ensures that the clusters are linked sequentially.
+ * The cluster right after `previous` is taken when it is free, so a chain
+ * grows into a contiguous run. Otherwise the bitmap is scanned one word at a
+ * time starting right after `latest_cluster` and wrapping around the device,
+ * so allocations are spread over the whole data zone. Clusters already erased
+ * by ufs_PreErase() are looked for first, any free cluster after that.
  *
- * @param[in]   ufs       Pointer to the UFS structure.
- * @param[out]  clusters  Pointer to the array that will hold the ordered cluster IDs.
- * @param[in]   length    Number of clusters to allocate and order.
+ * @param[in]   ufs        Pointer to the UFS structure.
+ * @param[in]   previous   Cluster the new one will be linked after, or 0xFFFF.
  *
- * @return      ufs_ReturnType    UFS_OK on success, UFS_NOT_OK on failure.
+ * @return      uint16_t  Index of a free cluster, or 0xFFFF if the device is full.
  */
-static ufs_ReturnType ufs_OrderClusters(UFS *ufs, uint16_t *clusters, uint16_t length)
+static uint16_t ufs_FindFreeCluster(UFS *ufs, uint16_t previous)
 {
-    if (length < 2)
+    uint16_t numberSlotOfSector = UFS_SECTOR_SIZE(ufs) / 2;
+    uint16_t numberWord = (ufs->NumberCluster + 31) >> 5;
+    uint32_t cluster = 0xFFFF;
+
+    if (previous != 0xFFFF && (uint32_t)previous + 1 < ufs->NumberCluster &&
+        (ufs->FreeBitmap[(previous + 1) >> 5] & (1UL << ((previous + 1) & 0x1F))))
     {
-        return UFS_NOT_OK;  // No need to order if fewer than two clusters
+        // Extend the current run
+        cluster = previous + 1;
     }
-
-    uint8_t data_sector[ufs->conf->api->u16numberByteOfSector];
-
-    uint16_t sector_old = 0;
-    uint16_t countSector = ufs->latest_cluster.sector_id;
-    uint16_t countSegment = ufs->latest_cluster.position;
-    uint16_t *valueCluster;
-
-    // Find and allocate free clusters
-    for (uint16_t count_cluster = 0; count_cluster < (length - 1); count_cluster++)
+    else
     {
-        clusters[count_cluster] = 0xFFFF;  // Initialize as invalid
-
-        // Search for free cluster
-        do
+        uint32_t start = ufs->latest_cluster.sector_id * numberSlotOfSector + ufs->latest_cluster.position + 1;
+        if (start >= ufs->NumberCluster)
         {
-            if (++countSector >= (ufs->ClusterDataZoneFirstSector - ufs->ClusterMappingZoneFirstSector))
-            {
-                countSector = 0x00;  // Wrap around if sector exceeds its range
-            }
+            start = 0x00;  // Wrap around at the end of the device
+        }
 
-            if(countSector * (ufs->conf->api->u16numberByteOfSector / 2) >= \
-               (ufs->conf->api->u32numberSectorOfDevice - ufs->ClusterDataZoneFirstSector) / ufs->NumberSectorOfCluster)
+        // First pass on erased clusters only, second pass on every free cluster
+        for (uint8_t pass = (ufs->CleanBitmap != NULL) ? 0 : 1; pass < 2 && cluster == 0xFFFF; pass++)
+        {
+            // Scan numberWord + 1 words so the bits before 'start' in the first word are visited last
+            for (uint16_t countWord = 0; countWord <= numberWord; countWord++)
             {
-            	countSector = 0;
-            }
-
-            ufs->conf->api->ReadSector(ufs->ClusterMappingZoneFirstSector + countSector, data_sector, ufs->conf->api->u16numberByteOfSector);
+                uint16_t idWord = ((start >> 5) + countWord) % numberWord;
+                uint32_t bits = ufs->FreeBitmap[idWord];
 
-            countSegment = ufs->latest_cluster.position;
-            do
-            {
-                if (++countSegment >= (ufs->conf->api->u16numberByteOfSector / 2))
+                if (pass == 0)
                 {
-                    countSegment = 0x00;  // Wrap around if segment exceeds its range
+                    bits &= ufs->CleanBitmap[idWord];
                 }
 
-                if(countSegment >= (ufs->conf->api->u32numberSectorOfDevice - ufs->ClusterDataZoneFirstSector) / ufs->NumberSectorOfCluster)
+                if (countWord == 0)
+                {
+                    bits &= (0xFFFFFFFFUL << (start & 0x1F));
+                }
+                else if (countWord == numberWord)
                 {
-                	countSegment = 0;
+                    bits &= ~(0xFFFFFFFFUL << (start & 0x1F));
                 }
 
-                valueCluster = (uint16_t *)&data_sector[countSegment * 2];
-                if (*valueCluster == UFS_CLUSTER_FREE)
+                if (bits != 0)
                 {
-                    clusters[count_cluster] = countSector * (ufs->conf->api->u16numberByteOfSector / 2) + countSegment;
-                    ufs->latest_cluster.sector_id = countSector;
-                    ufs->latest_cluster.position = countSegment;
-                    if(ufs->NumberSectorOfCluster == ufs->conf->api->u16numberSectorOfBlock)
-                    {
-                    	uint16_t sectorID = ufs->ClusterDataZoneFirstSector + clusters[count_cluster] * ufs->NumberSectorOfCluster;
-                    	ufs->conf->api->EraseBlock(sectorID / ufs->NumberSectorOfCluster);
-                    }
+                    cluster = ((uint32_t)idWord << 5) + __builtin_ctzl(bits);
                     break;
                 }
-            } while (countSegment != ufs->latest_cluster.position);
-
-        } while (countSector != ufs->latest_cluster.sector_id);
-
-        if (clusters[count_cluster] == 0xFFFF)  // If no free cluster found, fail
-        {
-            return UFS_NOT_OK;
+            }
         }
     }
 
-    // Order and link clusters
-    clusters[length - 1] = UFS_CLUSTER_END;  // Mark end of cluster chain
-    countSector = clusters[0] / (ufs->conf->api->u16numberByteOfSector / 2);
-    countSegment = clusters[0] % (ufs->conf->api->u16numberByteOfSector / 2);
+    if (cluster == 0xFFFF)
+    {
+        return 0xFFFF;
+    }
 
-    ufs->conf->api->ReadSector(ufs->ClusterMappingZoneFirstSector + countSector, data_sector, ufs->conf->api->u16numberByteOfSector);
-    sector_old = countSector;
+    ufs->latest_cluster.sector_id = cluster / numberSlotOfSector;
+    ufs->latest_cluster.position = cluster % numberSlotOfSector;
+    return cluster;
+}
 
-    for (uint16_t count_cluster = 0; count_cluster < (length - 1); count_cluster++)
+/**
+ * @brief   Appends a cluster to the tail of a cluster list.
+ *
+ * The cluster extends the last run when it directly follows it, otherwise a
+ * new run is started and the run array grows by UFS_EXTENT_GROW entries when full.
+ *
+ * @param[in,out]   list      Pointer to the cluster list.
+ * @param[in]       cluster   Index of the cluster to append.
+ *
+ * @return      ufs_ReturnType    UFS_OK on success, UFS_NOT_OK on failure.
+ */
+static ufs_ReturnType ufs_ExtentAppend(ufs_ListClusterID_Type *list, uint16_t cluster)
+{
+    if (list->number > 0)
     {
-        countSector = clusters[count_cluster] / (ufs->conf->api->u16numberByteOfSector / 2);
-        countSegment = clusters[count_cluster] % (ufs->conf->api->u16numberByteOfSector / 2);
+        ufs_Extent_Type *last = &list->extent[list->number - 1];
 
-        if (sector_old != countSector)  // Write previous sector and read new one
+        // Contiguous with the last run, only the run grows
+        if ((uint32_t)last->start + last->count == cluster && last->count < 0xFFFF)
         {
-        	ufs->conf->api->EraseSector(ufs->ClusterMappingZoneFirstSector + sector_old);
-            ufs->conf->api->WriteSector(ufs->ClusterMappingZoneFirstSector + sector_old, data_sector, ufs->conf->api->u16numberByteOfSector);
-            ufs->conf->api->ReadSector(ufs->ClusterMappingZoneFirstSector + countSector, data_sector, ufs->conf->api->u16numberByteOfSector);
-            sector_old = countSector;
+            last->count++;
+            list->length++;
+            return UFS_OK;
         }
+    }
 
-        // Link the current cluster to the next
-        valueCluster = (uint16_t *)&data_sector[countSegment * 2];
-        *valueCluster = clusters[count_cluster + 1];
-
-        // Update used size
-        ufs->UsedSize += ufs->conf->api->u16numberByteOfSector * ufs->NumberSectorOfCluster;
+    if (list->number >= list->capacity)
+    {
+        ufs_Extent_Type *extent = (ufs_Extent_Type *)realloc(list->extent,
+                                   (list->capacity + UFS_EXTENT_GROW) * sizeof(ufs_Extent_Type));
+        if (extent == NULL)
+        {
+            return UFS_NOT_OK;   // Memory allocation failure
+        }
+        list->extent = extent;
+        list->capacity += UFS_EXTENT_GROW;
     }
 
-    // Write the final sector
-    ufs->conf->api->EraseSector(ufs->ClusterMappingZoneFirstSector + countSector);
-    ufs->conf->api->WriteSector(ufs->ClusterMappingZoneFirstSector + countSector, data_sector, ufs->conf->api->u16numberByteOfSector);
+    list->extent[list->number].start = cluster;
+    list->extent[list->number].count = 1;
+    list->number++;
+    list->length++;
 
     return UFS_OK;
 }
 
 /**
- * @brief   Sets a value in the cluster map of the UFS.
- *
- * This function updates the cluster mapping table by writing the provided value at the
- * specified cluster index. It calculates the sector and offset within the sector where
- * the value should be written, reads the sector, updates the value, and writes the
- * sector back to the UFS.
+ * @brief   Gets the cluster at a position of a cluster list.
  *
- * @param[in]   ufs             Pointer to the UFS structure.
- * @param[in]   cluster_index   The index of the cluster to update in the cluster map.
- * @param[in]   value           The value to set in the cluster map.
+ * @param[in]   list    Pointer to the cluster list.
+ * @param[in]   index   Position of the cluster in the chain.
+ * @param[out]  run     Number of contiguous clusters from this one to the end of its run, may be NULL.
  *
- * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK on failure.
+ * @return      uint16_t  Index of the cluster, or 0xFFFF when the position is past the end of the chain.
  */
-ufs_ReturnType ufs_SetClusterMap(UFS *ufs, uint16_t cluster_index, uint16_t value)
+static uint16_t ufs_ExtentCluster(const ufs_ListClusterID_Type *list, uint32_t index, uint16_t *run)
 {
-    // Calculate the sector index in the cluster map where the cluster index resides
-    uint16_t sector_index = cluster_index / (ufs->conf->api->u16numberByteOfSector / 2);  // Divide by half the sector size (because of 16-bit values)
-    uint16_t offset_within_sector = cluster_index % (ufs->conf->api->u16numberByteOfSector / 2);  // Offset within the sector for the specific cluster entry
-
-    // Allocate memory for the sector buffer
-    uint8_t data_sector[ufs->conf->api->u16numberByteOfSector];
-
-    uint16_t *valueCluster = NULL;
-
-    // Read the sector that contains the cluster map entry
-    ufs->conf->api->ReadSector(ufs->ClusterMappingZoneFirstSector + sector_index, data_sector, ufs->conf->api->u16numberByteOfSector);
-
-    // Locate the exact position of the cluster map entry in the sector
-    valueCluster = (uint16_t *)&data_sector[offset_within_sector * 2];  // Each entry is 2 bytes, so multiply offset by 2
+    for (uint16_t countExtent = 0; countExtent < list->number; countExtent++)
+    {
+        if (index < list->extent[countExtent].count)
+        {
+            if (run != NULL)
+            {
+                *run = list->extent[countExtent].count - index;
+            }
+            return list->extent[countExtent].start + index;
+        }
+        index -= list->extent[countExtent].count;
+    }
 
-    // Update the value in the cluster map
-    *valueCluster = value;
+    return 0xFFFF;
+}
 
-    // Write the updated sector back to the UFS
-    ufs->conf->api->EraseSector(ufs->ClusterMappingZoneFirstSector + sector_index);
-    ufs->conf->api->WriteSector(ufs->ClusterMappingZoneFirstSector + sector_index, data_sector, ufs->conf->api->u16numberByteOfSector);
+/**
+ * @brief   Releases the memory of a cluster list.
+ *
+ * @param[in,out]   list   Pointer to the cluster list.
+ */
+static void ufs_ExtentFree(ufs_ListClusterID_Type *list)
+{
+    free(list->extent);
+    list->extent = NULL;
+    list->number = 0;
+    list->capacity = 0;
+    list->length = 0;
+}
 
-    // Return success
-    return UFS_OK;
+/**
+ * @brief   Releases an entry of the recently closed files.
+ *
+ * @param[in]   recent   Pointer to the entry.
+ */
+static void ufs_RecentDrop(ufs_RecentFile_Type *recent)
+{
+    ufs_ExtentFree(&recent->clusters);
+    free(recent->window.buffer);
+    memset(recent, 0x00, sizeof(ufs_RecentFile_Type));
+    recent->slot = 0xFFFF;
 }
 
 /**
- * @brief   Updates file information in the UFS file system.
+ * @brief   Forgets the cached cluster extents of a recently closed file.
  *
- * This function reads the sector where the file (item) information is stored,
- * updates the information in memory, and writes the updated sector back to the
- * UFS (Universal File System).
+ * Called whenever the cluster chain of a file is replaced or released, so a
+ * later reopen resolves the new chain from the cluster map.
  *
- * @param[in]   ufs   Pointer to the UFS (Universal File System) structure.
- * @param[in]   item  Pointer to the item (file) whose information will be updated.
+ * @param[in]   ufs    Pointer to the UFS structure.
+ * @param[in]   slot   Path id of the file, 0xFFFF forgets every file.
+ */
+static void ufs_RecentForget(UFS *ufs, uint16_t slot)
+{
+    for (uint8_t countRecent = 0; countRecent < UFS_RECENT_FILES; countRecent++)
+    {
+        if (slot == 0xFFFF || ufs->Recent[countRecent].slot == slot)
+        {
+            ufs_RecentDrop(&ufs->Recent[countRecent]);
+        }
+    }
+}
+
+/**
+ * @brief   Returns the path id of an open item.
  *
- * @return      ufs_ReturnType    UFS_OK on success, UFS_NOT_OK on failure.
+ * @param[in]   item   Pointer to the UFS item structure.
+ *
+ * @return      uint16_t  Slot of the item in the item zone.
  */
-static ufs_ReturnType ufs_UpdateItemInfo(UFS *ufs, ufs_Item_Type *item)
+static uint16_t ufs_ItemSlot(ufs_Item_Type *item)
 {
-    // Allocate memory for the sector data
-    uint8_t data_sector[ufs->conf->api->u16numberByteOfSector];
+    return item->location.sector_id * (UFS_SECTOR_SIZE(item->ufs) / sizeof(ufs_ItemInfo_Type)) +
+           item->location.position;
+}
 
-    // Check if the item has a valid sector ID and no prior error
-    if (item->err != UFS_ERROR_NONE || item->location.sector_id == 0xFFFF)
+/**
+ * @brief   Takes the lock of a file, shared for reading or exclusive for writing.
+ *
+ * The lock state lives in the item index and is only changed under the
+ * metadata mutex, which is released while the lock is busy. The caller then
+ * sleeps in the api Yield function, which newUFS() requires with a mutex, so
+ * a holder of lower priority gets to run. A file lock must be taken before
+ * the metadata mutex, never while holding it.
+ *
+ * @param[in]   ufs         Pointer to the UFS structure.
+ * @param[in]   slot        Slot of the file in the item zone.
+ * @param[in]   exclusive   Non-zero to take the lock for writing.
+ */
+static void ufs_FileLock(UFS *ufs, uint16_t slot, uint8_t exclusive)
+{
+    if (slot >= ufs->ItemIndex.numberSlot)
     {
-        item->err = UFS_ERROR_INVALID_SECTOR;
-        return UFS_NOT_OK;
+        return;
     }
 
-    // Read the sector containing the item information
-    ufs->conf->api->ReadSector(ufs->ItemZoneFirstSector + item->location.sector_id, data_sector, ufs->conf->api->u16numberByteOfSector);
-    // Decode Header
-    for(uint16_t countByte = 0; countByte < ufs->conf->api->u16numberByteOfSector; countByte ++)
+    while (1)
     {
-    	if(data_sector[countByte] != 0x00)
-    	{
-    		data_sector[countByte] ^= BYTE_CODEC_DEFAULT;
-    	}
-    }
+        // Lock the mutex to ensure thread safety (check LockMutex and mutex)
+        if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
+        {
+            ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
+        }
 
-    // Update the item information in the sector data
-    memcpy(&data_sector[item->location.position * sizeof(ufs_ItemInfo_Type)], item->info.data, sizeof(ufs_ItemInfo_Type));
+        int8_t state = ufs->ItemIndex.lock[slot];
+        uint8_t taken = exclusive ? (state == 0) : (state >= 0 && state < INT8_MAX);
+        if (taken)
+        {
+            ufs->ItemIndex.lock[slot] = exclusive ? -1 : state + 1;
+        }
 
-    // Encode Header
-    for(uint16_t countByte = 0; countByte < ufs->conf->api->u16numberByteOfSector; countByte ++)
-    {
-    	if(data_sector[countByte] != 0x00)
-    	{
-    		data_sector[countByte] ^= BYTE_CODEC_DEFAULT;
-    	}
-    }
+        // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+        if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+        {
+            ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+        }
 
-    // Write the updated sector back to the UFS
-    ufs->conf->api->EraseSector(ufs->ItemZoneFirstSector + item->location.sector_id);
-    ufs->conf->api->WriteSector(ufs->ItemZoneFirstSector + item->location.sector_id, data_sector, ufs->conf->api->u16numberByteOfSector);
+        if (taken)
+        {
+            return;
+        }
 
-    // Return success
-    return UFS_OK;
+        // Let the holder finish, without a mutex there is no other task to wait for
+        if (ufs->conf->api->Yield)
+        {
+            ufs->conf->api->Yield();
+        }
+    }
 }
 
 /**
- * @brief   Performs a fast format of the UFS device.
- *
- * This function formats the UFS by erasing and re-initializing the boot sector,
- * item zone, and cluster mapping sectors. It also sets up necessary fields such as
- * the device ID and sector information.
- *
- * @param[in]   ufs   Pointer to the UFS (Universal File System) structure.
+ * @brief   Releases a lock taken with ufs_FileLock().
  *
- * @return      ufs_ReturnType    UFS_OK on success, UFS_NOT_OK on failure.
+ * @param[in]   ufs    Pointer to the UFS structure.
+ * @param[in]   slot   Slot of the file in the item zone.
  */
-ufs_ReturnType ufs_FastFormat(UFS *ufs)
+static void ufs_FileUnlock(UFS *ufs, uint16_t slot)
 {
-    // Allocate memory for one sector's worth of data
-    uint8_t data_sector[ufs->conf->api->u16numberByteOfSector];
+    if (slot >= ufs->ItemIndex.numberSlot)
+    {
+        return;
+    }
 
-    // Format the boot sector by erasing it
-    ufs->conf->api->EraseBlock(BOOT_SECTOR_ID);
-    ufs->conf->api->EraseBlock(BOOT_SECTOR_ID + 1);
-    //ufs->conf->api->EraseSector(BOOT_SECTOR_ID);
-
-    // Calculate key values to avoid redundant calculations
-    uint16_t sector_size = ufs->conf->api->u16numberByteOfSector;
-    uint16_t total_sectors = ufs->conf->api->u32numberSectorOfDevice;
-    uint16_t max_files = ufs->conf->u8NumberFileMaxOfDevice;
+    // Lock the mutex to ensure thread safety (check LockMutex and mutex)
+    if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
+    }
 
-    // Set up the item zone and cluster mapping zone
-    ufs->ItemZoneFirstSector = 0x01;
-    ufs->ClusterMappingZoneFirstSector = ((sizeof(ufs_ItemInfo_Type) * max_files) / sector_size) + ufs->ItemZoneFirstSector + 1;
+    if (ufs->ItemIndex.lock[slot] < 0)
+    {
+        ufs->ItemIndex.lock[slot] = 0;
+    }
+    else if (ufs->ItemIndex.lock[slot] > 0)
+    {
+        ufs->ItemIndex.lock[slot]--;
+    }
 
-    // Calculate sectors required for cluster mapping
-    uint16_t numberClusterMappingOfSector = sector_size / 2;
-    uint16_t numberSectorForClusterMapping = ((total_sectors - (ufs->ClusterMappingZoneFirstSector + 1)) / numberClusterMappingOfSector) + 1;
+    // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+    if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+    }
+}
 
-    // Calculate maximum sectors for cluster mapping and set up the number of sectors per cluster
-    uint16_t numberSectorMaxForClusterMapping = total_sectors / 50;
-    ufs->NumberSectorOfCluster = numberSectorForClusterMapping / numberSectorMaxForClusterMapping + 1;
+/**
+ * @brief   Resolves the cluster chain of a file up to a number of clusters.
+ *
+ * The chain is resolved lazily: an open file starts with an empty cluster
+ * list and this function follows the cluster map from the last resolved
+ * cluster only until the list holds `count` clusters, or the whole chain
+ * when fewer are used by the file. Contiguous clusters are stored as one run
+ * in the cluster list of the `item` structure. Once resolved, a cluster is
+ * never looked up in the map again.
+ *
+ * @param[in]   ufs    Pointer to the UFS structure.
+ * @param[in]   item   Pointer to the UFS item structure that contains file information.
+ * @param[in]   count  Number of clusters needed from the start of the file, UFS_CLUSTERS_ALL for the whole chain.
+ *
+ * @return      ufs_ReturnType    UFS_OK on success, UFS_NOT_OK on failure.
+ */
+static ufs_ReturnType ufs_GetListCluster(UFS *ufs, ufs_Item_Type *item, uint32_t count)
+{
+    // Calculate the number of clusters used based on the file size, an empty file owns one cluster
+    uint32_t file_size_in_bytes = item->info.comp.size;
+    uint32_t cluster_size_in_bytes = UFS_SECTOR_SIZE(ufs) * UFS_CLUSTER_SECTORS(ufs);
+    uint32_t number_clusters = (file_size_in_bytes + cluster_size_in_bytes - 1) / cluster_size_in_bytes;
+    uint16_t cluster;
 
-    if(ufs->conf->api->u16numberSectorOfBlock != 0 && ufs->NumberSectorOfCluster < ufs->conf->api->u16numberSectorOfBlock)
+    if (number_clusters == 0)
+    {
+        number_clusters = 1;
+    }
+    if (count > number_clusters)
     {
-    	ufs->NumberSectorOfCluster = ufs->conf->api->u16numberSectorOfBlock;
+        count = number_clusters;
     }
 
-    // Determine the start of the cluster data zone
-    ufs->ClusterDataZoneFirstSector = ufs->ClusterMappingZoneFirstSector +
-                                      ((ufs->NumberSectorOfCluster != 1) ? numberSectorMaxForClusterMapping : numberSectorForClusterMapping) + 1;
+    // Nothing to do when the needed part of the chain is already known
+    if (item->clusters.length >= count)
+    {
+        return UFS_OK;
+    }
 
-    ufs->ClusterDataZoneFirstSector = (ufs->ClusterDataZoneFirstSector + 0x0F) & ~0x0F;
+    if (item->clusters.length == 0)
+    {
+        // Start from the first cluster of the file from the file metadata
+        cluster = item->info.comp.first_cluster;
+    }
+    else
+    {
+        // Continue after the last resolved cluster
+        cluster = ufs_MapGetEntry(ufs, ufs_ExtentCluster(&item->clusters, item->clusters.length - 1, NULL));
+    }
 
-    // Read and store the unique device ID
-    ufs->conf->api->ReadUniqueID(ufs->DeviceId, 8);
+    // Iterate through the clusters and build the cluster chain
+    while (cluster < ufs->NumberCluster)
+    {
+        if (ufs_ExtentAppend(&item->clusters, cluster) != UFS_OK)
+        {
+            item->err = UFS_ERROR_ALLOCATE_MEM;
+            return UFS_NOT_OK;   // Memory allocation failure
+        }
 
-    // Initialize boot sector metadata
-    memset(data_sector, 0x00, sector_size);
-    data_sector[0] = 'U';
-    data_sector[1] = 'F';
-    data_sector[2] = 'S';
-    data_sector[4] = (ufs->ItemZoneFirstSector >> 8) & 0xFF;
-    data_sector[5] = ufs->ItemZoneFirstSector & 0xFF;
-    data_sector[6] = (ufs->ClusterMappingZoneFirstSector >> 8) & 0xFF;
-    data_sector[7] = ufs->ClusterMappingZoneFirstSector & 0xFF;
-    data_sector[8] = (ufs->ClusterDataZoneFirstSector >> 8) & 0xFF;
-    data_sector[9] = ufs->ClusterDataZoneFirstSector & 0xFF;
-    data_sector[10] = (ufs->NumberSectorOfCluster >> 8) & 0xFF;
-    data_sector[11] = ufs->NumberSectorOfCluster & 0xFF;
+        if (item->clusters.length >= count)
+        {
+            break;
+        }
 
-    // Copy the device ID into the boot sector
-    memcpy(&data_sector[12], ufs->DeviceId, 8);
+        // Get the value of the next cluster in the chain
+        cluster = ufs_MapGetEntry(ufs, cluster);
+    }
 
-    // Add end-of-sector markers
-    data_sector[sector_size - 3] = '\r';
-    data_sector[sector_size - 2] = '\n';
-    data_sector[sector_size - 1] = ufs_CheckSum(data_sector, sector_size - 1);
+    // A free cluster or the end marker ends the chain, a bad cluster breaks it
+    if (cluster == UFS_CLUSTER_BAD)
+    {
+        // If a bad cluster is encountered, set an error in the item
+        item->err = UFS_ERROR_MEM_SECTOR_BAD;
+        return UFS_NOT_OK;
+    }
 
-    // Write the boot sector to the device
-    ufs->conf->api->WriteSector(BOOT_SECTOR_ID, data_sector, sector_size);
+    return UFS_OK;
+}
 
-    // Format the item zone by erasing and initializing each sector
-    memset(data_sector, 0x00, sector_size);
-    for (uint16_t countSector = 0; countSector < (ufs->ClusterMappingZoneFirstSector - ufs->ItemZoneFirstSector); countSector++)
+/**
+ * @brief   Frees the tail of a cluster list.
+ *
+ * The clusters from position `from` to the end of the list are marked free in
+ * the cluster map, bad clusters are left as they are. The list is truncated
+ * and, when clusters remain, its new last cluster becomes the end of the chain.
+ *
+ * @param[in]       ufs    Pointer to the UFS structure.
+ * @param[in,out]   list   Pointer to the cluster list.
+ * @param[in]       from   Position of the first cluster to free.
+ *
+ * @return      ufs_ReturnType    UFS_OK on success, UFS_NOT_OK on failure.
+ */
+static ufs_ReturnType ufs_CleanClusters(UFS *ufs, ufs_ListClusterID_Type *list, uint16_t from)
+{
+    // If the cluster list is too short, there's nothing to clean
+    if (from >= list->length)
     {
-    	if(countSector == 0)
-    	{
-    		// Folder '/' for root in first sector of item zone
-    		data_sector[0] = (uint8_t)'/' ^ BYTE_CODEC_DEFAULT;
-    	}
-    	//ufs->conf->api->EraseSector(ufs->ItemZoneFirstSector + countSector);
-        ufs->conf->api->WriteSector(ufs->ItemZoneFirstSector + countSector, data_sector, sector_size);
+        return UFS_NOT_OK;
     }
 
-    // Format the cluster mapping zone by erasing and initializing each sector
-    memset(data_sector, 0xFF, sector_size);  // Pre-fill data_sector with 0xFF for efficiency
-    for (uint16_t countSector = 0; countSector < (ufs->ClusterDataZoneFirstSector - ufs->ClusterMappingZoneFirstSector); countSector++)
+    uint16_t position = 0;
+    uint16_t number = list->number;
+
+    for (uint16_t countExtent = 0; countExtent < list->number; countExtent++)
     {
-    	if(countSector == 0)
-    	{
-    		// Cluter Mapping for root is UFS_CLUSTER_END
-    		data_sector[0] = 0xFF ^ BYTE_CODEC_DEFAULT;
-    		data_sector[1] = 0xFD ^ BYTE_CODEC_DEFAULT;
-    	}
-    	//ufs->conf->api->EraseBlock(ufs->ClusterMappingZoneFirstSector + countSector);
-        ufs->conf->api->WriteSector(ufs->ClusterMappingZoneFirstSector + countSector, data_sector, sector_size);
+        ufs_Extent_Type *extent = &list->extent[countExtent];
+        uint16_t first = (from > position) ? (from - position) : 0;
+
+        position += extent->count;
+        if (first >= extent->count)
+        {
+            continue;   // The whole run is kept
+        }
+
+        for (uint16_t countCluster = first; countCluster < extent->count; countCluster++)
+        {
+            // Mark the cluster as free, the used size follows the free bitmap
+            if (ufs_MapGetEntry(ufs, extent->start + countCluster) != UFS_CLUSTER_BAD)
+            {
+                ufs_MapSetEntry(ufs, extent->start + countCluster, UFS_CLUSTER_FREE);
+            }
+        }
+
+        // The run that holds the first freed cluster becomes the last one
+        if (number == list->number)
+        {
+            extent->count = first;
+            number = (first > 0) ? (countExtent + 1) : countExtent;
+        }
     }
 
-    ufs->path.id = 0;
-    ufs->path.name = (uint8_t *)"/";
-    // Set the used size to zero since the device has been formatted
-    ufs->UsedSize = 0;
+    list->number = number;
+    list->length = from;
+
+    // The remaining chain ends at its new last cluster
+    if (from > 0)
+    {
+        ufs_MapSetEntry(ufs, ufs_ExtentCluster(list, from - 1, NULL), UFS_CLUSTER_END);
+    }
 
     return UFS_OK;
 }
 
 /**
- * @brief   Initializes a new UFS instance.
+ * @brief   Returns the number of clusters held by one erase block.
  *
- * This function sets up a new UFS (Universal File System) instance by
- * initializing the UFS configuration, reading the boot sector, and
- * configuring internal parameters.
+ * @param[in]   ufs   Pointer to the UFS structure.
  *
- * @param[in]  pUfsCfg   Pointer to the UFS configuration structure.
+ * @return      uint16_t  Clusters per erase block, 1 when a cluster is at least one block.
+ */
+static uint16_t ufs_ClustersOfBlock(UFS *ufs)
+{
+    uint16_t number = UFS_BLOCK_SECTORS(ufs) / UFS_CLUSTER_SECTORS(ufs);
+
+    return (number > 1) ? number : 1;
+}
+
+/**
+ * @brief   Finds a free erase block of the data zone.
  *
- * @return     UFS*      Pointer to the initialized UFS instance, or NULL if
- *                       initialization failed.
+ * Only used when clusters are smaller than an erase block, so a large
+ * allocation can start on a block boundary and be erased block by block.
+ * The search starts right after `latest_cluster` and wraps around the device,
+ * a block already erased by ufs_PreErase() is preferred.
+ *
+ * @param[in]   ufs   Pointer to the UFS structure.
+ *
+ * @return      uint16_t  First cluster of a block whose clusters are all free, or 0xFFFF if none.
  */
-UFS *newUFS(ufs_Cfg_Type *pUfsCfg)
+static uint16_t ufs_FindFreeBlock(UFS *ufs)
 {
-    // Check if the required API functions are set
-    if (pUfsCfg->api->Init == NULL || pUfsCfg->api->ReadSector == NULL ||
-        pUfsCfg->api->WriteSector == NULL || pUfsCfg->api->EraseSector == NULL ||
-        pUfsCfg->api->EraseBlock == NULL || pUfsCfg->api->EraseChip == NULL||
-		pUfsCfg->api->ReadUniqueID == NULL)
+    uint16_t clustersOfBlock = ufs_ClustersOfBlock(ufs);
+    uint16_t numberBlock = ufs->NumberCluster / clustersOfBlock;
+    uint32_t mask;
+
+    // The free bits of a block must sit in one bitmap word
+    if (clustersOfBlock < 2 || clustersOfBlock > 32 || (32 % clustersOfBlock) != 0 || numberBlock == 0)
     {
-        return NULL;  // Return NULL if any essential function is missing
+        return 0xFFFF;
     }
+    mask = (clustersOfBlock == 32) ? 0xFFFFFFFFUL : ((1UL << clustersOfBlock) - 1);
 
-    // Allocate memory for sector data and UFS instance
-    uint8_t data_sector[pUfsCfg->api->u16numberByteOfSector];
+    uint16_t latest = ufs->latest_cluster.sector_id * (UFS_SECTOR_SIZE(ufs) / 2) + ufs->latest_cluster.position;
+    uint16_t start = (latest / clustersOfBlock + 1) % numberBlock;
 
-    UFS *ufs = (UFS *)malloc(sizeof(UFS));
-    if (!ufs)
+    uint16_t found = 0xFFFF;
+    for (uint16_t countBlock = 0; countBlock < numberBlock; countBlock++)
     {
-        return NULL;
+        uint16_t cluster = ((start + countBlock) % numberBlock) * clustersOfBlock;
+
+        if (((ufs->FreeBitmap[cluster >> 5] >> (cluster & 0x1F)) & mask) == mask)
+        {
+            if (ufs->CleanBitmap == NULL || ((ufs->CleanBitmap[cluster >> 5] >> (cluster & 0x1F)) & mask) == mask)
+            {
+                return cluster;
+            }
+            if (found == 0xFFFF)
+            {
+                found = cluster;
+            }
+        }
     }
 
-    // Initialize UFS configuration
-    ufs->conf = pUfsCfg;
-    ufs->conf->api->Init();
+    return found;
+}
 
-    // Read boot sector
-    ufs->conf->api->ReadSector(BOOT_SECTOR_ID, data_sector, ufs->conf->api->u16numberByteOfSector);
+/**
+ * @brief   Erases the data sectors of a run of contiguous clusters.
+ *
+ * Every erase block fully covered by the run is erased with a single block
+ * erase, the sectors of partially covered blocks are erased one by one.
+ *
+ * @param[in]   ufs       Pointer to the UFS structure.
+ * @param[in]   cluster   Index of the first cluster of the run.
+ * @param[in]   count     Number of clusters in the run.
+ *
+ * @return      uint16_t  Number of erase operations issued.
+ */
+static uint16_t ufs_EraseClusters(UFS *ufs, uint16_t cluster, uint16_t count)
+{
+    uint16_t sectorOfBlock = UFS_BLOCK_SECTORS(ufs);
+    uint32_t sectorID = ufs->ClusterDataZoneFirstSector + (uint32_t)cluster * UFS_CLUSTER_SECTORS(ufs);
+    uint32_t sectorEnd = sectorID + (uint32_t)count * UFS_CLUSTER_SECTORS(ufs);
+    uint16_t number = 0;
 
-    // Check if the boot sector is valid
-    if (UFS_OK != ufs_BytesCmp(data_sector, (uint8_t *)"UFS", 3) ||
-        UFS_OK != ufs_BytesCmp(&data_sector[ufs->conf->api->u16numberByteOfSector - 3], (uint8_t *)"\r\n", 2) ||
-        data_sector[ufs->conf->api->u16numberByteOfSector - 1] != ufs_CheckSum(data_sector, ufs->conf->api->u16numberByteOfSector - 1))
+    while (sectorID < sectorEnd)
     {
-        // Perform fast format if boot sector is invalid
-        ufs_FastFormat(ufs);
-        return ufs;
+        if (sectorOfBlock != 0 && (sectorID % sectorOfBlock) == 0 && sectorEnd - sectorID >= sectorOfBlock)
+        {
+            ufs->conf->api->EraseBlock(sectorID / sectorOfBlock);
+            sectorID += sectorOfBlock;
+        }
+        else
+        {
+            ufs->conf->api->EraseSector(sectorID);
+            sectorID++;
+        }
+        number++;
     }
 
-    // Initialize UFS parameters from the boot sector
-    ufs->latest_cluster.sector_id = 0x00;
-    ufs->latest_cluster.position = 0x00;
-
-    ufs->ItemZoneFirstSector = (data_sector[4] << 8) | data_sector[5];
-    ufs->ClusterMappingZoneFirstSector = (data_sector[6] << 8) | data_sector[7];
-    ufs->ClusterDataZoneFirstSector = (data_sector[8] << 8) | data_sector[9];
-    ufs->NumberSectorOfCluster = (data_sector[10] << 8) | data_sector[11];
-
-    // Copy device ID from the boot sector
-    memcpy(ufs->DeviceId, &data_sector[12], 8);
+    return number;
+}
 
-    ufs->conf->api->ReadSector(ufs->ClusterMappingZoneFirstSector + 0, data_sector, ufs->conf->api->u16numberByteOfSector);
+/**
+ * @brief   Gets a run of newly reserved clusters ready to be programmed.
+ *
+ * Clusters already erased by ufs_PreErase() are only taken out of the clean
+ * bitmap, the others are erased run by run with ufs_EraseClusters().
+ *
+ * @param[in]   ufs       Pointer to the UFS structure.
+ * @param[in]   cluster   Index of the first cluster of the run.
+ * @param[in]   count     Number of clusters in the run.
+ */
+static void ufs_PrepareClusters(UFS *ufs, uint16_t cluster, uint16_t count)
+{
+    uint16_t dirty = 0;  // Length of the run still to erase, it ends right before 'cluster'
 
-    // Calculate the used size of the UFS
-    ufs->UsedSize = ufs_GetUsedSize(ufs);
+    for (uint16_t countCluster = 0; countCluster < count; countCluster++, cluster++)
+    {
+        uint32_t mask = 1UL << (cluster & 0x1F);
 
-    ufs->path.id = 0x00;
-    ufs->path.name   = (uint8_t *)"/";
+        if (ufs->CleanBitmap != NULL && (ufs->CleanBitmap[cluster >> 5] & mask))
+        {
+            ufs->CleanBitmap[cluster >> 5] &= ~mask;
+            if (dirty > 0)
+            {
+                ufs->stats.DataErase += ufs_EraseClusters(ufs, cluster - dirty, dirty);
+                dirty = 0;
+            }
+        }
+        else
+        {
+            dirty++;
+        }
+    }
 
-    return ufs;
+    if (dirty > 0)
+    {
+        ufs->stats.DataErase += ufs_EraseClusters(ufs, cluster - dirty, dirty);
+    }
 }
 
 /**
- * @brief Opens a file in the UFS system.
+ * @brief   Orders and allocates clusters in the UFS.
  *
- * This function searches for a file in the UFS system by its name. If the file
- * exists, it loads its metadata and cluster information. If it doesn't exist,
- * it attempts to create a new file entry in the UFS, allocating necessary clusters.
+ * This function finds free clusters in the UFS and appends them to the cluster
+ * list. Each cluster is searched right after the previous one, so the chain
+ * stays contiguous while free space allows it, and a new chain of at least one
+ * erase block starts on a free block. The new clusters are linked after the
+ * last cluster of the list and the last one ends the chain. They are erased
+ * run by run once all of them are reserved, whole blocks with a block erase,
+ * unless ufs_PreErase() already erased them.
+ * On failure the clusters reserved by this call are released again.
  *
- * @param[in]  ufs        Pointer to the UFS structure.
- * @param[in]  name_file  Pointer to the file name string.
- * @param[in]  item       Pointer to the UFS item structure where metadata will be stored.
+ * @param[in]       ufs     Pointer to the UFS structure.
+ * @param[in,out]   list    Pointer to the cluster list to extend.
+ * @param[in]       count   Number of clusters to allocate.
  *
- * @return ufs_ReturnType UFS_OK on success, UFS_NOT_OK if the file cannot be opened.
+ * @return      ufs_ReturnType    UFS_OK on success, UFS_NOT_OK on failure.
  */
-__fast
-ufs_ReturnType ufs_OpenItem(UFS *ufs, uint8_t *name_file, ufs_Item_Type *item)
+static ufs_ReturnType ufs_OrderClusters(UFS *ufs, ufs_ListClusterID_Type *list, uint16_t count)
 {
-    ufs_Location_Type slotItem; // Temporary variable to hold available slot information.
-    uint8_t data_sector[ufs->conf->api->u16numberByteOfSector]; // Allocates memory to read sector data.
+    uint16_t length = list->length;
+    uint16_t previous = (length > 0) ? ufs_ExtentCluster(list, length - 1, NULL) : 0xFFFF;
 
-    // Check for memory allocation failure or invalid UFS pointer.
-    if (ufs == NULL)
+    if (count == 0)
     {
-        item->err = UFS_ERROR_ALLOCATE_MEM;
-        return UFS_NOT_OK;
+        return UFS_NOT_OK;  // Nothing to allocate
     }
 
-    // Lock the mutex to ensure thread safety (check LockMutex and mutex)
-    if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
+    // Release the chains of deleted files first when the free clusters are not enough
+    ufs_ReclaimFor(ufs, count);
+
+    // Start a large new chain on a free erase block
+    uint16_t block = 0xFFFF;
+    if (previous == 0xFFFF && count >= ufs_ClustersOfBlock(ufs))
     {
-        ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
+        block = ufs_FindFreeBlock(ufs);
     }
 
-    // Initialize the slotItem and item structures to default values.
-    slotItem.sector_id = 0xFFFF;
-    slotItem.position  = 0xFFFF;
-
-    item->location.sector_id = 0xFFFF;
-    item->status = UFS_ITEM_FREE;
-    item->ufs = NULL;
-
-    // Parse the name of the file and store it in the item structure.
-    ufs_ParseNameFile(name_file, &item->info.comp.name);
-
-    // Iterate through the sectors in the item zone to find the file or an empty slot.
-    for (uint16_t countSector = 0; countSector < (ufs->ClusterMappingZoneFirstSector - ufs->ItemZoneFirstSector); countSector++)
+    // Find and allocate free clusters
+    for (uint16_t count_cluster = 0; count_cluster < count; count_cluster++)
     {
-        ufs->conf->api->ReadSector(ufs->ItemZoneFirstSector + countSector, data_sector, ufs->conf->api->u16numberByteOfSector);
-        //Decode
-        for(uint16_t countByte = 0; countByte < ufs->conf->api->u16numberByteOfSector; countByte ++)
-        {
-        	if(data_sector[countByte] != 0x00)
-        	{
-        		data_sector[countByte] ^= BYTE_CODEC_DEFAULT;
-        	}
-        }
-        // Iterate through segments within the sector to search for the file.
-        for (uint16_t countSegment = 0; countSegment < (ufs->conf->api->u16numberByteOfSector / sizeof(ufs_ItemInfo_Type)); countSegment++)
-        {
-            // Check if the file name matches the current segment.
-        	uint16_t *path_id = (uint16_t *)&data_sector[countSegment * sizeof(ufs_ItemInfo_Type) + 24u];
-            if (
-                UFS_OK == ufs_BytesCmp(item->info.comp.name.head, &data_sector[countSegment * sizeof(ufs_ItemInfo_Type)], item->info.comp.name.length) &&
-                UFS_OK == ufs_BytesCmp(item->info.comp.name.extention, &data_sector[countSegment * sizeof(ufs_ItemInfo_Type) + MAX_NAME_LENGTH], 3) &&
-				ufs->path.id == *path_id &&
-                item->info.comp.name.length == data_sector[countSegment * sizeof(ufs_ItemInfo_Type) + MAX_NAME_LENGTH + 3])
-            {
-                // If the file is found, update item metadata and exit the loop.
-                item->location.sector_id = countSector;
-                item->location.position  = countSegment;
-                memcpy(item->info.data, &data_sector[countSegment * sizeof(ufs_ItemInfo_Type)], sizeof(ufs_ItemInfo_Type));
-                if(item->info.comp.name.extention[0] != 0x00)
-                {
-                	ufs_GetListCluster(ufs, item);
-                }
+        uint16_t cluster = (count_cluster == 0 && block != 0xFFFF) ? block : ufs_FindFreeCluster(ufs, previous);
 
-                break;
+        if (cluster == 0xFFFF)  // If no free cluster found, fail
+        {
+            if (list->length > length)
+            {
+                ufs_CleanClusters(ufs, list, length);
             }
+            return UFS_NOT_OK;
+        }
 
-            // Save the first empty slot in case we need to create a new file.
-            if (data_sector[countSegment * sizeof(ufs_ItemInfo_Type)] == UFS_ITEM_FREE)
+        // Reserve the cluster so the next search skips it, it ends the chain for now
+        ufs_MapSetEntry(ufs, cluster, UFS_CLUSTER_END);
+
+        if (ufs_ExtentAppend(list, cluster) != UFS_OK)
+        {
+            ufs_MapSetEntry(ufs, cluster, UFS_CLUSTER_FREE);
+            if (list->length > length)
             {
-                slotItem.sector_id = countSector;
-                slotItem.position = countSegment;
+                ufs_CleanClusters(ufs, list, length);
             }
+            return UFS_NOT_OK;
         }
 
-        // If the file was found, break out of the outer loop.
-        if (item->location.sector_id != 0xFFFF)
+        // Link the previous cluster to the new one
+        if (previous != 0xFFFF)
         {
-            break;
+            ufs_MapSetEntry(ufs, previous, cluster);
         }
+        previous = cluster;
     }
 
-    // If no existing file was found, attempt to create a new item in the UFS.
-    if (item->location.sector_id == 0xFFFF && slotItem.sector_id != 0xFFFF)
+    // Erase the new clusters, one call per contiguous run
+    for (uint16_t index = length; index < list->length; )
     {
-    	if(item->info.comp.name.extention[0] != 0x00)
-    	{
-			uint16_t *value_cluster;
-			uint16_t countSector = 0;
-			uint16_t countSegment = 0;
+        uint16_t run = 0;
+        uint16_t cluster = ufs_ExtentCluster(list, index, &run);
+
+        if (run > list->length - index)
+        {
+            run = list->length - index;
+        }
+        ufs_PrepareClusters(ufs, cluster, run);
+        index += run;
+    }
+
+    return UFS_OK;
+}
+
+/**
+ * @brief   Sets a value in the cluster map of the UFS.
+ *
+ * This function updates the cluster mapping table by writing the provided value at the
+ * specified cluster index. It calculates the sector and offset within the sector where
+ * the value should be written, reads the sector, updates the value, and writes the
+ * sector back to the UFS.
+ *
+ * @param[in]   ufs             Pointer to the UFS structure.
+ * @param[in]   cluster_index   The index of the cluster to update in the cluster map.
+ * @param[in]   value           The value to set in the cluster map.
+ *
+ * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK on failure.
+ */
+ufs_ReturnType ufs_SetClusterMap(UFS *ufs, uint16_t cluster_index, uint16_t value)
+{
+    // Update the value in the cached cluster map, it is written back on the next flush
+    ufs_MapSetEntry(ufs, cluster_index, value);
+
+    // Return success
+    return UFS_OK;
+}
+
+/**
+ * @brief   Computes the hash bucket of an item.
+ *
+ * @param[in]   parent   Path id of the parent folder.
+ * @param[in]   name     Parsed name and extension of the item.
+ *
+ * @return      uint16_t  Bucket index in the item index.
+ */
+static uint16_t ufs_IndexHash(uint16_t parent, const ufs_Name_Type *name)
+{
+    // FNV-1a over the parent id, the name and the extension
+    uint32_t hash = 2166136261UL;
+
+    hash = (hash ^ (parent & 0xFF)) * 16777619UL;
+    hash = (hash ^ (parent >> 8)) * 16777619UL;
+    for (uint8_t countByte = 0; countByte < name->length && countByte < MAX_NAME_LENGTH; countByte++)
+    {
+        hash = (hash ^ name->head[countByte]) * 16777619UL;
+    }
+    for (uint8_t countByte = 0; countByte < 3; countByte++)
+    {
+        hash = (hash ^ name->extention[countByte]) * 16777619UL;
+    }
+
+    return hash % UFS_ITEM_INDEX_BUCKETS;
+}
+
+/**
+ * @brief   Adds a used slot to its hash bucket and to the child list of its parent.
+ *
+ * The child list is kept in slot order, so listing a folder returns its
+ * items in the same order as a scan of the item zone.
+ *
+ * @param[in]   ufs    Pointer to the UFS structure.
+ * @param[in]   slot   Path id of the item.
+ */
+static void ufs_IndexLink(UFS *ufs, uint16_t slot)
+{
+    ufs_ItemIndex_Type *index = &ufs->ItemIndex;
+    ufs_ItemInfo_Type *info = &index->info[slot];
+    uint16_t bucket = ufs_IndexHash(info->comp.parent, &info->comp.name);
+
+    index->nextHash[slot] = index->bucket[bucket];
+    index->bucket[bucket] = slot;
+
+    index->nextSibling[slot] = 0xFFFF;
+    if (info->comp.parent >= index->numberSlot)
+    {
+        return;  // Parent outside the item zone, the item is only reachable by name
+    }
+
+    uint16_t *link = &index->firstChild[info->comp.parent];
+    while (*link != 0xFFFF && *link < slot)
+    {
+        link = &index->nextSibling[*link];
+    }
+    index->nextSibling[slot] = *link;
+    *link = slot;
+}
+
+/**
+ * @brief   Removes a used slot from its hash bucket and from its parent's child list.
+ *
+ * @param[in]   ufs    Pointer to the UFS structure.
+ * @param[in]   slot   Path id of the item.
+ */
+static void ufs_IndexUnlink(UFS *ufs, uint16_t slot)
+{
+    ufs_ItemIndex_Type *index = &ufs->ItemIndex;
+    ufs_ItemInfo_Type *info = &index->info[slot];
+    uint16_t *link = &index->bucket[ufs_IndexHash(info->comp.parent, &info->comp.name)];
+
+    while (*link != 0xFFFF)
+    {
+        if (*link == slot)
+        {
+            *link = index->nextHash[slot];
+            break;
+        }
+        link = &index->nextHash[*link];
+    }
+
+    if (info->comp.parent >= index->numberSlot)
+    {
+        return;
+    }
+
+    link = &index->firstChild[info->comp.parent];
+    while (*link != 0xFFFF)
+    {
+        if (*link == slot)
+        {
+            *link = index->nextSibling[slot];
+            break;
+        }
+        link = &index->nextSibling[*link];
+    }
+}
+
+/**
+ * @brief   Replaces the RAM copy of an item slot and re-links it in the index.
+ *
+ * @param[in]   ufs    Pointer to the UFS structure.
+ * @param[in]   slot   Path id of the item.
+ * @param[in]   info   New content of the slot.
+ */
+static void ufs_IndexUpdate(UFS *ufs, uint16_t slot, const ufs_ItemInfo_Type *info)
+{
+    ufs_ItemIndex_Type *index = &ufs->ItemIndex;
+
+    // Slot 0 holds the root folder, it is never listed nor searched
+    if (slot != 0 && index->info[slot].data[0] != UFS_ITEM_FREE)
+    {
+        ufs_IndexUnlink(ufs, slot);
+    }
+
+    memcpy(index->info[slot].data, info->data, sizeof(ufs_ItemInfo_Type));
+
+    if (slot != 0 && index->info[slot].data[0] != UFS_ITEM_FREE)
+    {
+        ufs_IndexLink(ufs, slot);
+    }
+}
+
+/**
+ * @brief   Looks up an item of a folder in the item index.
+ *
+ * @param[in]   ufs      Pointer to the UFS structure.
+ * @param[in]   parent   Path id of the folder.
+ * @param[in]   name     Parsed name and extension of the item.
+ *
+ * @return      uint16_t  Path id of the item, or 0xFFFF if it does not exist.
+ */
+static uint16_t ufs_IndexFind(UFS *ufs, uint16_t parent, const ufs_Name_Type *name)
+{
+    ufs_ItemIndex_Type *index = &ufs->ItemIndex;
+    uint16_t slot = index->bucket[ufs_IndexHash(parent, name)];
+
+    while (slot != 0xFFFF)
+    {
+        ufs_ItemInfo_Type *info = &index->info[slot];
+
+        if (info->comp.parent == parent &&
+            info->comp.name.length == name->length &&
+            UFS_OK == ufs_BytesCmp(info->comp.name.head, (uint8_t *)name->head, name->length) &&
+            UFS_OK == ufs_BytesCmp(info->comp.name.extention, (uint8_t *)name->extention, 3))
+        {
+            return slot;
+        }
+        slot = index->nextHash[slot];
+    }
+
+    return 0xFFFF;
+}
+
+/**
+ * @brief   Returns the first free slot of the item zone.
+ *
+ * @param[in]   ufs   Pointer to the UFS structure.
+ *
+ * @return      uint16_t  Path id of a free slot, or 0xFFFF if the item zone is full.
+ */
+static uint16_t ufs_IndexFreeSlot(UFS *ufs)
+{
+    for (uint16_t slot = 1; slot < ufs->ItemIndex.numberSlot; slot++)
+    {
+        if (ufs->ItemIndex.info[slot].data[0] == UFS_ITEM_FREE)
+        {
+            return slot;
+        }
+    }
+
+    return 0xFFFF;
+}
+
+/**
+ * @brief   Decodes one item entry read from the item zone, in place.
+ *
+ * Entries in the current layout carry ITEM_LAYOUT_MARK in their name length
+ * and have every byte encoded. Entries written before file CRC support only
+ * have their non-zero bytes encoded, they are converted to the current layout
+ * with an unknown CRC.
+ *
+ * @param[in]       ufs    Pointer to the UFS structure.
+ * @param[in,out]   info   Entry as read from the device.
+ */
+static void ufs_ItemDecode(UFS *ufs, ufs_ItemInfo_Type *info)
+{
+#if UFS_GEOMETRY_FIXED == UFS_OK
+    (void)ufs;  // The sector size is a constant
+#endif
+    uint8_t length = info->comp.name.length;
+
+    if (length != 0x00 && ((length ^ BYTE_CODEC_DEFAULT) & ITEM_LAYOUT_MARK) != 0)
+    {
+        ufs_KernelXor(info->data, info->data, sizeof(ufs_ItemInfo_Type), BYTE_CODEC_DEFAULT);
+        info->comp.name.length &= ~ITEM_LAYOUT_MARK;
+        return;
+    }
+
+    ufs_KernelXorNonZero(info->data, sizeof(ufs_ItemInfo_Type), BYTE_CODEC_DEFAULT);
+
+    // The first cluster was stored as a cluster map position
+    ufs_LegacyItemInfo_Type legacy;
+    memcpy(legacy.data, info->data, sizeof(ufs_LegacyItemInfo_Type));
+    info->comp.first_cluster = (legacy.comp.first_cluster.sector_id == 0xFFFF) ? 0xFFFF :
+                               legacy.comp.first_cluster.sector_id * (UFS_SECTOR_SIZE(ufs) / 2) + legacy.comp.first_cluster.position;
+    info->comp.parent = legacy.comp.parent;
+    info->comp.crc = 0;
+}
+
+/**
+ * @brief   Encodes one item entry in the current layout, in place.
+ *
+ * @param[in,out]   info   Entry to write to the device.
+ */
+static void ufs_ItemEncode(ufs_ItemInfo_Type *info)
+{
+    // A free entry has no name length to carry the mark
+    if (info->data[0] == UFS_ITEM_FREE)
+    {
+        ufs_KernelXorNonZero(info->data, sizeof(ufs_ItemInfo_Type), BYTE_CODEC_DEFAULT);
+        return;
+    }
+
+    info->comp.name.length |= ITEM_LAYOUT_MARK;
+    ufs_KernelXor(info->data, info->data, sizeof(ufs_ItemInfo_Type), BYTE_CODEC_DEFAULT);
+}
+
+/**
+ * @brief   Builds the in-RAM item index from the item zone.
+ *
+ * Every item sector is read and decoded once. All later lookups, listings
+ * and free slot searches are served from RAM, and ufs_UpdateItemInfo()
+ * keeps the index in step with the device.
+ *
+ * @param[in]   ufs   Pointer to the UFS structure.
+ *
+ * @return      ufs_ReturnType    UFS_OK on success, UFS_NOT_OK on allocation failure.
+ */
+static ufs_ReturnType ufs_IndexBuild(UFS *ufs)
+{
+    ufs_ItemIndex_Type *index = &ufs->ItemIndex;
+    uint16_t itemsPerSector = UFS_SECTOR_SIZE(ufs) / sizeof(ufs_ItemInfo_Type);
+    uint16_t totalSectors = ufs->ClusterMappingZoneFirstSector - ufs->ItemZoneFirstSector;
+    uint16_t numberSlot = totalSectors * itemsPerSector;
+
+    // Allocate the index arrays (kept when the number of slots did not change)
+    if (index->numberSlot != numberSlot || index->info == NULL)
+    {
+        free(index->info);
+        free(index->bucket);
+        free(index->nextHash);
+        free(index->firstChild);
+        free(index->nextSibling);
+        free(index->dirty);
+        free(index->lock);
+
+        index->info = (ufs_ItemInfo_Type *)malloc(numberSlot * sizeof(ufs_ItemInfo_Type));
+        index->bucket = (uint16_t *)malloc(UFS_ITEM_INDEX_BUCKETS * sizeof(uint16_t));
+        index->nextHash = (uint16_t *)malloc(numberSlot * sizeof(uint16_t));
+        index->firstChild = (uint16_t *)malloc(numberSlot * sizeof(uint16_t));
+        index->nextSibling = (uint16_t *)malloc(numberSlot * sizeof(uint16_t));
+        index->dirty = (uint8_t *)malloc(totalSectors);
+        index->lock = (int8_t *)malloc(numberSlot);
+        index->numberSlot = numberSlot;
+
+        if (!index->info || !index->bucket || !index->nextHash || !index->firstChild || !index->nextSibling || !index->dirty ||
+            !index->lock)
+        {
+            return UFS_NOT_OK;
+        }
+    }
+
+    memset(index->bucket, 0xFF, UFS_ITEM_INDEX_BUCKETS * sizeof(uint16_t));
+    memset(index->firstChild, 0xFF, numberSlot * sizeof(uint16_t));
+    memset(index->dirty, 0x00, totalSectors);
+    memset(index->lock, 0x00, numberSlot);
+    ufs->ItemPendingBytes = 0;
+
+    // Read the item zone straight into the index and decode it in place
+    for (uint16_t countSector = 0; countSector < totalSectors; countSector++)
+    {
+        uint8_t *data_sector = index->info[countSector * itemsPerSector].data;
+
+        ufs->conf->api->ReadSector(ufs->ItemZoneFirstSector + countSector, data_sector, UFS_SECTOR_SIZE(ufs));
+        for (uint16_t countItem = 0; countItem < itemsPerSector; countItem++)
+        {
+            ufs_ItemDecode(ufs, &index->info[countSector * itemsPerSector + countItem]);
+        }
+    }
+
+    for (uint16_t slot = 1; slot < numberSlot; slot++)
+    {
+        if (index->info[slot].data[0] != UFS_ITEM_FREE)
+        {
+            ufs_IndexLink(ufs, slot);
+        }
+    }
+
+    return UFS_OK;
+}
+
+/**
+ * @brief   Borrows a sector buffer from the scratch pool.
+ *
+ * The buffer must be given back with ufs_ScratchReturn(). When every buffer
+ * of the pool is borrowed, one is allocated from the heap instead, so the
+ * call never waits and keeps no sector buffer on the stack.
+ *
+ * @param[in]   ufs   Pointer to the UFS structure.
+ *
+ * @return      uint8_t*  Sector buffer, NULL if the pool is empty and the heap is exhausted.
+ */
+static uint8_t *ufs_ScratchBorrow(UFS *ufs)
+{
+    uint8_t *buffer = NULL;
+
+    // Lock the mutex to ensure thread safety (check LockMutex and mutex)
+    if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
+    }
+
+    for (uint8_t countBuffer = 0; countBuffer < UFS_SCRATCH_SECTORS; countBuffer++)
+    {
+        if ((ufs->ScratchBusy & (1u << countBuffer)) == 0)
+        {
+            ufs->ScratchBusy |= (1u << countBuffer);
+            buffer = &ufs->Scratch[(uint32_t)countBuffer * UFS_SECTOR_SIZE(ufs)];
+            break;
+        }
+    }
+
+    if (buffer == NULL)
+    {
+        ufs->stats.ScratchMiss++;
+    }
+
+    // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+    if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+    }
+
+    if (buffer == NULL)
+    {
+        buffer = (uint8_t *)malloc(UFS_SECTOR_SIZE(ufs));
+    }
+
+    return buffer;
+}
+
+/**
+ * @brief   Gives back a buffer taken with ufs_ScratchBorrow().
+ *
+ * @param[in]   ufs      Pointer to the UFS structure.
+ * @param[in]   buffer   Buffer to give back, NULL is ignored.
+ */
+static void ufs_ScratchReturn(UFS *ufs, uint8_t *buffer)
+{
+    uint32_t pool_size = (uint32_t)UFS_SCRATCH_SECTORS * UFS_SECTOR_SIZE(ufs);
+
+    if (buffer == NULL)
+    {
+        return;
+    }
+
+    // A buffer from outside the pool came from the heap
+    if (buffer < ufs->Scratch || buffer >= &ufs->Scratch[pool_size])
+    {
+        free(buffer);
+        return;
+    }
+
+    // Lock the mutex to ensure thread safety (check LockMutex and mutex)
+    if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
+    }
+
+    ufs->ScratchBusy &= ~(1u << ((buffer - ufs->Scratch) / UFS_SECTOR_SIZE(ufs)));
+
+    // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+    if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+    }
+}
+
+/**
+ * @brief   Writes one item sector back from the in-RAM item index.
+ *
+ * @param[in]   ufs         Pointer to the UFS structure.
+ * @param[in]   sector_id   Sector index inside the item zone.
+ */
+static void ufs_ItemSectorWriteBack(UFS *ufs, uint16_t sector_id)
+{
+    // Borrow a buffer for the sector data, the sector stays dirty without one
+    uint8_t *data_sector = ufs_ScratchBorrow(ufs);
+    uint16_t itemsPerSector = UFS_SECTOR_SIZE(ufs) / sizeof(ufs_ItemInfo_Type);
+
+    if (data_sector == NULL)
+    {
+        return;
+    }
+
+    // Rebuild the sector from the index
+    memcpy(data_sector, ufs->ItemIndex.info[sector_id * itemsPerSector].data, UFS_SECTOR_SIZE(ufs));
+
+    // Encode Header
+    for (uint16_t countItem = 0; countItem < itemsPerSector; countItem++)
+    {
+        ufs_ItemEncode(&((ufs_ItemInfo_Type *)data_sector)[countItem]);
+    }
+
+    // Write the updated sector back to the UFS
+    ufs->conf->api->EraseSector(ufs->ItemZoneFirstSector + sector_id);
+    ufs->conf->api->WriteSector(ufs->ItemZoneFirstSector + sector_id, data_sector, UFS_SECTOR_SIZE(ufs));
+    ufs_ScratchReturn(ufs, data_sector);
+
+    ufs->ItemIndex.dirty[sector_id] = 0;
+    ufs->stats.ItemSectorWrite++;
+}
+
+/**
+ * @brief   Writes every item sector holding deferred changes back to the device.
+ *
+ * @param[in]   ufs   Pointer to the UFS structure.
+ */
+static void ufs_ItemFlush(UFS *ufs)
+{
+    uint16_t itemsPerSector = UFS_SECTOR_SIZE(ufs) / sizeof(ufs_ItemInfo_Type);
+
+    for (uint16_t countSector = 0; countSector < ufs->ItemIndex.numberSlot / itemsPerSector; countSector++)
+    {
+        if (ufs->ItemIndex.dirty[countSector])
+        {
+            ufs_ItemSectorWriteBack(ufs, countSector);
+        }
+    }
+
+    ufs->ItemPendingBytes = 0;
+}
+
+/**
+ * @brief   Updates file information in the UFS file system.
+ *
+ * This function updates the item information in the in-RAM item index,
+ * rebuilds the whole item sector from the index and writes it back to the
+ * UFS (Universal File System). It is the only place where the item zone is
+ * modified, so the index always matches the device. Deferred changes of
+ * other items of the same sector are written too, after the cluster map
+ * they refer to.
+ *
+ * @param[in]   ufs   Pointer to the UFS (Universal File System) structure.
+ * @param[in]   item  Pointer to the item (file) whose information will be updated.
+ *
+ * @return      ufs_ReturnType    UFS_OK on success, UFS_NOT_OK on failure.
+ */
+static ufs_ReturnType ufs_UpdateItemInfo(UFS *ufs, ufs_Item_Type *item)
+{
+    uint16_t itemsPerSector = UFS_SECTOR_SIZE(ufs) / sizeof(ufs_ItemInfo_Type);
+
+    // Check if the item has a valid sector ID and no prior error
+    if (item->err != UFS_ERROR_NONE || item->location.sector_id == 0xFFFF)
+    {
+        item->err = UFS_ERROR_INVALID_SECTOR;
+        return UFS_NOT_OK;
+    }
+
+    // Update the item information in the index
+    ufs_IndexUpdate(ufs, item->location.sector_id * itemsPerSector + item->location.position, &item->info);
+
+    // The cluster map goes first, so the item never points to a chain the device does not hold
+    ufs_MapCacheFlush(ufs);
+
+    ufs_ItemSectorWriteBack(ufs, item->location.sector_id);
+
+    // Return success
+    return UFS_OK;
+}
+
+/**
+ * @brief   Updates file information in RAM and defers the item zone write.
+ *
+ * The item index is updated at once, so lookups and listings see the new
+ * size. The item sector is written by ufs_CloseItem(), ufs_Sync() or when
+ * UFS_ITEM_COMMIT_BYTES bytes were written or the oldest pending change is
+ * UFS_ITEM_COMMIT_MS old.
+ *
+ * @param[in]   ufs      Pointer to the UFS structure.
+ * @param[in]   item     Pointer to the item whose information changed.
+ * @param[in]   length   Number of bytes written to the file by this change.
+ *
+ * @return      ufs_ReturnType    UFS_OK on success, UFS_NOT_OK on failure.
+ */
+static ufs_ReturnType ufs_DeferItemInfo(UFS *ufs, ufs_Item_Type *item, uint32_t length)
+{
+    uint16_t itemsPerSector = UFS_SECTOR_SIZE(ufs) / sizeof(ufs_ItemInfo_Type);
+
+    if (item->err != UFS_ERROR_NONE || item->location.sector_id == 0xFFFF)
+    {
+        item->err = UFS_ERROR_INVALID_SECTOR;
+        return UFS_NOT_OK;
+    }
+
+    ufs_IndexUpdate(ufs, item->location.sector_id * itemsPerSector + item->location.position, &item->info);
+
+    // Remember when the item zone started to lag behind the index
+    if (ufs->ItemPendingBytes == 0 && ufs->ItemIndex.dirty[item->location.sector_id] == 0 && ufs->conf->api->GetTick != NULL)
+    {
+        ufs->ItemDirtyTick = ufs->conf->api->GetTick();
+    }
+    ufs->ItemIndex.dirty[item->location.sector_id] = 1;
+    ufs->ItemPendingBytes += length;
+
+    if (ufs->ItemPendingBytes >= UFS_ITEM_COMMIT_BYTES ||
+        (UFS_ITEM_COMMIT_MS != 0 && ufs->conf->api->GetTick != NULL &&
+         ufs->conf->api->GetTick() - ufs->ItemDirtyTick >= UFS_ITEM_COMMIT_MS))
+    {
+        // The cluster chains go first, so a committed size never runs past its chain
+        ufs_MapCacheFlush(ufs);
+        ufs_ItemFlush(ufs);
+    }
+
+    return UFS_OK;
+}
+
+/**
+ * @brief   Releases the cluster chains of the reclaim queue.
+ *
+ * The cluster map and the item records go first, so a chain is never
+ * released on the device while a deleted item still points to it. The
+ * chains are then walked and released in the map cache, which is written
+ * back once for the whole batch.
+ *
+ * @param[in]   ufs   Pointer to the UFS structure.
+ *
+ * @return      uint32_t  Number of clusters released.
+ */
+static uint32_t ufs_ReclaimRun(UFS *ufs)
+{
+    uint32_t number = 0;
+
+    if (ufs->ReclaimCount == 0)
+    {
+        return 0;
+    }
+
+    ufs_MapCacheFlush(ufs);
+    ufs_ItemFlush(ufs);
+
+    while (ufs->ReclaimCount > 0)
+    {
+        uint16_t cluster = ufs->ReclaimQueue[--ufs->ReclaimCount];
+
+        // Each link is read before its cluster is released, a released cluster ends the walk
+        while (cluster < ufs->NumberCluster)
+        {
+            uint16_t next = ufs_MapGetEntry(ufs, cluster);
+
+            if (next == UFS_CLUSTER_FREE || next == UFS_CLUSTER_BAD)
+            {
+                break;
+            }
+            ufs_MapSetEntry(ufs, cluster, UFS_CLUSTER_FREE);
+            number++;
+
+            if (next == UFS_CLUSTER_END)
+            {
+                break;
+            }
+            cluster = next;
+        }
+    }
+
+    ufs_MapCacheFlush(ufs);
+
+    return number;
+}
+
+/**
+ * @brief   Releases the queued chains when the free clusters run short.
+ *
+ * @param[in]   ufs     Pointer to the UFS structure.
+ * @param[in]   count   Number of clusters about to be allocated.
+ */
+static void ufs_ReclaimFor(UFS *ufs, uint16_t count)
+{
+    uint32_t cluster_size = (uint32_t)UFS_SECTOR_SIZE(ufs) * UFS_CLUSTER_SECTORS(ufs);
+
+    if (ufs->ReclaimCount > 0 && ufs->NumberCluster - (uint32_t)ufs->UsedSize / cluster_size < count)
+    {
+        ufs_ReclaimRun(ufs);
+    }
+}
+
+/**
+ * @brief   Queues the cluster chain of a deleted file.
+ *
+ * The item must already be marked free in the item index, or point at
+ * another chain on the device. When the queue is full the queued chains are
+ * released first.
+ *
+ * @param[in]   ufs     Pointer to the UFS structure.
+ * @param[in]   cluster First cluster of the chain.
+ */
+static void ufs_ReclaimPush(UFS *ufs, uint16_t cluster)
+{
+    // Cluster 0 belongs to the root folder, files never own it
+    if (cluster == 0 || cluster >= ufs->NumberCluster)
+    {
+        return;
+    }
+
+    if (ufs->ReclaimCount >= UFS_RECLAIM_QUEUE)
+    {
+        ufs_ReclaimRun(ufs);
+    }
+    ufs->ReclaimQueue[ufs->ReclaimCount++] = cluster;
+}
+
+/**
+ * @brief   Releases the clusters no item can reach.
+ *
+ * Run at mount, after ufs_RecoverItems(). The chain of every file is walked
+ * from its first cluster and any cluster left allocated outside those chains
+ * is released: chains queued by a delete that was never reclaimed, chains of
+ * streams or rewrites that were never committed before a power loss.
+ *
+ * @param[in]   ufs   Pointer to the UFS structure.
+ */
+static void ufs_ReclaimOrphans(UFS *ufs)
+{
+    uint32_t *reached = (uint32_t *)calloc((ufs->NumberCluster + 31) >> 5, sizeof(uint32_t));
+
+    if (reached == NULL)
+    {
+        return;  // The orphans stay allocated until the next mount
+    }
+
+    // Cluster 0 belongs to the root folder
+    reached[0] = 1;
+
+    for (uint16_t slot = 1; slot < ufs->ItemIndex.numberSlot; slot++)
+    {
+        ufs_ItemInfo_Type *info = &ufs->ItemIndex.info[slot];
+
+        // Only files own a cluster chain
+        if (info->data[0] == UFS_ITEM_FREE || info->comp.name.extention[0] == 0x00 ||
+            info->comp.first_cluster == 0xFFFF)
+        {
+            continue;
+        }
+
+        uint16_t cluster = info->comp.first_cluster;
+        while (cluster < ufs->NumberCluster && (reached[cluster >> 5] & (1UL << (cluster & 0x1F))) == 0)
+        {
+            reached[cluster >> 5] |= (1UL << (cluster & 0x1F));
+            cluster = ufs_MapGetEntry(ufs, cluster);
+        }
+    }
+
+    for (uint16_t cluster = 0; cluster < ufs->NumberCluster; cluster++)
+    {
+        if ((ufs->FreeBitmap[cluster >> 5] & (1UL << (cluster & 0x1F))) == 0 &&
+            (reached[cluster >> 5] & (1UL << (cluster & 0x1F))) == 0 &&
+            ufs_MapGetEntry(ufs, cluster) != UFS_CLUSTER_BAD)
+        {
+            ufs_MapSetEntry(ufs, cluster, UFS_CLUSTER_FREE);
+        }
+    }
+
+    free(reached);
+    ufs_MapCacheFlush(ufs);
+}
+
+/**
+ * @brief   Performs a fast format of the UFS device.
+ *
+ * This function formats the UFS by erasing and re-initializing the boot sector,
+ * item zone, and cluster mapping sectors. It also sets up necessary fields such as
+ * the device ID and sector information.
+ *
+ * @param[in]   ufs   Pointer to the UFS (Universal File System) structure.
+ *
+ * @return      ufs_ReturnType    UFS_OK on success, UFS_NOT_OK on failure.
+ */
+ufs_ReturnType ufs_FastFormat(UFS *ufs)
+{
+    // Borrow a buffer for one sector's worth of data
+    uint8_t *data_sector = ufs_ScratchBorrow(ufs);
+    if (data_sector == NULL)
+    {
+        return UFS_NOT_OK;
+    }
+
+    // Cluster extents kept for closed files and queued chains belong to the old layout
+    ufs_RecentForget(ufs, 0xFFFF);
+    ufs->ReclaimCount = 0;
+
+    // Format the boot sector by erasing it
+    ufs->conf->api->EraseBlock(BOOT_SECTOR_ID);
+    ufs->conf->api->EraseBlock(BOOT_SECTOR_ID + 1);
+    //ufs->conf->api->EraseSector(BOOT_SECTOR_ID);
+
+    // Calculate key values to avoid redundant calculations
+    uint16_t sector_size = UFS_SECTOR_SIZE(ufs);
+    uint16_t total_sectors = ufs->conf->api->u32numberSectorOfDevice;
+    uint16_t max_files = ufs->conf->u8NumberFileMaxOfDevice;
+
+    // Set up the item zone and cluster mapping zone
+    ufs->ItemZoneFirstSector = 0x01;
+    ufs->ClusterMappingZoneFirstSector = ((sizeof(ufs_ItemInfo_Type) * max_files) / sector_size) + ufs->ItemZoneFirstSector + 1;
+
+    // Calculate sectors required for cluster mapping
+    uint16_t numberClusterMappingOfSector = sector_size / 2;
+    uint16_t numberSectorForClusterMapping = ((total_sectors - (ufs->ClusterMappingZoneFirstSector + 1)) / numberClusterMappingOfSector) + 1;
+
+    // Calculate maximum sectors for cluster mapping and set up the number of sectors per cluster
+    uint16_t numberSectorMaxForClusterMapping = total_sectors / 50;
+    ufs->NumberSectorOfCluster = numberSectorForClusterMapping / numberSectorMaxForClusterMapping + 1;
+
+#if UFS_SECTORS_PER_CLUSTER == 0
+    // Round the cluster up to one erase block
+    if(UFS_BLOCK_SECTORS(ufs) != 0 && ufs->NumberSectorOfCluster < UFS_BLOCK_SECTORS(ufs))
+    {
+        ufs->NumberSectorOfCluster = UFS_BLOCK_SECTORS(ufs);
+    }
+#else
+    if(ufs->NumberSectorOfCluster < UFS_SECTORS_PER_CLUSTER)
+    {
+        ufs->NumberSectorOfCluster = UFS_SECTORS_PER_CLUSTER;
+    }
+#endif
+
+    // Determine the start of the cluster data zone
+    ufs->ClusterDataZoneFirstSector = ufs->ClusterMappingZoneFirstSector +
+                                      ((ufs->NumberSectorOfCluster != 1) ? numberSectorMaxForClusterMapping : numberSectorForClusterMapping) + 1;
+
+    ufs->ClusterDataZoneFirstSector = (ufs->ClusterDataZoneFirstSector + 0x0F) & ~0x0F;
+
+    // Read and store the unique device ID
+    ufs->conf->api->ReadUniqueID(ufs->DeviceId, 8);
+
+    // Initialize boot sector metadata
+    memset(data_sector, 0x00, sector_size);
+    data_sector[0] = 'U';
+    data_sector[1] = 'F';
+    data_sector[2] = 'S';
+    data_sector[4] = (ufs->ItemZoneFirstSector >> 8) & 0xFF;
+    data_sector[5] = ufs->ItemZoneFirstSector & 0xFF;
+    data_sector[6] = (ufs->ClusterMappingZoneFirstSector >> 8) & 0xFF;
+    data_sector[7] = ufs->ClusterMappingZoneFirstSector & 0xFF;
+    data_sector[8] = (ufs->ClusterDataZoneFirstSector >> 8) & 0xFF;
+    data_sector[9] = ufs->ClusterDataZoneFirstSector & 0xFF;
+    data_sector[10] = (UFS_CLUSTER_SECTORS(ufs) >> 8) & 0xFF;
+    data_sector[11] = UFS_CLUSTER_SECTORS(ufs) & 0xFF;
+
+    // Copy the device ID into the boot sector
+    memcpy(&data_sector[12], ufs->DeviceId, 8);
+
+    // Add end-of-sector markers
+    data_sector[sector_size - 3] = '\r';
+    data_sector[sector_size - 2] = '\n';
+    data_sector[sector_size - 1] = ufs_CheckSum(data_sector, sector_size - 1);
+
+    // Write the boot sector to the device
+    ufs->conf->api->WriteSector(BOOT_SECTOR_ID, data_sector, sector_size);
+
+    // Format the item zone by erasing and initializing each sector
+    memset(data_sector, 0x00, sector_size);
+    for (uint16_t countSector = 0; countSector < (ufs->ClusterMappingZoneFirstSector - ufs->ItemZoneFirstSector); countSector++)
+    {
+    	if(countSector == 0)
+    	{
+    		// Folder '/' for root in first sector of item zone, its cluster is 0
+    		data_sector[0] = (uint8_t)'/';
+    		ufs_ItemEncode((ufs_ItemInfo_Type *)data_sector);
+    	}
+    	//ufs->conf->api->EraseSector(ufs->ItemZoneFirstSector + countSector);
+        ufs->conf->api->WriteSector(ufs->ItemZoneFirstSector + countSector, data_sector, sector_size);
+        memset(data_sector, 0x00, sizeof(ufs_ItemInfo_Type));
+    }
+
+    // Format the cluster mapping zone by erasing and initializing each sector
+    ufs_MapCacheInvalidate(ufs);
+    memset(data_sector, 0xFF, sector_size);  // Pre-fill data_sector with 0xFF for efficiency
+    for (uint16_t countSector = 0; countSector < (ufs->ClusterDataZoneFirstSector - ufs->ClusterMappingZoneFirstSector); countSector++)
+    {
+    	if(countSector == 0)
+    	{
+    		// Cluter Mapping for root is UFS_CLUSTER_END
+    		data_sector[0] = 0xFF ^ BYTE_CODEC_DEFAULT;
+    		data_sector[1] = 0xFD ^ BYTE_CODEC_DEFAULT;
+    	}
+    	else
+    	{
+    		// Only the root cluster is taken, the other map sectors start free
+    		data_sector[0] = 0xFF;
+    		data_sector[1] = 0xFF;
+    	}
+    	//ufs->conf->api->EraseBlock(ufs->ClusterMappingZoneFirstSector + countSector);
+        ufs->conf->api->WriteSector(ufs->ClusterMappingZoneFirstSector + countSector, data_sector, sector_size);
+    }
+    ufs_ScratchReturn(ufs, data_sector);
+
+    ufs->path.id = 0;
+    ufs->path.name = (uint8_t *)"/";
+
+    ufs->latest_cluster.sector_id = 0x00;
+    ufs->latest_cluster.position = 0x00;
+
+    // Only the root folder is left in the item zone
+    if (ufs_IndexBuild(ufs) != UFS_OK)
+    {
+        return UFS_NOT_OK;
+    }
+
+    // Every cluster except the root one is free again
+    return ufs_BuildFreeBitmap(ufs);
+}
+
+/**
+ * @brief   Returns the end of the data programmed in a file sector.
+ *
+ * @param[in]   ufs      Pointer to the UFS structure.
+ * @param[in]   cluster  Cluster holding the sector.
+ * @param[in]   sector   Sector index inside the cluster.
+ * @param[in]   offset   First byte of the sector to look at.
+ *
+ * @return      uint16_t  Offset after the last non-erased byte, 0 if none was found.
+ */
+static uint16_t ufs_SectorDataEnd(UFS *ufs, uint16_t cluster, uint16_t sector, uint16_t offset)
+{
+    uint16_t sector_size = UFS_SECTOR_SIZE(ufs);
+    uint16_t end = 0;
+    uint8_t *data_sector = ufs_ScratchBorrow(ufs);
+
+    if (data_sector == NULL)
+    {
+        return 0;
+    }
+
+    ufs->conf->api->ReadSector(ufs->ClusterDataZoneFirstSector + (uint32_t)cluster * UFS_CLUSTER_SECTORS(ufs) + sector,
+                               data_sector, sector_size);
+
+    // Look for the last programmed byte after offset
+    end = (uint16_t)ufs_KernelDataEnd(&data_sector[offset], sector_size - offset, UFS_BYTE_VALUE_AFTER_ERASE);
+    if (end != 0)
+    {
+        end += offset;
+    }
+
+    ufs_ScratchReturn(ufs, data_sector);
+    return end;
+}
+
+/**
+ * @brief   Repairs file metadata left behind by deferred commits.
+ *
+ * Size and first cluster changes reach the item zone later than the data
+ * and the cluster map, so after a power loss an item may lag behind its
+ * chain. Two rules are applied to every file:
+ *  - a first cluster that is free on the map was released by a rewrite
+ *    that was never committed, it is reserved again and the file is empty;
+ *  - programmed bytes after the recorded size of a non-empty file come
+ *    from appends that were never committed, the size is extended up to
+ *    the last non-erased byte. Appended bytes equal to the erased value at
+ *    the very end of the file cannot be told apart and are dropped.
+ *
+ * @param[in]   ufs   Pointer to the UFS structure.
+ */
+static void ufs_RecoverItems(UFS *ufs)
+{
+    uint16_t sector_size = UFS_SECTOR_SIZE(ufs);
+    uint16_t itemsPerSector = sector_size / sizeof(ufs_ItemInfo_Type);
+    uint32_t cluster_size = (uint32_t)sector_size * UFS_CLUSTER_SECTORS(ufs);
+
+    for (uint16_t slot = 1; slot < ufs->ItemIndex.numberSlot; slot++)
+    {
+        ufs_ItemInfo_Type info = ufs->ItemIndex.info[slot];
+
+        // Only files own a cluster chain
+        if (info.data[0] == UFS_ITEM_FREE || info.comp.name.extention[0] == 0x00)
+        {
+            continue;
+        }
+
+        uint16_t cluster = info.comp.first_cluster;
+        if (cluster >= ufs->NumberCluster)
+        {
+            continue;
+        }
+
+        if (ufs_MapGetEntry(ufs, cluster) == UFS_CLUSTER_FREE)
+        {
+            ufs_MapSetEntry(ufs, cluster, UFS_CLUSTER_END);
+            info.comp.size = 0;
+        }
+        else if (info.comp.size != 0)
+        {
+            // Walk to the cluster holding the first byte after the recorded size
+            uint32_t position = info.comp.size;
+            for (uint32_t countCluster = 0; countCluster < position / cluster_size && cluster < ufs->NumberCluster; countCluster++)
+            {
+                cluster = ufs_MapGetEntry(ufs, cluster);
+            }
+
+            // Appends are contiguous, so scan until a sector is not filled to its end
+            while (cluster < ufs->NumberCluster)
+            {
+                uint16_t sector = (position % cluster_size) / sector_size;
+                uint16_t offset = position % sector_size;
+                uint16_t end = ufs_SectorDataEnd(ufs, cluster, sector, offset);
+
+                if (end == 0)
+                {
+                    break;
+                }
+
+                position += end - offset;
+                if (end != sector_size)
+                {
+                    break;
+                }
+
+                if (position % cluster_size == 0)
+                {
+                    cluster = ufs_MapGetEntry(ufs, cluster);
+                }
+            }
+
+            info.comp.size = position;
+        }
+
+        if (info.comp.size != ufs->ItemIndex.info[slot].comp.size)
+        {
+            // The CRC only covers the committed size, it is computed again on demand
+            info.comp.crc = 0;
+            ufs_IndexUpdate(ufs, slot, &info);
+            ufs->ItemIndex.dirty[slot / itemsPerSector] = 1;
+        }
+    }
+
+    ufs_MapCacheFlush(ufs);
+    ufs_ItemFlush(ufs);
+}
+
+/**
+ * @brief   Initializes a new UFS instance.
+ *
+ * This function sets up a new UFS (Universal File System) instance by
+ * initializing the UFS configuration, reading the boot sector, and
+ * configuring internal parameters.
+ *
+ * @param[in]  pUfsCfg   Pointer to the UFS configuration structure.
+ *
+ * @return     UFS*      Pointer to the initialized UFS instance, or NULL if
+ *                       initialization failed.
+ */
+UFS *newUFS(ufs_Cfg_Type *pUfsCfg)
+{
+    // Check if the required API functions are set
+    if (pUfsCfg->api->Init == NULL || pUfsCfg->api->ReadSector == NULL ||
+        pUfsCfg->api->WriteSector == NULL || pUfsCfg->api->EraseSector == NULL ||
+        pUfsCfg->api->EraseBlock == NULL || pUfsCfg->api->EraseChip == NULL||
+		pUfsCfg->api->ReadUniqueID == NULL)
+    {
+        return NULL;  // Return NULL if any essential function is missing
+    }
+
+    // With several tasks, a task waiting for a file lock must sleep so a lower priority holder can run
+    if (pUfsCfg->api->LockMutex != NULL && pUfsCfg->api->mutex != NULL && pUfsCfg->api->Yield == NULL)
+    {
+        return NULL;
+    }
+
+#if UFS_GEOMETRY_FIXED == UFS_OK
+    // The code is built for one flash geometry
+    if (pUfsCfg->api->u16numberByteOfSector != UFS_FIXED_BYTES_PER_SECTOR ||
+        pUfsCfg->api->u16numberSectorOfBlock != UFS_FIXED_SECTORS_PER_BLOCK)
+    {
+        return NULL;
+    }
+#endif
+
+    // Allocate memory for the UFS instance
+    UFS *ufs = (UFS *)malloc(sizeof(UFS));
+    if (!ufs)
+    {
+        return NULL;
+    }
+
+    // Initialize UFS configuration
+    ufs->conf = pUfsCfg;
+    ufs->conf->api->Init();
+
+    ufs->latest_cluster.sector_id = 0x00;
+    ufs->latest_cluster.position = 0x00;
+    ufs->path.id = 0x00;
+    ufs->path.name   = (uint8_t *)"/";
+    memset(&ufs->stats, 0x00, sizeof(ufs_Stats_Type));
+    ufs->FreeBitmap = NULL;
+    ufs->CleanBitmap = NULL;
+    ufs->CleanCursor = 0;
+    ufs->NumberCluster = 0;
+    memset(&ufs->ItemIndex, 0x00, sizeof(ufs_ItemIndex_Type));
+    ufs->ItemPendingBytes = 0;
+    ufs->ItemDirtyTick = 0;
+    ufs->DataVersion = 0;
+    ufs->ReclaimCount = 0;
+
+    // Allocate the open-file table, every handle and recent entry starts empty
+    ufs->RecentTick = 0;
+    ufs->Streams = NULL;
+    ufs->Requests = NULL;
+    ufs->Handle = (ufs_Item_Type *)calloc(UFS_OPEN_FILES, sizeof(ufs_Item_Type));
+    ufs->Recent = (ufs_RecentFile_Type *)calloc(UFS_RECENT_FILES, sizeof(ufs_RecentFile_Type));
+    ufs->ReclaimQueue = (uint16_t *)calloc(UFS_RECLAIM_QUEUE, sizeof(uint16_t));
+
+    // Allocate the scratch pool, every buffer starts free
+    ufs->Scratch = (uint8_t *)malloc((uint32_t)UFS_SCRATCH_SECTORS * UFS_SECTOR_SIZE(ufs));
+    ufs->ScratchBusy = 0;
+    if (!ufs->Handle || !ufs->Recent || !ufs->ReclaimQueue || !ufs->Scratch)
+    {
+        free(ufs->Handle);
+        free(ufs->Recent);
+        free(ufs->ReclaimQueue);
+        free(ufs->Scratch);
+        free(ufs);
+        return NULL;
+    }
+    for (uint8_t countRecent = 0; countRecent < UFS_RECENT_FILES; countRecent++)
+    {
+        ufs->Recent[countRecent].slot = 0xFFFF;
+    }
+
+    // Allocate the cluster mapping cache
+    ufs->MapCacheTick = 0;
+    ufs->MapCache = (ufs_MapCache_Type *)calloc(UFS_MAP_CACHE_SLOTS, sizeof(ufs_MapCache_Type));
+    if (!ufs->MapCache)
+    {
+        free(ufs->Handle);
+        free(ufs->Recent);
+        free(ufs->ReclaimQueue);
+        free(ufs->Scratch);
+        free(ufs);
+        return NULL;
+    }
+
+    for (uint8_t countSlot = 0; countSlot < UFS_MAP_CACHE_SLOTS; countSlot++)
+    {
+        ufs->MapCache[countSlot].data = (uint8_t *)malloc(UFS_SECTOR_SIZE(ufs));
+        if (!ufs->MapCache[countSlot].data)
+        {
+            while (countSlot-- > 0)
+            {
+                free(ufs->MapCache[countSlot].data);
+            }
+            free(ufs->MapCache);
+            free(ufs->Handle);
+            free(ufs->Recent);
+            free(ufs->ReclaimQueue);
+            free(ufs->Scratch);
+            free(ufs);
+            return NULL;
+        }
+    }
+    ufs_MapCacheInvalidate(ufs);
+
+    // Read boot sector, the scratch pool is still free
+    uint8_t *data_sector = ufs_ScratchBorrow(ufs);
+    ufs->conf->api->ReadSector(BOOT_SECTOR_ID, data_sector, UFS_SECTOR_SIZE(ufs));
+
+    // Check if the boot sector is valid
+    uint8_t bootValid = (UFS_OK == ufs_BytesCmp(data_sector, (uint8_t *)"UFS", 3) &&
+                         UFS_OK == ufs_BytesCmp(&data_sector[UFS_SECTOR_SIZE(ufs) - 3], (uint8_t *)"\r\n", 2) &&
+                         data_sector[UFS_SECTOR_SIZE(ufs) - 1] == ufs_CheckSum(data_sector, UFS_SECTOR_SIZE(ufs) - 1));
+
+    if (bootValid)
+    {
+        // Initialize UFS parameters from the boot sector
+        ufs->ItemZoneFirstSector = (data_sector[4] << 8) | data_sector[5];
+        ufs->ClusterMappingZoneFirstSector = (data_sector[6] << 8) | data_sector[7];
+        ufs->ClusterDataZoneFirstSector = (data_sector[8] << 8) | data_sector[9];
+        ufs->NumberSectorOfCluster = (data_sector[10] << 8) | data_sector[11];
+
+        // Copy device ID from the boot sector
+        memcpy(ufs->DeviceId, &data_sector[12], 8);
+    }
+    ufs_ScratchReturn(ufs, data_sector);
+
+    if (!bootValid)
+    {
+        // Perform fast format if boot sector is invalid
+        if (ufs_FastFormat(ufs) != UFS_OK)
+        {
+            ufs_Unmount(ufs);
+            return NULL;
+        }
+        return ufs;
+    }
+
+    // Build the item index and the free cluster bitmap
+    if (ufs_IndexBuild(ufs) != UFS_OK || ufs_BuildFreeBitmap(ufs) != UFS_OK)
+    {
+        ufs_Unmount(ufs);
+        return NULL;
+    }
+
+    // Repair the files whose metadata was not committed before power loss
+    ufs_RecoverItems(ufs);
+
+    // Release the chains no file reaches any more
+    ufs_ReclaimOrphans(ufs);
+
+    return ufs;
+}
+
+/**
+ * @brief Opens a file in the UFS system.
+ *
+ * This function searches for a file in the in-RAM item index by its name. If the file
+ * exists, it loads its metadata. If it doesn't exist, it attempts to create a new
+ * file entry in the UFS, allocating its first cluster. The cluster map is not read
+ * here, the cluster chain is resolved on the first read or write of the file.
+ *
+ * @param[in]  ufs        Pointer to the UFS structure.
+ * @param[in]  name_file  Pointer to the file name string.
+ * @param[in]  item       Pointer to the UFS item structure where metadata will be stored.
+ *
+ * @return ufs_ReturnType UFS_OK on success, UFS_NOT_OK if the file cannot be opened.
+ */
+__fast
+ufs_ReturnType ufs_OpenItem(UFS *ufs, uint8_t *name_file, ufs_Item_Type *item)
+{
+    ufs_Location_Type slotItem; // Temporary variable to hold available slot information.
+
+    // Check for memory allocation failure or invalid UFS pointer.
+    if (ufs == NULL)
+    {
+        item->err = UFS_ERROR_ALLOCATE_MEM;
+        return UFS_NOT_OK;
+    }
+
+    uint16_t itemsPerSector = UFS_SECTOR_SIZE(ufs) / sizeof(ufs_ItemInfo_Type);
+
+    // Lock the mutex to ensure thread safety (check LockMutex and mutex)
+    if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
+    }
+
+    // Initialize the slotItem and item structures to default values.
+    slotItem.sector_id = 0xFFFF;
+    slotItem.position  = 0xFFFF;
+
+    item->location.sector_id = 0xFFFF;
+    item->status = UFS_ITEM_FREE;
+    item->ufs = NULL;
+
+    // Start with an empty read-ahead window and cluster list, their buffers are reused
+    item->window.count = 0;
+    item->window.next = 0;
+    item->clusters.number = 0;
+    item->clusters.length = 0;
+
+    // Parse the name of the file and store it in the item structure.
+    ufs_ParseNameFile(name_file, &item->info.comp.name);
+
+    // Look the item up in the index, or pick a free slot to create it.
+    uint16_t slot = ufs_IndexFind(ufs, ufs->path.id, &item->info.comp.name);
+    if (slot != 0xFFFF)
+    {
+        // If the file is found, update item metadata.
+        item->location.sector_id = slot / itemsPerSector;
+        item->location.position  = slot % itemsPerSector;
+        memcpy(item->info.data, ufs->ItemIndex.info[slot].data, sizeof(ufs_ItemInfo_Type));
+
+        // The cluster chain is resolved on the first read or write
+    }
+    else
+    {
+        // Save the first empty slot in case we need to create a new file.
+        slot = ufs_IndexFreeSlot(ufs);
+        if (slot != 0xFFFF)
+        {
+            slotItem.sector_id = slot / itemsPerSector;
+            slotItem.position = slot % itemsPerSector;
+        }
+    }
+
+    // If no existing file was found, attempt to create a new item in the UFS.
+    if (item->location.sector_id == 0xFFFF && slotItem.sector_id != 0xFFFF)
+    {
+    	if(item->info.comp.name.extention[0] != 0x00)
+    	{
+			uint16_t cluster;
 
 			// Initialize item metadata for the new file.
 			item->info.comp.size = 0;
 			item->info.comp.parent = ufs->path.id;
 
-			item->info.comp.first_cluster.sector_id = 0xFFFF;
+			item->info.comp.crc = 0;
+
+			// Search for an available cluster to assign to the new file.
+			ufs_ReclaimFor(ufs, 1);
+			cluster = ufs_FindFreeCluster(ufs, 0xFFFF);
+			item->info.comp.first_cluster = cluster;
+
+			// If a valid cluster was found, finalize the file creation.
+			if (item->info.comp.first_cluster != 0xFFFF)
+			{
+				ufs_MapSetEntry(ufs, cluster, UFS_CLUSTER_END);
+
+				// Update the item zone with the new file entry.
+				item->location.sector_id = slotItem.sector_id;
+				item->location.position  = slotItem.position;
+				item->err = UFS_ERROR_NONE;
+
+				item->info.comp.parent = ufs->path.id;
+				ufs_UpdateItemInfo(ufs, item);
+			}
+			else
+			{
+				item->err = UFS_ERROR_FULL_CLUSTER;
+
+				// Unlock the mutex after the file operation (check UnlockMutex and mutex)
+				if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+				{
+					ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+				}
+				return UFS_NOT_OK;
+			}
+    	}
+    	else
+    	{
+			// Update the item zone with the new file entry.
+			item->location.sector_id = slotItem.sector_id;
+			item->location.position  = slotItem.position;
+			item->info.comp.first_cluster = 0x00;
+			item->info.comp.parent = ufs->path.id;
+			item->info.comp.size = 0;
+			item->err = UFS_ERROR_NONE;
+
+			ufs_UpdateItemInfo(ufs, item);
+    	}
+    }
+    else if (item->location.sector_id == 0xFFFF && slotItem.sector_id == 0xFFFF)
+    {
+        // No file and no available space for a new file.
+        item->err = UFS_ERROR_FULL_FILE;
+
+        // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+        if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+        {
+            ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+        }
+        return UFS_NOT_OK;
+    }
+
+    for(uint8_t count = 0; count < ufs->conf->u8NumberEncodeFileExtension; count ++)
+    {
+    	if(UFS_OK == ufs_BytesCmp((uint8_t *)ufs->conf->pExtensionEncodeFileList[count].pListExtensionName, item->info.comp.name.extention, 3))
+    	{
+    		item->EncodeEnable = UFS_ENCODE_ENABLE;
+    	}
+    }
+
+    // Mark the item as successfully opened.
+    item->ufs = ufs;
+    item->err = UFS_ERROR_NONE;
+    if(item->info.comp.name.extention[0] != 0x00)
+    {
+    	item->status = UFS_FILE_EXIST;
+    }
+    else
+    {
+    	item->status = UFS_FOLDER_EXIST;
+    }
+
+    // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+    if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+    }
+    return UFS_OK;
+}
+
+/**
+ * @brief Closes a UFS item and releases allocated memory.
+ *
+ * This function commits the pending metadata, frees memory associated with the
+ * cluster list of the item and resets all relevant fields to indicate that the
+ * item is no longer in use.
+ *
+ * @param[in] item Pointer to the UFS item structure.
+ *
+ * @return ufs_ReturnType UFS_OK on success, UFS_NOT_OK if the item is invalid.
+ */
+ufs_ReturnType ufs_CloseItem(ufs_Item_Type *item)
+{
+    if (item == NULL)
+    {
+        item->err = UFS_ERROR_ALLOCATE_MEM;
+        return UFS_NOT_OK;
+    }
+
+    // Write back the cluster map and item changes made through this item
+    if (item->ufs != NULL)
+    {
+        ufs_Sync(item->ufs);
+    }
+
+    // Free the cluster list and reset length
+    ufs_ExtentFree(&item->clusters);
+
+    // Reset item info to default values
+    item->info.data[0] = UFS_ITEM_FREE;
+    item->info.comp.name.length = 0;
+    item->info.comp.size = 0;
+    item->info.comp.first_cluster = 0xFFFF;
+    item->info.comp.crc = 0;
+
+    // Reset item location
+    item->location.sector_id = 0xFFFF;
+    item->location.position = 0;
+
+    // Release the read-ahead window
+    free(item->window.buffer);
+    item->window.buffer = NULL;
+    item->window.count = 0;
+
+    // Mark the item as free and detach it from UFS, a handle of the open-file table is released too
+    item->status = UFS_ITEM_FREE;
+    item->ufs = NULL;
+    item->refs = 0;
+
+    return UFS_OK;
+}
+
+/**
+ * @brief Opens a file through the open-file table.
+ *
+ * The file is looked up in the in-RAM item index. When it is already open the
+ * same handle is returned. Otherwise a free handle is opened with ufs_OpenItem(),
+ * which creates the item when it does not exist, and takes over the cluster
+ * extents and read-ahead window kept from a recent ufs_FileClose() of the file,
+ * so reopening a hot file needs no flash read. The cursor of a new handle starts
+ * at the beginning of the file.
+ *
+ * @param[in]  ufs        Pointer to the UFS structure.
+ * @param[in]  name_file  Pointer to the file name string.
+ *
+ * @return ufs_Item_Type* Handle of the file, or NULL if no handle is free or the file cannot be opened.
+ */
+ufs_Item_Type *ufs_FileOpen(UFS *ufs, uint8_t *name_file)
+{
+    ufs_Item_Type *handle = NULL;
+    ufs_Name_Type name;
+    uint8_t name_copy[MAX_NAME_LENGTH + 5];
+
+    // Lock the mutex to ensure thread safety (check LockMutex and mutex)
+    if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
+    }
+
+    // Share the handle of a file that is already open, the name is parsed from a copy as parsing splits it
+    strncpy((char *)name_copy, (const char *)name_file, sizeof(name_copy) - 1);
+    name_copy[sizeof(name_copy) - 1] = '\0';
+    ufs_ParseNameFile(name_copy, &name);
+    uint16_t slot = ufs_IndexFind(ufs, ufs->path.id, &name);
+    for (uint8_t countHandle = 0; countHandle < UFS_OPEN_FILES && slot != 0xFFFF; countHandle++)
+    {
+        if (ufs->Handle[countHandle].ufs != NULL && ufs->Handle[countHandle].refs > 0 &&
+            ufs_ItemSlot(&ufs->Handle[countHandle]) == slot)
+        {
+            handle = &ufs->Handle[countHandle];
+            handle->refs++;
+            break;
+        }
+    }
+
+    // Otherwise take a free handle
+    for (uint8_t countHandle = 0; countHandle < UFS_OPEN_FILES && handle == NULL; countHandle++)
+    {
+        if (ufs->Handle[countHandle].ufs == NULL)
+        {
+            handle = &ufs->Handle[countHandle];
+            if (ufs_OpenItem(ufs, name_file, handle) != UFS_OK)
+            {
+                ufs_CloseItem(handle);
+                handle = NULL;
+                break;
+            }
+
+            // Reuse the cluster extents and read-ahead window of a recently closed file
+            slot = ufs_ItemSlot(handle);
+            for (uint8_t countRecent = 0; countRecent < UFS_RECENT_FILES; countRecent++)
+            {
+                ufs_RecentFile_Type *recent = &ufs->Recent[countRecent];
+                if (recent->slot != slot)
+                {
+                    continue;
+                }
+
+                if (recent->first_cluster == handle->info.comp.first_cluster)
+                {
+                    ufs_ExtentFree(&handle->clusters);
+                    free(handle->window.buffer);
+                    handle->clusters = recent->clusters;
+                    handle->window = recent->window;
+                    handle->window.next = 0;
+                    recent->clusters.extent = NULL;
+                    recent->window.buffer = NULL;
+                }
+                ufs_RecentDrop(recent);
+            }
+
+            handle->cursor = 0;
+            handle->refs = 1;
+        }
+    }
+
+    // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+    if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+    }
+    return handle;
+}
+
+/**
+ * @brief Closes a handle of the open-file table.
+ *
+ * The handle is released when its last holder closes it. Pending metadata is
+ * committed like ufs_CloseItem() does, and the cluster extents resolved while
+ * the file was open are kept among the recently closed files. The least
+ * recently closed file is forgotten when UFS_RECENT_FILES are already kept.
+ *
+ * @param[in] file  Handle returned by ufs_FileOpen().
+ *
+ * @return ufs_ReturnType UFS_OK on success, UFS_NOT_OK if the handle is not open.
+ */
+ufs_ReturnType ufs_FileClose(ufs_Item_Type *file)
+{
+    if (file == NULL || file->ufs == NULL || file->refs == 0)
+    {
+        return UFS_NOT_OK;
+    }
+
+    UFS *ufs = file->ufs;
+
+    // Lock the mutex to ensure thread safety (check LockMutex and mutex)
+    if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
+    }
+
+    file->refs--;
+    if (file->refs == 0)
+    {
+        if (file->err == UFS_ERROR_NONE && file->clusters.length > 0)
+        {
+            // Keep the resolved chain in the entry of the file, else in the oldest one (empty entries have age 0)
+            uint16_t slot = ufs_ItemSlot(file);
+            ufs_RecentFile_Type *recent = &ufs->Recent[0];
+            for (uint8_t countRecent = 0; countRecent < UFS_RECENT_FILES; countRecent++)
+            {
+                if (ufs->Recent[countRecent].slot == slot)
+                {
+                    recent = &ufs->Recent[countRecent];
+                    break;
+                }
+                if (ufs->Recent[countRecent].age < recent->age)
+                {
+                    recent = &ufs->Recent[countRecent];
+                }
+            }
+            ufs_RecentDrop(recent);
+
+            recent->slot = slot;
+            recent->first_cluster = file->info.comp.first_cluster;
+            recent->clusters = file->clusters;
+            recent->window = file->window;
+            recent->age = ++ufs->RecentTick;
+            memset(&file->clusters, 0x00, sizeof(ufs_ListClusterID_Type));
+            file->window.buffer = NULL;
+        }
+
+        ufs_CloseItem(file);
+    }
+
+    // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+    if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+    }
+    return UFS_OK;
+}
+
+/**
+ * @brief Reads from a handle at its cursor.
+ *
+ * @param[in]   file     Handle returned by ufs_FileOpen().
+ * @param[out]  data     Pointer to the buffer where the read data will be stored.
+ * @param[in]   length   The number of bytes to read.
+ *
+ * @return uint32_t The number of bytes read, the cursor moves past them.
+ */
+uint32_t ufs_FileRead(ufs_Item_Type *file, uint8_t *data, uint32_t length)
+{
+    if (file == NULL || file->ufs == NULL || file->refs == 0 || file->err != UFS_ERROR_NONE)
+    {
+        return 0;
+    }
+
+    uint32_t bytes_read = ufs_ReadFile(file, file->cursor, data, length);
+    file->cursor += bytes_read;
+
+    return bytes_read;
+}
+
+/**
+ * @brief Moves the cursor of a handle.
+ *
+ * @param[in]   file       Handle returned by ufs_FileOpen().
+ * @param[in]   position   New cursor position, at most the size of the file.
+ *
+ * @return ufs_ReturnType UFS_OK on success, UFS_NOT_OK if the handle is not open or the position is past the end.
+ */
+ufs_ReturnType ufs_FileSeek(ufs_Item_Type *file, uint32_t position)
+{
+    if (file == NULL || file->ufs == NULL || file->refs == 0 || position > file->info.comp.size)
+    {
+        return UFS_NOT_OK;
+    }
+
+    file->cursor = position;
+
+    return UFS_OK;
+}
+
+/**
+ * @brief   Writes all cached UFS metadata back to the device.
+ *
+ * This function programs the sectors open streams hold in RAM, releases the
+ * cluster chains queued by deletes, flushes the dirty sectors of the cluster
+ * mapping cache and then the item sectors holding deferred size and first
+ * cluster changes, so every write done since the last flush becomes
+ * persistent. The content of a stream becomes part of its file on
+ * ufs_StreamClose().
+ *
+ * @param[in]   ufs   Pointer to the UFS structure.
+ *
+ * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK if the UFS is invalid.
+ */
+ufs_ReturnType ufs_Sync(UFS *ufs)
+{
+    if (ufs == NULL)
+    {
+        return UFS_NOT_OK;
+    }
+
+    // Lock the mutex to ensure thread safety (check LockMutex and mutex)
+    if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
+    }
+
+    ufs_Drain(ufs, 0);
+    ufs_ReclaimRun(ufs);
+    ufs_MapCacheFlush(ufs);
+    ufs_ItemFlush(ufs);
+
+    // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+    if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+    }
+    return UFS_OK;
+}
+
+/**
+ * @brief   Releases the cluster chains of deleted files.
+ *
+ * ufs_DeleteItem() and ufs_DeleteFolder() only queue the chains of the files
+ * they delete. This function releases every queued chain in one batch, with
+ * one write back of the cluster map, and is meant to be called from a low
+ * priority task or while the device is idle.
+ *
+ * @param[in]   ufs   Pointer to the UFS structure.
+ *
+ * @return      uint32_t  Number of clusters released.
+ */
+uint32_t ufs_Reclaim(UFS *ufs)
+{
+    uint32_t number;
+
+    if (ufs == NULL)
+    {
+        return 0;
+    }
+
+    // Lock the mutex to ensure thread safety (check LockMutex and mutex)
+    if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
+    }
+
+    number = ufs_ReclaimRun(ufs);
+
+    // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+    if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+    }
+    return number;
+}
+
+/**
+ * @brief   Finds a free cluster that may still hold data.
+ *
+ * The free and clean bitmaps are scanned one word at a time, starting at
+ * `CleanCursor` and wrapping around the device.
+ *
+ * @param[in]   ufs   Pointer to the UFS structure.
+ *
+ * @return      uint16_t  Index of a free cluster not known to be erased, or 0xFFFF if none.
+ */
+static uint16_t ufs_FindDirtyCluster(UFS *ufs)
+{
+    uint16_t numberWord = (ufs->NumberCluster + 31) >> 5;
+    uint32_t start = (ufs->CleanCursor < ufs->NumberCluster) ? ufs->CleanCursor : 0;
+
+    // Scan numberWord + 1 words so the bits before 'start' in the first word are visited last
+    for (uint16_t countWord = 0; countWord <= numberWord; countWord++)
+    {
+        uint16_t idWord = ((start >> 5) + countWord) % numberWord;
+        uint32_t bits = ufs->FreeBitmap[idWord] & ~ufs->CleanBitmap[idWord];
+
+        if (countWord == 0)
+        {
+            bits &= (0xFFFFFFFFUL << (start & 0x1F));
+        }
+        else if (countWord == numberWord)
+        {
+            bits &= ~(0xFFFFFFFFUL << (start & 0x1F));
+        }
+
+        if (bits != 0)
+        {
+            return ((uint32_t)idWord << 5) + __builtin_ctzl(bits);
+        }
+    }
+
+    return 0xFFFF;
+}
+
+/**
+ * @brief   Erases free clusters ahead of time.
+ *
+ * Meant to be called from a low priority task or while the device is idle.
+ * Each call erases up to `budget` runs of free clusters that may still hold
+ * data and marks them clean, so later allocations only have to program them.
+ * An erase block whose clusters are all free is erased with one block erase.
+ * The clusters being erased are held out of the free bitmap and the mutex is
+ * released during the erase, so foreground file operations are not blocked.
+ *
+ * @param[in]   ufs      Pointer to the UFS structure.
+ * @param[in]   budget   Maximum number of runs to erase.
+ *
+ * @return      uint16_t  Number of erase operations issued, 0 when every free cluster is already erased.
+ */
+uint16_t ufs_PreErase(UFS *ufs, uint16_t budget)
+{
+    uint16_t number = 0;
+
+    if (ufs == NULL)
+    {
+        return 0;
+    }
+
+    for (uint16_t countRun = 0; countRun < budget; countRun++)
+    {
+        // Lock the mutex to ensure thread safety (check LockMutex and mutex)
+        if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
+        {
+            ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
+        }
+
+        uint16_t cluster = (ufs->FreeBitmap != NULL && ufs->CleanBitmap != NULL) ? ufs_FindDirtyCluster(ufs) : 0xFFFF;
+        uint16_t count = 0;
+
+        if (cluster != 0xFFFF)
+        {
+            uint16_t clustersOfBlock = ufs_ClustersOfBlock(ufs);
+            uint16_t first = cluster - cluster % clustersOfBlock;
+            uint32_t end = (uint32_t)first + clustersOfBlock;
+
+            if (end > ufs->NumberCluster)
+            {
+                end = ufs->NumberCluster;
+            }
+
+            // Take the whole block when all of its clusters are free
+            count = end - first;
+            for (uint16_t index = first; index < end; index++)
+            {
+                if ((ufs->FreeBitmap[index >> 5] & (1UL << (index & 0x1F))) == 0)
+                {
+                    count = 0;
+                    break;
+                }
+            }
+
+            if (count != 0)
+            {
+                cluster = first;
+            }
+            else
+            {
+                // Otherwise the run of free clusters still holding data
+                count = 1;
+                while (cluster + count < end &&
+                       (ufs->FreeBitmap[(cluster + count) >> 5] & ~ufs->CleanBitmap[(cluster + count) >> 5] &
+                        (1UL << ((cluster + count) & 0x1F))))
+                {
+                    count++;
+                }
+            }
+
+            // Hold the clusters out of the allocator while they are erased
+            for (uint16_t index = cluster; index < cluster + count; index++)
+            {
+                ufs->FreeBitmap[index >> 5] &= ~(1UL << (index & 0x1F));
+            }
+            ufs->CleanCursor = ((uint32_t)cluster + count < ufs->NumberCluster) ? cluster + count : 0;
+        }
+
+        // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+        if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+        {
+            ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+        }
+
+        if (count == 0)
+        {
+            break;  // Every free cluster is already erased
+        }
+
+        uint16_t issued = ufs_EraseClusters(ufs, cluster, count);
+
+        // Lock the mutex to ensure thread safety (check LockMutex and mutex)
+        if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
+        {
+            ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
+        }
+
+        // Give the clusters back to the allocator, erased
+        for (uint16_t index = cluster; index < cluster + count; index++)
+        {
+            ufs->FreeBitmap[index >> 5] |= (1UL << (index & 0x1F));
+            ufs->CleanBitmap[index >> 5] |= (1UL << (index & 0x1F));
+        }
+        ufs->stats.DataPreErase += issued;
+        number += issued;
+
+        // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+        if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+        {
+            ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+        }
+    }
+
+    return number;
+}
+
+/**
+ * @brief   Flushes and releases a UFS instance.
+ *
+ * This function writes all cached metadata back to the device and frees the
+ * memory allocated by newUFS(). The instance must not be used afterwards.
+ *
+ * @param[in]   ufs   Pointer to the UFS structure.
+ *
+ * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK if the UFS is invalid.
+ */
+ufs_ReturnType ufs_Unmount(UFS *ufs)
+{
+    if (ufs_Sync(ufs) != UFS_OK)
+    {
+        return UFS_NOT_OK;
+    }
+
+    for (uint8_t countSlot = 0; countSlot < UFS_MAP_CACHE_SLOTS; countSlot++)
+    {
+        free(ufs->MapCache[countSlot].data);
+    }
+    free(ufs->MapCache);
+    free(ufs->FreeBitmap);
+    free(ufs->CleanBitmap);
+    free(ufs->ItemIndex.info);
+    free(ufs->ItemIndex.bucket);
+    free(ufs->ItemIndex.nextHash);
+    free(ufs->ItemIndex.firstChild);
+    free(ufs->ItemIndex.nextSibling);
+    free(ufs->ItemIndex.dirty);
+    free(ufs->ItemIndex.lock);
+    for (uint8_t countHandle = 0; countHandle < UFS_OPEN_FILES; countHandle++)
+    {
+        ufs_ExtentFree(&ufs->Handle[countHandle].clusters);
+        free(ufs->Handle[countHandle].window.buffer);
+    }
+    free(ufs->Handle);
+    ufs_RecentForget(ufs, 0xFFFF);
+    free(ufs->Recent);
+    free(ufs->ReclaimQueue);
+    free(ufs->Scratch);
+    free(ufs);
+
+    return UFS_OK;
+}
+
+/**
+ * @brief   Tells whether a stream is open on an item.
+ *
+ * Must be called with the mutex held, streams register and unregister under it.
+ *
+ * @param[in]   ufs    Pointer to the UFS structure.
+ * @param[in]   slot   Slot of the item in the item index.
+ *
+ * @return      uint8_t  1 when an open stream writes the item, 0 otherwise.
+ */
+static uint8_t ufs_StreamOpenOn(UFS *ufs, uint16_t slot)
+{
+    for (ufs_Stream_Type *stream = ufs->Streams; stream != NULL; stream = stream->next)
+    {
+        if (ufs_ItemSlot(stream->file) == slot)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief   Releases the handles of the open-file table on a deleted item.
+ *
+ * A deleted slot can be taken by a new item, a handle left on it would write
+ * its stale metadata over the new item. Must be called with the mutex held.
+ *
+ * @param[in]   ufs    Pointer to the UFS structure.
+ * @param[in]   slot   Slot of the deleted item in the item index.
+ * @param[in]   keep   Handle released by the caller itself, may be NULL.
+ */
+static void ufs_HandleRelease(UFS *ufs, uint16_t slot, const ufs_Item_Type *keep)
+{
+    for (uint8_t countHandle = 0; countHandle < UFS_OPEN_FILES; countHandle++)
+    {
+        ufs_Item_Type *handle = &ufs->Handle[countHandle];
+        if (handle != keep && handle->ufs != NULL && handle->refs > 0 && ufs_ItemSlot(handle) == slot)
+        {
+            ufs_ExtentFree(&handle->clusters);
+            free(handle->window.buffer);
+            memset((uint8_t *)handle, 0x00, sizeof(ufs_Item_Type));
+        }
+    }
+}
+
+/**
+ * @brief Deletes a file from the UFS system.
+ *
+ * This function marks the item as deleted in the item index and queues the
+ * cluster chain of a file for the reclaimer, no cluster map entry is read or
+ * written. The item record is committed like a deferred change and the chain
+ * is released by ufs_Reclaim(), ufs_Sync(), or when an allocation needs it.
+ * A file with an open stream is not deleted, the item and its handle are left
+ * as they are and the stream goes on. Other handles of the open-file table on
+ * the deleted item are released.
+ *
+ * @param[in] item Pointer to the UFS item structure.
+ *
+ * @return ufs_ReturnType UFS_OK on success, UFS_BUSY if a stream is open on the file,
+ *                        UFS_NOT_OK if the item is invalid.
+ */
+ufs_ReturnType ufs_DeleteItem(ufs_Item_Type *item)
+{
+    if (item == NULL || item->ufs == NULL)
+    {
+        item->err = UFS_ERROR_ALLOCATE_MEM;
+        return UFS_NOT_OK;
+    }
+
+    if(item->err != UFS_ERROR_NONE)
+    {
+    	item->err = UFS_ERROR_NOT_EXISTED;
+    	return UFS_NOT_OK;
+    }
+
+    // Wait for the reads and writes in progress on the item
+    uint16_t slot = ufs_ItemSlot(item);
+    ufs_FileLock(item->ufs, slot, 1);
+
+    // Lock the mutex to ensure thread safety (check LockMutex and mutex)
+    if (item->ufs->conf->api->LockMutex && item->ufs->conf->api->mutex)
+    {
+        item->ufs->conf->api->LockMutex((void *)item->ufs->conf->api->mutex);  // Lock the mutex
+    }
+
+    UFS *ufs = item->ufs;
+    uint16_t first_cluster = item->info.comp.first_cluster;
+    uint8_t isFile = (item->info.comp.name.extention[0] != 0x00);
+
+    // The stream would program and commit clusters of a deleted item
+    if (isFile && ufs_StreamOpenOn(ufs, slot))
+    {
+        // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+        if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+        {
+            ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+        }
+        ufs_FileUnlock(ufs, slot);
+        return UFS_BUSY;
+    }
+
+    if (isFile)
+    {
+        ufs_RecentForget(ufs, slot);
+    }
+    ufs_ExtentFree(&item->clusters);
+
+    // Reset item info to indicate deletion
+    item->info.data[0] = UFS_ITEM_FREE;
+    item->info.comp.name.length = 0;
+    item->info.comp.size = 0;
+    item->info.comp.first_cluster = 0xFFFF;
+    item->info.comp.crc = 0;
+
+    // Mark the item deleted in the index, the record is committed later
+    ufs_ReturnType result = ufs_DeferItemInfo(ufs, item, 0);
+
+    // Queue the chain of a file, a folder owns no cluster
+    if (isFile && result == UFS_OK)
+    {
+        ufs_ReclaimPush(ufs, first_cluster);
+    }
+
+    // The item may have been opened through the open-file table as well
+    if (result == UFS_OK)
+    {
+        ufs_HandleRelease(ufs, slot, item);
+    }
+
+    // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+    if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+    }
+    ufs_FileUnlock(ufs, slot);
+
+    // Reset item location
+    item->location.sector_id = 0xFFFF;
+    item->location.position = 0;
+
+    // Release the read-ahead window
+    free(item->window.buffer);
+    item->window.buffer = NULL;
+    item->window.count = 0;
+
+    // Mark the item as free and detach it from UFS, a handle of the open-file table is released too
+    item->status = UFS_ITEM_FREE;
+    item->ufs = NULL;
+    item->refs = 0;
+
+    return UFS_OK;
+}
+
+/**
+ * @brief   Counts the number of used items in the mounted folder.
+ *
+ * This function walks the child list of the mounted folder in the in-RAM
+ * item index, so its cost only depends on the number of items of the folder.
+ *
+ * @param[in]   ufs   Pointer to the UFS (Universal File System) structure.
+ *                    It contains configuration and function pointers for accessing
+ *                    the hardware API and memory mapping.
+ *
+ * @return      uint16_t  The number of used items found in the mounted folder.
+ */
+uint16_t ufs_CountItem(UFS *ufs)
+{
+    uint16_t count = 0;
+
+    // Walk the child list of the mounted folder
+    for (uint16_t slot = ufs->ItemIndex.firstChild[ufs->path.id]; slot != 0xFFFF; slot = ufs->ItemIndex.nextSibling[slot])
+    {
+        count++;
+    }
+
+    return count;       // Return the count of items
+}
+
+/**
+ * @brief Checks the existence of a directory or file within the currently mounted folder in UFS.
+ *
+ * This function looks the item up in the in-RAM item index to verify if a
+ * specified directory or file name exists within the mounted folder. If found,
+ * the provided item structure is populated with its details.
+ *
+ * @param[in] ufs    Pointer to the UFS structure.
+ * @param[in] name   Name of the directory or file to check.
+ * @param[out] item  Pointer to store detailed information of the item if found.
+ *
+ * @return ufs_ReturnType UFS_OK if the item exists within the mounted folder, UFS_NOT_OK otherwise.
+ */
+ufs_ReturnType ufs_CheckExistence(UFS *ufs, uint8_t *name, ufs_Item_Type *item)
+{
+    uint16_t itemsPerSector = UFS_SECTOR_SIZE(ufs) / sizeof(ufs_ItemInfo_Type);
+
+    // Parse the file or directory name
+    ufs_ParseNameFile(name, &item->info.comp.name);
+
+    item->err = UFS_ERROR_NONE;
+    item->window.count = 0;
+    item->window.next = 0;
+    item->clusters.number = 0;
+    item->clusters.length = 0;
+
+    // Look the item up in the mounted folder
+    uint16_t slot = ufs_IndexFind(ufs, ufs->path.id, &item->info.comp.name);
+    if (slot != 0xFFFF)
+    {
+        // Populate the item structure with details of the found item
+        item->location.sector_id = slot / itemsPerSector;
+        item->location.position = slot % itemsPerSector;
+        item->status = (item->info.comp.name.extention[0] == 0x00) ? UFS_FOLDER_EXIST : UFS_FILE_EXIST;
+        item->err = UFS_ERROR_NONE;
+        item->ufs = ufs;
+        memcpy(item->info.data, ufs->ItemIndex.info[slot].data, sizeof(ufs_ItemInfo_Type));
+        return UFS_OK;
+    }
+
+    // If the item was not found, mark it as not existing and return failure
+    item->location.sector_id = 0xFFFF;
+    item->location.position = 0xFFFF;
+    item->status = UFS_ITEM_FREE;
+    item->err = UFS_ERROR_NOT_EXISTED;
+    return UFS_NOT_OK;
+}
+
+/**
+ * @brief   Retrieves a list of used items from the mounted folder.
+ *
+ * This function walks the child list of the mounted folder in the in-RAM
+ * item index and copies the information of its items into the provided array
+ * of `ufs_ItemInfo_Type`. It stops when the specified number of items
+ * (`length`) has been read or when there are no more items in the folder.
+ *
+ * @param[in]   ufs         Pointer to the UFS (Universal File System) structure,
+ *                          which contains configuration and hardware API details.
+ *
+ * @param[out]  item_info   Pointer to an array of `ufs_ItemInfo_Type` structures
+ *                          where the retrieved item information will be stored.
+ *
+ * @param[in]   length      The maximum number of items to retrieve. This determines
+ *                          how many items will be copied to the `item_info` array.
+ *
+ * @return      uint16_t    The number of items successfully read and copied into
+ *                          the `item_info` array.
+ *
+ * @note        Ensure that the `item_info` array is large enough to hold the
+ *              number of items specified by `length`.
+ */
+uint16_t ufs_GetListItem(UFS *ufs, ufs_ItemInfo_Type *item_info, uint16_t length)
+{
+    uint16_t item_read = 0;
+
+    // Walk the child list of the mounted folder
+    for (uint16_t slot = ufs->ItemIndex.firstChild[ufs->path.id]; slot != 0xFFFF && item_read < length; slot = ufs->ItemIndex.nextSibling[slot])
+    {
+        memcpy(item_info[item_read].data, ufs->ItemIndex.info[slot].data, sizeof(ufs_ItemInfo_Type));
+        item_read++;
+    }
+
+    return item_read;   // Return the actual number of items read
+}
+
+/**
+ * @brief   Returns the space used by allocated clusters.
+ *
+ * The used space is seeded from the free cluster bitmap at mount and then
+ * follows every cluster allocation and release, so no item zone scan is
+ * needed.
+ *
+ * @param[in]   ufs     Pointer to the UFS (Universal File System) structure.
+ *
+ * @return      uint32_t    The used size in bytes, 0 if `ufs` is NULL.
+ */
+uint32_t ufs_GetUsedSize(UFS *ufs)
+{
+    if (ufs == NULL)
+    {
+        return 0;
+    }
+
+    return (uint32_t)ufs->UsedSize;
+}
+
+/**
+ * @brief   Returns the space left for new clusters.
+ *
+ * @param[in]   ufs     Pointer to the UFS (Universal File System) structure.
+ *
+ * @return      uint32_t    The free size in bytes, 0 if `ufs` is NULL.
+ */
+uint32_t ufs_GetFreeSize(UFS *ufs)
+{
+    if (ufs == NULL)
+    {
+        return 0;
+    }
+
+    return (uint32_t)ufs->NumberCluster * UFS_SECTOR_SIZE(ufs) * UFS_CLUSTER_SECTORS(ufs) - (uint32_t)ufs->UsedSize;
+}
+
+/**
+ * @brief   Retrieves the total usable size of the UFS device.
+ *
+ * This function calculates the usable size of the device based on the number of
+ * sectors available in the device, starting from the first data zone sector.
+ *
+ * @param[in]   ufs     Pointer to the UFS (Universal File System) structure,
+ *                      which contains configuration and hardware API details.
+ *
+ * @return      uint32_t    The total usable device size in bytes. If the input
+ *                          `ufs` or `ufs->conf` is NULL, the function returns 0.
+ */
+uint32_t ufs_GetDeviceSize(UFS *ufs)
+{
+    // Ensure the input pointers are valid
+    if (ufs != NULL && ufs->conf != NULL)
+    {
+        uint16_t sectorSize = UFS_SECTOR_SIZE(ufs);
+        uint32_t totalSectors = ufs->conf->api->u32numberSectorOfDevice;
+        uint32_t dataZoneStartSector = ufs->ClusterDataZoneFirstSector;
+
+        // Calculate the usable size starting from the data zone
+        return sectorSize * (totalSectors - dataZoneStartSector);
+    }
+
+    // Return 0 if input pointers are invalid
+    return 0;
+}
+
+/**
+ * @brief   Returns the device sector holding a file position.
+ *
+ * @param[in]   file       Pointer to the UFS file structure.
+ * @param[in]   position   Position inside the file.
+ *
+ * @return      uint32_t  Device sector, or 0xFFFFFFFF past the end of the file.
+ */
+static uint32_t ufs_FileSector(ufs_Item_Type *file, uint32_t position)
+{
+    uint32_t cluster_size = UFS_SECTOR_SIZE(file->ufs) * UFS_CLUSTER_SECTORS(file->ufs);
+    uint16_t cluster;
+
+    if (position >= file->info.comp.size)
+    {
+        return 0xFFFFFFFF;
+    }
+
+    cluster = ufs_ExtentCluster(&file->clusters, position / cluster_size, NULL);
+    if (cluster >= file->ufs->NumberCluster)
+    {
+        return 0xFFFFFFFF;
+    }
+
+    return file->ufs->ClusterDataZoneFirstSector + (uint32_t)cluster * UFS_CLUSTER_SECTORS(file->ufs) +
+           (position % cluster_size) / UFS_SECTOR_SIZE(file->ufs);
+}
+
+/**
+ * @brief   Copies part of a file sector through the read-ahead window of the file.
+ *
+ * On a miss the sector is loaded into the window, together with the next
+ * sector of the file when the access is sequential. Both sectors are read
+ * with one ReadRange transfer when they follow each other on the device.
+ * Any file data write in the UFS invalidates the window.
+ *
+ * @param[in]   file        Pointer to the UFS file structure.
+ * @param[in]   sector_id   Device sector to copy from.
+ * @param[in]   sector_pos  File position of the first byte of that sector.
+ * @param[in]   offset      Offset of the first byte to copy inside the sector.
+ * @param[out]  data        Destination buffer.
+ * @param[in]   length      Number of bytes to copy.
+ * @param[in]   sequential  Non-zero when the read continues the previous one.
+ */
+static void ufs_ReadWindowCopy(ufs_Item_Type *file, uint32_t sector_id, uint32_t sector_pos, uint16_t offset,
+                               uint8_t *data, uint16_t length, uint8_t sequential)
+{
+    UFS *ufs = file->ufs;
+    uint16_t sector_size = UFS_SECTOR_SIZE(ufs);
+    ufs_ReadWindow_Type *window = &file->window;
+
+    if (window->version != ufs->DataVersion)
+    {
+        window->count = 0;
+    }
+
+    for (uint8_t slot = 0; slot < window->count; slot++)
+    {
+        if (window->sector[slot] == sector_id)
+        {
+            memcpy(data, &window->buffer[slot * sector_size + offset], length);
+            return;
+        }
+    }
+
+    if (window->buffer == NULL)
+    {
+        window->buffer = (uint8_t *)malloc(2 * sector_size);
+        if (window->buffer == NULL)
+        {
+            // Read through a scratch buffer instead
+            uint8_t *fallback = ufs_ScratchBorrow(ufs);
+            if (fallback != NULL)
+            {
+                ufs->conf->api->ReadSector(sector_id, fallback, sector_size);
+                memcpy(data, &fallback[offset], length);
+                ufs_ScratchReturn(ufs, fallback);
+            }
+            return;
+        }
+    }
+
+    uint32_t next_sector = sequential ? ufs_FileSector(file, sector_pos + sector_size) : 0xFFFFFFFF;
+
+    window->sector[0] = sector_id;
+    window->sector[1] = next_sector;
+    window->count = (next_sector != 0xFFFFFFFF) ? 2 : 1;
+    window->version = ufs->DataVersion;
+
+    if (window->count == 2 && next_sector == sector_id + 1 && ufs->conf->api->ReadRange != NULL)
+    {
+        ufs->conf->api->ReadRange(sector_id, 0, window->buffer, 2 * sector_size);
+    }
+    else
+    {
+        ufs->conf->api->ReadSector(sector_id, window->buffer, sector_size);
+        if (window->count == 2)
+        {
+            ufs->conf->api->ReadSector(next_sector, &window->buffer[sector_size], sector_size);
+        }
+    }
+
+    memcpy(data, &window->buffer[offset], length);
+}
+
+/**
+ * @brief   Reads data from a file in UFS.
+ *
+ * This function reads data from the specified file, starting from the given position
+ * and continuing for the specified length, but never past the end of the file.
+ * Physically contiguous clusters are read as one run straight into the provided
+ * buffer, with a single ReadRange transfer when the device provides it, and
+ * encoded files are decoded in place. Partial sectors go through the read-ahead
+ * window of the file, which also fetches the next sector when the file is read
+ * sequentially, so small sequential reads hit each sector only once. The file
+ * lock is shared with other readers and the metadata mutex is only held while
+ * the cluster chain is resolved.
+ *
+ * @param[in]   file      Pointer to the UFS file structure.
+ * @param[in]   position  The starting position within the file from where to begin reading.
+ * @param[out]  data      Pointer to the buffer where the read data will be stored.
+ * @param[in]   length    The number of bytes to read from the file.
+ *
+ * @return      uint32_t  The number of bytes successfully read from the file.
+ */
+__fast
+uint32_t ufs_ReadFile(ufs_Item_Type *file, uint32_t position, uint8_t *data, uint32_t length)
+{
+	if(file->ufs == NULL || file->err != UFS_ERROR_NONE)
+	{
+		 return UFS_NOT_OK;
+	}
+
+    if(file->status != UFS_FILE_EXIST)
+    {
+    	file->err = UFS_ERROR_ITEM_NOT_FILE;
+    	return UFS_NOT_OK;
+    }
+
+    uint16_t sector_size = UFS_SECTOR_SIZE(file->ufs);
+    uint32_t cluster_size = sector_size * UFS_CLUSTER_SECTORS(file->ufs);
+    uint32_t bytes_read = 0;
+    uint32_t cluster_index = position / cluster_size;
+    uint32_t offset_within_cluster = position % cluster_size;
+
+    uint8_t sequential = (position == file->window.next);
+
+    // Never read past the end of the file
+    if (position >= file->info.comp.size)
+    {
+        length = 0;
+    }
+    else if (length > file->info.comp.size - position)
+    {
+        length = file->info.comp.size - position;
+    }
+
+    // Share the file with other readers, writers wait until the read is done
+    ufs_FileLock(file->ufs, ufs_ItemSlot(file), 0);
+
+    // Lock the mutex to ensure thread safety (check LockMutex and mutex)
+    if (file->ufs->conf->api->LockMutex && file->ufs->conf->api->mutex)
+    {
+        file->ufs->conf->api->LockMutex((void *)file->ufs->conf->api->mutex);  // Lock the mutex
+    }
+
+    // Resolve the cluster chain only as far as the last byte to read, plus the
+    // sector the read-ahead window fetches next when the access is sequential
+    if (length > 0)
+    {
+        ufs_GetListCluster(file->ufs, file, (position + length - 1 + (sequential ? sector_size : 0)) / cluster_size + 1);
+    }
+
+    // The sectors are read without the mutex, other files stay available meanwhile
+    if (file->ufs->conf->api->UnlockMutex && file->ufs->conf->api->mutex)
+    {
+        file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);  // Unlock the mutex
+    }
+
+    // Loop through the extents of the file, each one is a run of physically contiguous clusters
+    while (bytes_read < length)
+    {
+        uint16_t run = 0;
+        uint16_t first_cluster = ufs_ExtentCluster(&file->clusters, cluster_index, &run);
+        uint32_t run_clusters = (offset_within_cluster + (length - bytes_read) + cluster_size - 1) / cluster_size;
+
+        if (first_cluster >= file->ufs->NumberCluster)
+        {
+            break;
+        }
+
+        // Only the clusters still needed from the run are read
+        if (run_clusters > run)
+        {
+            run_clusters = run;
+        }
+
+        uint32_t chunk = run_clusters * cluster_size - offset_within_cluster;
+        if (chunk > length - bytes_read)
+        {
+            chunk = length - bytes_read;
+        }
+
+        uint32_t sector_id = file->ufs->ClusterDataZoneFirstSector + first_cluster * UFS_CLUSTER_SECTORS(file->ufs) +
+                             offset_within_cluster / sector_size;
+        uint16_t offset_within_sector = offset_within_cluster % sector_size;
+        uint32_t done = 0;
+
+        while (done < chunk)
+        {
+            uint32_t part = sector_size - offset_within_sector;
+            if (part > chunk - done)
+            {
+                part = chunk - done;
+            }
+
+            if (part < sector_size)
+            {
+                // Partial sectors are served from the read-ahead window
+                ufs_ReadWindowCopy(file, sector_id, position + bytes_read + done - offset_within_sector,
+                                   offset_within_sector, &data[bytes_read + done], part, sequential);
+                done += part;
+                sector_id++;
+                offset_within_sector = 0;
+                continue;
+            }
+
+            // Whole sectors go straight into the caller's buffer
+            uint32_t whole = (chunk - done) / sector_size * sector_size;
+            if (file->ufs->conf->api->ReadRange != NULL)
+            {
+                file->ufs->conf->api->ReadRange(sector_id, 0, &data[bytes_read + done], whole);
+            }
+            else
+            {
+                for (uint32_t countByte = 0; countByte < whole; countByte += sector_size)
+                {
+                    file->ufs->conf->api->ReadSector(sector_id + countByte / sector_size, &data[bytes_read + done + countByte], sector_size);
+                }
+            }
+            done += whole;
+            sector_id += whole / sector_size;
+        }
+
+        // Decode in place
+        if(file->EncodeEnable == UFS_ENCODE_ENABLE)
+        {
+            ufs_KernelXor(&data[bytes_read], &data[bytes_read], chunk, file->ufs->DeviceId[0] | BYTE_CODEC_DEFAULT);
+        }
+
+        bytes_read += chunk;
+        cluster_index += run_clusters;
+        offset_within_cluster = 0;
+    }
+    file->window.next = position + bytes_read;
+
+    ufs_FileUnlock(file->ufs, ufs_ItemSlot(file));
+    return bytes_read;  // Return the number of bytes successfully read
+}
+
+/**
+ * @brief   Reads back bytes just programmed in a sector and compares them with the data written.
+ *
+ * Only the programmed range is read: through ReadRange when the device has it,
+ * else the sector is read from its start up to the last programmed byte. The
+ * bytes read are decoded in place, so `source` is the data before encoding.
+ *
+ * @param[in]   ufs        Pointer to the UFS structure.
+ * @param[in]   sectorID   Sector that was programmed.
+ * @param[in]   offset     Offset of the programmed bytes in the sector.
+ * @param[in]   source     Data written, before encoding.
+ * @param[in]   length     Number of bytes programmed.
+ * @param[in]   codec      Key the data was encoded with, 0 if it was not encoded.
+ * @param[out]  buffer     Sector buffer receiving the bytes read back.
+ *
+ * @return      ufs_ReturnType  UFS_OK if the device holds the data, UFS_NOT_OK otherwise.
+ */
+static ufs_ReturnType ufs_VerifyProgram(UFS *ufs, uint32_t sectorID, uint16_t offset, const uint8_t *source,
+                                        uint32_t length, uint8_t codec, uint8_t *buffer)
+{
+    if (length == 0)
+    {
+        return UFS_OK;
+    }
+
+    if (ufs->conf->api->ReadRange != NULL)
+    {
+        ufs->conf->api->ReadRange(sectorID, offset, buffer, length);
+    }
+    else
+    {
+        ufs->conf->api->ReadSector(sectorID, buffer, offset + length);
+        buffer = &buffer[offset];
+    }
+
+    ufs_KernelXor(buffer, buffer, length, codec);
+    return ufs_KernelCompare(buffer, source, length);
+}
+
+/**
+ * @brief   Handles a sector of a file write that failed verification.
+ *
+ * The clusters from the failed one to the end of the chain are released and
+ * the failed cluster is marked bad, so it is never allocated again. The file
+ * keeps `size` bytes with an unknown CRC.
+ *
+ * @param[in]   file            Pointer to the UFS file structure.
+ * @param[in]   cluster_index   Position of the first cluster to release in the chain of the file.
+ * @param[in]   cluster         Failed cluster.
+ * @param[in]   size            Size of the file after the failure.
+ */
+static void ufs_WriteVerifyFail(ufs_Item_Type *file, uint16_t cluster_index, uint16_t cluster, uint32_t size)
+{
+    // Lock the mutex to release the clusters
+    if (file->ufs->conf->api->LockMutex && file->ufs->conf->api->mutex)
+    {
+        file->ufs->conf->api->LockMutex((void *)file->ufs->conf->api->mutex);
+    }
+
+    file->info.comp.size = size;
+    file->info.comp.crc = 0;
+    ufs_CleanClusters(file->ufs, &file->clusters, cluster_index);  // Clean the bad clusters
+    ufs_SetClusterMap(file->ufs, cluster, UFS_CLUSTER_BAD);  // Mark as bad
+    file->err = UFS_ERROR_SUM_SECTOR_FAIL;  // Set error for checksum failure
+
+    // Unlock the mutex after the file operation
+    if (file->ufs->conf->api->UnlockMutex && file->ufs->conf->api->mutex)
+    {
+        file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);
+    }
+}
+
+/**
+ * @brief   Writes data to a file in UFS.
+ *
+ * This function writes the provided data to the specified file. The data goes to
+ * a newly allocated chain and the file's metadata, including the first cluster and
+ * size, is updated. The old chain is released through the reclaim queue once the
+ * new metadata is committed, or before the new chain is allocated when the device
+ * has no room for both.
+ * The file lock is held alone, the metadata mutex is released while the sectors are programmed.
+ *
+ * @param[in]   file    Pointer to the UFS file structure.
+ * @param[in]   data    Pointer to the data buffer to be written.
+ * @param[in]   length  Length of the data to be written (in bytes).
+ *
+ * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK on failure.
+ */
+__fast
+ufs_ReturnType ufs_WriteFile(ufs_Item_Type *file, uint8_t *data, uint32_t length, ufs_CheckSumStatus sumEnable)
+{
+	if(file->ufs == NULL || file->err != UFS_ERROR_NONE)
+	{
+		 return UFS_NOT_OK;
+	}
+
+    if(file->status != UFS_FILE_EXIST)
+    {
+    	file->err = UFS_ERROR_ITEM_NOT_FILE;
+    	return UFS_NOT_OK;
+    }
+
+    uint32_t cluster_size = UFS_SECTOR_SIZE(file->ufs) * UFS_CLUSTER_SECTORS(file->ufs);
+    uint32_t number_clusters = (length + cluster_size - 1) / cluster_size;  // Calculate number of clusters needed
+    uint16_t cluster_index = 0;
+    uint32_t bytes_written = 0;
+    uint32_t crc = 0;
+    uint8_t codec = (file->EncodeEnable == UFS_ENCODE_ENABLE) ? (file->ufs->DeviceId[0] | BYTE_CODEC_DEFAULT) : 0x00;
+
+    uint8_t *sector_buffer = ufs_ScratchBorrow(file->ufs);
+
+    if (sector_buffer == NULL)
+    {
+        file->err = UFS_ERROR_ALLOCATE_MEM;
+        return UFS_NOT_OK;
+    }
+
+    // Keep readers and other writers of the file out until the write is done
+    ufs_FileLock(file->ufs, ufs_ItemSlot(file), 1);
+
+    // Lock the mutex to ensure thread safety (check LockMutex and mutex)
+    if (file->ufs->conf->api->LockMutex && file->ufs->conf->api->mutex)
+    {
+        file->ufs->conf->api->LockMutex((void *)file->ufs->conf->api->mutex);  // Lock the mutex
+    }
+
+    // An empty file still owns one cluster
+    if (number_clusters == 0)
+    {
+        number_clusters = 1;
+    }
+
+    // The old chain stays allocated until the new metadata is committed, so
+    // the item on the device never points to clusters given to another file
+    uint16_t previous = file->info.comp.first_cluster;
+    ufs_ExtentFree(&file->clusters);
+    ufs_RecentForget(file->ufs, ufs_ItemSlot(file));
+
+    // Order the clusters for the new data
+    ufs_ReturnType ordered = ufs_OrderClusters(file->ufs, &file->clusters, number_clusters);
+    if (ordered != UFS_OK)
+    {
+        // No room for both contents, the old chain is released first and the new content takes its place
+        ufs_ReclaimPush(file->ufs, previous);
+        previous = 0;
+        ordered = ufs_OrderClusters(file->ufs, &file->clusters, number_clusters);
+    }
+
+    if (ordered != UFS_OK)
+    {
+        // Cluster allocation failure
+        file->err = UFS_ERROR_FULL_MEM;
+
+        // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+        if (file->ufs->conf->api->UnlockMutex && file->ufs->conf->api->mutex)
+        {
+            file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);  // Unlock the mutex
+        }
+        ufs_FileUnlock(file->ufs, ufs_ItemSlot(file));
+        ufs_ScratchReturn(file->ufs, sector_buffer);
+        return UFS_NOT_OK;
+    }
+
+    // Cached file sectors are outdated from now on
+    file->ufs->DataVersion++;
 
-			// Search for available clusters to assign to the new file.
-			countSector = ufs->latest_cluster.sector_id;
-			do
-			{
-				// Loop through the cluster mapping zone to find an available cluster.
-				if (++countSector >= (ufs->ClusterDataZoneFirstSector - ufs->ClusterMappingZoneFirstSector))
-				{
-					countSector = 0x00;
-				}
+    // The clusters are reserved, the data is programmed without the mutex
+    if (file->ufs->conf->api->UnlockMutex && file->ufs->conf->api->mutex)
+    {
+        file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);  // Unlock the mutex
+    }
 
-				if(countSector * (ufs->conf->api->u16numberByteOfSector / 2) > \
-				   (ufs->conf->api->u32numberSectorOfDevice - ufs->ClusterDataZoneFirstSector) / ufs->NumberSectorOfCluster)
-				{
-					countSector = 0;
-				}
+    // Start writing the data to the file's clusters
+    for (cluster_index = 0; cluster_index < number_clusters; cluster_index++)
+    {
+        uint16_t cluster = ufs_ExtentCluster(&file->clusters, cluster_index, NULL);
+
+        for (uint16_t sector_in_cluster = 0; sector_in_cluster < UFS_CLUSTER_SECTORS(file->ufs); sector_in_cluster++)
+        {
+            uint32_t cluster_offset = file->ufs->ClusterDataZoneFirstSector +
+                                      ((uint32_t)cluster * UFS_CLUSTER_SECTORS(file->ufs)) + sector_in_cluster;
+
+            // Write data into the buffer, one sector at a time
+            uint32_t chunk = length - bytes_written;
+            if (chunk > UFS_SECTOR_SIZE(file->ufs))
+            {
+                chunk = UFS_SECTOR_SIZE(file->ufs);
+            }
+            ufs_KernelXor(sector_buffer, &data[bytes_written], chunk, codec);
+            memset(&sector_buffer[chunk], UFS_BYTE_VALUE_AFTER_ERASE, UFS_SECTOR_SIZE(file->ufs) - chunk);  // Pad remaining sector bytes if needed
+            crc = ufs_KernelCrc32(crc, &data[bytes_written], chunk);
+            bytes_written += chunk;
 
-				ufs->conf->api->ReadSector(ufs->ClusterMappingZoneFirstSector + countSector, data_sector, ufs->conf->api->u16numberByteOfSector);
+            // Write the buffer to the current sector
+            file->ufs->conf->api->WriteSector(cluster_offset, sector_buffer, UFS_SECTOR_SIZE(file->ufs));
 
-				countSegment = ufs->latest_cluster.position;
-				do
-				{
-					if (++countSegment >= (ufs->conf->api->u16numberByteOfSector / 2))
-					{
-						countSegment = 0x00;
-					}
+            // Read back the data bytes just programmed, the erased padding is not checked,
+            // on a failure the new chain is dropped and the file keeps its previous content
+            if (UFS_VERIFY_NOW(sumEnable) &&
+                ufs_VerifyProgram(file->ufs, cluster_offset, 0, &data[bytes_written - chunk], chunk, codec, sector_buffer) != UFS_OK)
+            {
+                ufs_WriteVerifyFail(file, 0, cluster, file->info.comp.size);
+                ufs_FileUnlock(file->ufs, ufs_ItemSlot(file));
+                ufs_ScratchReturn(file->ufs, sector_buffer);
+                return UFS_NOT_OK;
+            }
+
+            if (bytes_written == length)  // Stop if all data has been written
+            {
+                break;
+            }
+        }
+
+        if (bytes_written == length)
+        {
+            break;
+        }
+    }
 
-					if(countSegment >= (ufs->conf->api->u32numberSectorOfDevice - ufs->ClusterDataZoneFirstSector) / ufs->NumberSectorOfCluster)
-					{
-						countSegment = 0x00;
-					}
+    // Every sector is programmed, read the data back in one pass
+    if (UFS_VERIFY_LATER(sumEnable))
+    {
+        for (uint32_t position = 0; position < length; position += UFS_SECTOR_SIZE(file->ufs))
+        {
+            uint32_t chunk = length - position;
+            if (chunk > UFS_SECTOR_SIZE(file->ufs))
+            {
+                chunk = UFS_SECTOR_SIZE(file->ufs);
+            }
 
-					value_cluster = (uint16_t *)&data_sector[countSegment * 2];
-					if (*value_cluster == UFS_CLUSTER_FREE)
-					{
-						// Assign the found cluster to the new file.
-						item->info.comp.first_cluster.sector_id = countSector;
-						item->info.comp.first_cluster.position = countSegment;
+            cluster_index = position / cluster_size;
+            uint16_t cluster = ufs_ExtentCluster(&file->clusters, cluster_index, NULL);
+            uint32_t cluster_offset = file->ufs->ClusterDataZoneFirstSector +
+                                      (uint32_t)cluster * UFS_CLUSTER_SECTORS(file->ufs) +
+                                      (position % cluster_size) / UFS_SECTOR_SIZE(file->ufs);
 
-						ufs->latest_cluster.sector_id = countSector;
-						ufs->latest_cluster.position = countSegment;
-						break;
-					}
+            if (ufs_VerifyProgram(file->ufs, cluster_offset, 0, &data[position], chunk, codec, sector_buffer) != UFS_OK)
+            {
+                ufs_WriteVerifyFail(file, 0, cluster, file->info.comp.size);
+                ufs_FileUnlock(file->ufs, ufs_ItemSlot(file));
+                ufs_ScratchReturn(file->ufs, sector_buffer);
+                return UFS_NOT_OK;
+            }
+        }
+    }
 
-				} while (countSegment != ufs->latest_cluster.position);
+    ufs_ScratchReturn(file->ufs, sector_buffer);
 
-			} while (countSector != ufs->latest_cluster.sector_id);
+    // Lock the mutex to record the new metadata
+    if (file->ufs->conf->api->LockMutex && file->ufs->conf->api->mutex)
+    {
+        file->ufs->conf->api->LockMutex((void *)file->ufs->conf->api->mutex);  // Lock the mutex
+    }
 
-			// If a valid cluster was found, finalize the file creation.
-			if (item->info.comp.first_cluster.sector_id != 0xFFFF)
-			{
-				*value_cluster = UFS_CLUSTER_END;
-				ufs->conf->api->EraseSector(ufs->ClusterMappingZoneFirstSector + item->info.comp.first_cluster.sector_id);
-				ufs->conf->api->WriteSector(ufs->ClusterMappingZoneFirstSector + item->info.comp.first_cluster.sector_id, data_sector, ufs->conf->api->u16numberByteOfSector);
+    // Update file metadata to reflect the new size
+    file->info.comp.size = length;
+    file->info.comp.crc = crc;
+    file->info.comp.first_cluster = file->clusters.extent[0].start;
 
-				// Update the item zone with the new file entry.
-				item->location.sector_id = slotItem.sector_id;
-				item->location.position  = slotItem.position;
+    // Record the new metadata, it reaches the item zone on the next commit. The
+    // old chain is released by the reclaim queue, which commits the items first
+    if (ufs_DeferItemInfo(file->ufs, file, length) == UFS_OK)
+    {
+        ufs_ReclaimPush(file->ufs, previous);
+    }
 
-				ufs->conf->api->ReadSector(ufs->ItemZoneFirstSector + item->location.sector_id, data_sector, ufs->conf->api->u16numberByteOfSector);
-				for(uint16_t countByte = 0; countByte < ufs->conf->api->u16numberByteOfSector; countByte ++)
-				{
-					if(data_sector[countByte] != 0x00)
-					{
-						data_sector[countByte] ^= BYTE_CODEC_DEFAULT;
-					}
-				}
+    // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+    if (file->ufs->conf->api->UnlockMutex && file->ufs->conf->api->mutex)
+    {
+        file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);  // Unlock the mutex
+    }
+    ufs_FileUnlock(file->ufs, ufs_ItemSlot(file));
+
+    return UFS_OK;
+}
+
+/**
+ * @brief   Appends data to the end of a file in UFS.
+ *
+ * This function appends the provided data to the specified file. It manages clusters
+ * by extending the cluster list if necessary and writing the new data to the correct
+ * sectors. The bytes past the end of the file are still erased, so when the device
+ * provides WritePartial only the new byte range of each sector is programmed and the
+ * tail sector is never read back. Without WritePartial the tail sector is read,
+ * patched and rewritten.
+ *
+ * @param[in]   file        Pointer to the UFS file structure.
+ * @param[in]   data        Pointer to the data buffer to be appended.
+ * @param[in]   length      The number of bytes to append to the file.
+ * @param[in]   sumEnable   Indicates if checksum should be enabled (CHECKSUM_ENABLE/CHECKSUM_DISABLE).
+ *
+ * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK on failure.
+ */
+__fast
+ufs_ReturnType ufs_WriteAppendFile(ufs_Item_Type *file, uint8_t *data, uint32_t length, ufs_CheckSumStatus sumEnable)
+{
+    if(file->ufs == NULL || file->err != UFS_ERROR_NONE)
+	{
+		return UFS_NOT_OK;
+	}
+
+    if(file->status != UFS_FILE_EXIST)
+    {
+    	file->err = UFS_ERROR_ITEM_NOT_FILE;
+    	return UFS_NOT_OK;
+    }
+
+    uint16_t sector_size = UFS_SECTOR_SIZE(file->ufs);
+    uint32_t current_file_size = file->info.comp.size;  // Get current file size
+    uint32_t new_size = current_file_size + length;     // Calculate new size after appending
+    uint32_t bytes_written = 0;                         // Track how many bytes have been written
+    uint32_t cluster_size = sector_size * UFS_CLUSTER_SECTORS(file->ufs); // Calculate total cluster size
+    uint8_t codec = (file->EncodeEnable == UFS_ENCODE_ENABLE) ? (file->ufs->DeviceId[0] | BYTE_CODEC_DEFAULT) : 0x00;
+
+    // Continue the CRC of the content, an unknown CRC stays unknown
+    uint32_t crc = (current_file_size == 0) ? 0 : file->info.comp.crc;
+    uint8_t crcKnown = (current_file_size == 0 || crc != 0);
+
+    // Calculate the number of data clusters needed (an empty file owns one cluster)
+    uint16_t new_cluster_count = (new_size == 0) ? 1 : (new_size + cluster_size - 1) / cluster_size;
+
+    // Borrow a sector-level buffer
+    uint8_t *data_sector = ufs_ScratchBorrow(file->ufs);
+    if (data_sector == NULL)
+    {
+        file->err = UFS_ERROR_ALLOCATE_MEM;
+        return UFS_NOT_OK;
+    }
+
+    // Keep readers and other writers of the file out until the append is done
+    ufs_FileLock(file->ufs, ufs_ItemSlot(file), 1);
+
+    // Lock mutex for thread safety
+    if (file->ufs->conf->api->LockMutex && file->ufs->conf->api->mutex)
+    {
+        file->ufs->conf->api->LockMutex((void *)file->ufs->conf->api->mutex);  // Lock the mutex
+    }
+
+    // The new data goes after the last cluster of the chain, resolve all of it
+    if (ufs_GetListCluster(file->ufs, file, UFS_CLUSTERS_ALL) != UFS_OK)
+    {
+        if (file->ufs->conf->api->UnlockMutex && file->ufs->conf->api->mutex)
+        {
+        	file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);  // Unlock the mutex
+        }
+        ufs_FileUnlock(file->ufs, ufs_ItemSlot(file));
+        ufs_ScratchReturn(file->ufs, data_sector);
+        return UFS_NOT_OK;
+    }
+
+    // If new clusters are needed, extend the cluster list, they are linked after its last cluster
+    if (new_cluster_count > file->clusters.length)
+    {
+        if (ufs_OrderClusters(file->ufs, &file->clusters, new_cluster_count - file->clusters.length) != UFS_OK)
+        {
+            file->err = UFS_ERROR_FULL_MEM;  // Handle cluster allocation failure
+            if (file->ufs->conf->api->UnlockMutex && file->ufs->conf->api->mutex)
+            {
+            	file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);  // Unlock the mutex
+            }
+            ufs_FileUnlock(file->ufs, ufs_ItemSlot(file));
+            ufs_ScratchReturn(file->ufs, data_sector);
+            return UFS_NOT_OK;
+        }
+
+        // Link the new clusters on the device before data lands in them, so mount recovery can follow the chain
+        ufs_MapCacheFlush(file->ufs);
+    }
+
+    // The first cluster of an empty file is reserved but not erased yet
+    if (current_file_size == 0 && length > 0)
+    {
+        ufs_PrepareClusters(file->ufs, file->clusters.extent[0].start, 1);
+    }
+
+    // Cached file sectors are outdated from now on
+    file->ufs->DataVersion++;
+
+    // The clusters are reserved, the data is programmed without the mutex
+    if (file->ufs->conf->api->UnlockMutex && file->ufs->conf->api->mutex)
+    {
+        file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);  // Unlock the mutex
+    }
+
+    // Write the data sector by sector, starting at the end of the file
+    while (bytes_written < length)
+    {
+        uint32_t position = current_file_size + bytes_written;
+        uint16_t cluster_index = position / cluster_size;
+        uint16_t offset = position % sector_size;
+        uint16_t cluster = ufs_ExtentCluster(&file->clusters, cluster_index, NULL);
+        uint32_t chunk = sector_size - offset;
+        if (chunk > length - bytes_written)
+        {
+            chunk = length - bytes_written;
+        }
+
+        // Check if the cluster is valid
+        if (cluster >= file->ufs->NumberCluster)
+        {
+            file->err = UFS_ERROR_INVALID_SECTOR;
+            ufs_FileUnlock(file->ufs, ufs_ItemSlot(file));
+            ufs_ScratchReturn(file->ufs, data_sector);
+            return UFS_NOT_OK;
+        }
+
+        uint32_t cluster_offset = file->ufs->ClusterDataZoneFirstSector +
+                                  (uint32_t)cluster * UFS_CLUSTER_SECTORS(file->ufs) +
+                                  (position % cluster_size) / sector_size;
+
+        if (file->ufs->conf->api->WritePartial != NULL)
+        {
+            // Program only the new bytes, the rest of the sector is left untouched
+            ufs_KernelXor(data_sector, &data[bytes_written], chunk, codec);
+            file->ufs->conf->api->WritePartial(cluster_offset, offset, data_sector, chunk);
+        }
+        else
+        {
+            // Read the sector to keep the existing data, a fresh sector is still erased
+            if (offset > 0)
+            {
+                file->ufs->conf->api->ReadSector(cluster_offset, data_sector, sector_size);
+            }
+            else
+            {
+                memset(data_sector, UFS_BYTE_VALUE_AFTER_ERASE, sector_size);
+            }
+
+            ufs_KernelXor(&data_sector[offset], &data[bytes_written], chunk, codec);
+            file->ufs->conf->api->WriteSector(cluster_offset, data_sector, sector_size);
+        }
+
+        if (crcKnown)
+        {
+            crc = ufs_KernelCrc32(crc, &data[bytes_written], chunk);
+        }
+        bytes_written += chunk;
+
+        // Read back only the bytes just programmed
+        if (UFS_VERIFY_NOW(sumEnable) &&
+            ufs_VerifyProgram(file->ufs, cluster_offset, offset, &data[bytes_written - chunk], chunk, codec, data_sector) != UFS_OK)
+        {
+            ufs_WriteVerifyFail(file, cluster_index, cluster, current_file_size + bytes_written);
+            ufs_FileUnlock(file->ufs, ufs_ItemSlot(file));
+            ufs_ScratchReturn(file->ufs, data_sector);
+            return UFS_NOT_OK;
+        }
+    }
+
+    // Every sector is programmed, read the new bytes back in one pass
+    if (UFS_VERIFY_LATER(sumEnable))
+    {
+        for (uint32_t position = current_file_size; position < new_size; )
+        {
+            uint16_t cluster_index = position / cluster_size;
+            uint16_t offset = position % sector_size;
+            uint16_t cluster = ufs_ExtentCluster(&file->clusters, cluster_index, NULL);
+            uint32_t chunk = sector_size - offset;
+            if (chunk > new_size - position)
+            {
+                chunk = new_size - position;
+            }
+
+            uint32_t cluster_offset = file->ufs->ClusterDataZoneFirstSector +
+                                      (uint32_t)cluster * UFS_CLUSTER_SECTORS(file->ufs) +
+                                      (position % cluster_size) / sector_size;
+
+            position += chunk;
+            if (ufs_VerifyProgram(file->ufs, cluster_offset, offset, &data[position - chunk - current_file_size], chunk, codec, data_sector) != UFS_OK)
+            {
+                ufs_WriteVerifyFail(file, cluster_index, cluster, position);
+                ufs_FileUnlock(file->ufs, ufs_ItemSlot(file));
+                ufs_ScratchReturn(file->ufs, data_sector);
+                return UFS_NOT_OK;
+            }
+        }
+    }
+
+    ufs_ScratchReturn(file->ufs, data_sector);
+
+    // Lock mutex to record the new metadata
+    if (file->ufs->conf->api->LockMutex && file->ufs->conf->api->mutex)
+    {
+        file->ufs->conf->api->LockMutex((void *)file->ufs->conf->api->mutex);  // Lock the mutex
+    }
+
+    // Update the file's size and metadata after writing all data
+    file->info.comp.size = new_size;
+    file->info.comp.crc = crcKnown ? crc : 0;
+    if (current_file_size == 0)
+    {
+        // Commit at once, mount recovery only trusts data behind a non-empty file
+        ufs_UpdateItemInfo(file->ufs, file);
+    }
+    else
+    {
+        ufs_DeferItemInfo(file->ufs, file, length);
+    }
+
+    // Unlock the mutex after the file operation
+    if (file->ufs->conf->api->UnlockMutex && file->ufs->conf->api->mutex)
+    {
+        file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);
+    }
+    ufs_FileUnlock(file->ufs, ufs_ItemSlot(file));
+
+    return UFS_OK;
+}
+
+/**
+ * @brief   Builds one sector of a relocated cluster in a buffer.
+ *
+ * The sector is read from the old cluster and the bytes from `from` to `to`
+ * that fall in it are replaced, encoded like the rest of the sector.
+ *
+ * @param[in]       file              Pointer to the UFS file structure.
+ * @param[in]       old               Cluster the sector is read from.
+ * @param[in]       sector_in_cluster Position of the sector in the cluster.
+ * @param[in]       start             File position of the first byte of the sector.
+ * @param[in]       from              File position of the first byte to replace.
+ * @param[in]       to                File position after the last byte to replace.
+ * @param[in]       patch             New bytes for the file position `from`, before encoding.
+ * @param[in]       counted           File position from which the replaced bytes are added to the CRCs.
+ * @param[in]       codec             Key the file is encoded with, 0 if it is not encoded.
+ * @param[out]      buffer            Sector buffer receiving the sector.
+ * @param[in,out]   crcOld            CRC of the replaced bytes, NULL to leave the CRCs alone.
+ * @param[in,out]   crcNew            CRC of the new bytes.
+ */
+static void ufs_RelocateSector(ufs_Item_Type *file, uint16_t old, uint16_t sector_in_cluster, uint32_t start,
+                               uint32_t from, uint32_t to, const uint8_t *patch, uint32_t counted, uint8_t codec,
+                               uint8_t *buffer, uint32_t *crcOld, uint32_t *crcNew)
+{
+    UFS *ufs = file->ufs;
+    uint16_t sector_size = UFS_SECTOR_SIZE(ufs);
+
+    ufs->conf->api->ReadSector(ufs->ClusterDataZoneFirstSector + (uint32_t)old * UFS_CLUSTER_SECTORS(ufs) + sector_in_cluster,
+                               buffer, sector_size);
+
+    // Replace the bytes of the range that fall in this sector
+    uint32_t first = (from > start) ? from : start;
+    uint32_t last = (to < start + sector_size) ? to : start + sector_size;
+    if (first < last)
+    {
+        if (crcOld != NULL && first >= counted)
+        {
+            ufs_KernelXor(&buffer[first - start], &buffer[first - start], last - first, codec);
+            *crcOld = ufs_KernelCrc32(*crcOld, &buffer[first - start], last - first);
+            *crcNew = ufs_KernelCrc32(*crcNew, &patch[first - from], last - first);
+        }
+        ufs_KernelXor(&buffer[first - start], &patch[first - from], last - first, codec);
+    }
+}
+
+/**
+ * @brief   Moves one cluster of a file to a free cluster, patching a byte range on the way.
+ *
+ * Used by ufs_WriteAt() when the new bytes cannot be programmed over the old
+ * ones. The sectors of the cluster holding file data are copied to a newly
+ * erased cluster with the bytes from `from` to `to` replaced. The new
+ * cluster is linked in place of the old one on the device before the old
+ * one is released, so a power loss leaves either cluster in the chain. The
+ * rest of the chain is not touched.
+ *
+ * With `sumEnable` the copy is checked as UFS_WRITE_VERIFY selects, like the
+ * sectors of ufs_WriteFile(): each sector right after it is programmed, or
+ * the whole copy before the new cluster is linked.
+ *
+ * @param[in]       file            Pointer to the UFS file structure.
+ * @param[in]       cluster_index   Position of the cluster in the chain of the file.
+ * @param[in]       from            File position of the first byte to replace.
+ * @param[in]       to              File position after the last byte to replace, inside the cluster.
+ * @param[in]       patch           New bytes for the file position `from`, before encoding.
+ * @param[in]       counted         File position from which the replaced bytes are added to the CRCs.
+ * @param[in]       release         State of the old cluster afterwards, UFS_CLUSTER_FREE or UFS_CLUSTER_BAD.
+ * @param[in]       sumEnable       Verify the copied sectors.
+ * @param[in,out]   buffer          Sector buffer.
+ * @param[in,out]   crcOld          CRC of the replaced bytes.
+ * @param[in,out]   crcNew          CRC of the new bytes.
+ *
+ * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK on failure.
+ */
+static ufs_ReturnType ufs_RelocateCluster(ufs_Item_Type *file, uint16_t cluster_index, uint32_t from, uint32_t to,
+                                          const uint8_t *patch, uint32_t counted, uint16_t release,
+                                          ufs_CheckSumStatus sumEnable, uint8_t *buffer, uint32_t *crcOld, uint32_t *crcNew)
+{
+    UFS *ufs = file->ufs;
+    uint16_t sector_size = UFS_SECTOR_SIZE(ufs);
+    uint32_t cluster_size = sector_size * UFS_CLUSTER_SECTORS(ufs);
+    uint32_t base = (uint32_t)cluster_index * cluster_size;
+    uint8_t codec = (file->EncodeEnable == UFS_ENCODE_ENABLE) ? (ufs->DeviceId[0] | BYTE_CODEC_DEFAULT) : 0x00;
+    uint16_t old = ufs_ExtentCluster(&file->clusters, cluster_index, NULL);
+    uint8_t *readback = NULL;
+    uint8_t failed = 0;
+
+    // The sectors read back need a second buffer, the first one holds what was written
+    if (UFS_VERIFY_NOW(sumEnable) || UFS_VERIFY_LATER(sumEnable))
+    {
+        readback = ufs_ScratchBorrow(ufs);
+        if (readback == NULL)
+        {
+            file->err = UFS_ERROR_ALLOCATE_MEM;
+            return UFS_NOT_OK;
+        }
+    }
+
+    // Lock the mutex to reserve the new cluster
+    if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
+    }
+
+    ufs_ReclaimFor(ufs, 1);
+    uint16_t fresh = ufs_FindFreeCluster(ufs, old);
+    if (fresh == 0xFFFF)
+    {
+        file->err = UFS_ERROR_FULL_MEM;
+        if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+        {
+            ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+        }
+        ufs_ScratchReturn(ufs, readback);
+        return UFS_NOT_OK;
+    }
+
+    // Reserve the cluster so no other allocation takes it, it is not linked yet
+    ufs_MapSetEntry(ufs, fresh, UFS_CLUSTER_END);
+    ufs_PrepareClusters(ufs, fresh, 1);
+
+    // The cluster is reserved, the data is copied without the mutex
+    if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+    }
 
-				item->info.comp.parent = ufs->path.id;
-				memcpy(&data_sector[item->location.position * sizeof(ufs_ItemInfo_Type)], item->info.data, sizeof(ufs_ItemInfo_Type));
+    // Copy the sectors holding file data, the others stay erased
+    for (uint16_t sector_in_cluster = 0; sector_in_cluster < UFS_CLUSTER_SECTORS(ufs) && !failed; sector_in_cluster++)
+    {
+        uint32_t start = base + (uint32_t)sector_in_cluster * sector_size;
+        if (start >= file->info.comp.size)
+        {
+            break;
+        }
 
-				for(uint16_t countByte = 0; countByte < ufs->conf->api->u16numberByteOfSector; countByte ++)
-				{
-					if(data_sector[countByte] != 0x00)
-					{
-						data_sector[countByte] ^= BYTE_CODEC_DEFAULT;
-					}
-				}
+        ufs_RelocateSector(file, old, sector_in_cluster, start, from, to, patch, counted, codec, buffer, crcOld, crcNew);
 
-				ufs->conf->api->EraseSector(ufs->ItemZoneFirstSector + item->location.sector_id);
-				ufs->conf->api->WriteSector(ufs->ItemZoneFirstSector + item->location.sector_id, data_sector, ufs->conf->api->u16numberByteOfSector);
+        uint32_t sectorID = ufs->ClusterDataZoneFirstSector + (uint32_t)fresh * UFS_CLUSTER_SECTORS(ufs) + sector_in_cluster;
+        ufs->conf->api->WriteSector(sectorID, buffer, sector_size);
 
-				ufs_GetListCluster(ufs, item);
+        if (UFS_VERIFY_NOW(sumEnable) && ufs_VerifyProgram(ufs, sectorID, 0, buffer, sector_size, 0x00, readback) != UFS_OK)
+        {
+            failed = 1;
+        }
+    }
 
-				ufs->UsedSize += ufs->conf->api->u16numberByteOfSector * ufs->NumberSectorOfCluster;
-			}
-			else
-			{
-				item->err = UFS_ERROR_FULL_CLUSTER;
+    // Deferred verification: the copy is checked once, before the new cluster goes into the chain
+    if (UFS_VERIFY_LATER(sumEnable))
+    {
+        for (uint16_t sector_in_cluster = 0; sector_in_cluster < UFS_CLUSTER_SECTORS(ufs) && !failed; sector_in_cluster++)
+        {
+            uint32_t start = base + (uint32_t)sector_in_cluster * sector_size;
+            if (start >= file->info.comp.size)
+            {
+                break;
+            }
 
-				// Unlock the mutex after the file operation (check UnlockMutex and mutex)
-				if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
-				{
-					ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
-				}
-				return UFS_NOT_OK;
-			}
-    	}
-    	else
-    	{
-			// Update the item zone with the new file entry.
-			item->location.sector_id = slotItem.sector_id;
-			item->location.position  = slotItem.position;
-			item->clusters.length = 0;
-			item->info.comp.first_cluster.sector_id = 0x00;
-			item->info.comp.first_cluster.position = 0x00;
-			item->err = UFS_ERROR_NONE;
+            ufs_RelocateSector(file, old, sector_in_cluster, start, from, to, patch, counted, codec, buffer, NULL, NULL);
 
-			ufs_UpdateItemInfo(ufs, item);
-    	}
+            uint32_t sectorID = ufs->ClusterDataZoneFirstSector + (uint32_t)fresh * UFS_CLUSTER_SECTORS(ufs) + sector_in_cluster;
+            if (ufs_VerifyProgram(ufs, sectorID, 0, buffer, sector_size, 0x00, readback) != UFS_OK)
+            {
+                failed = 1;
+            }
+        }
     }
-    else if (item->location.sector_id == 0xFFFF && slotItem.sector_id == 0xFFFF)
-    {
-        // No file and no available space for a new file.
-        item->err = UFS_ERROR_FULL_FILE;
 
-        // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+    ufs_ScratchReturn(ufs, readback);
+
+    if (failed)
+    {
+        // The old cluster is still in the chain, only the new one is lost
+        if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
+        {
+            ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);
+        }
+        ufs_SetClusterMap(ufs, fresh, UFS_CLUSTER_BAD);
+        file->err = UFS_ERROR_SUM_SECTOR_FAIL;
         if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
         {
-            ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+            ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);
         }
         return UFS_NOT_OK;
     }
 
-    for(uint8_t count = 0; count < ufs->conf->u8NumberEncodeFileExtension; count ++)
+    // Lock the mutex to link the new cluster
+    if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
     {
-    	if(UFS_OK == ufs_BytesCmp((uint8_t *)ufs->conf->pExtensionEncodeFileList[count].pListExtensionName, item->info.comp.name.extention, 3))
-    	{
-    		item->EncodeEnable = UFS_ENCODE_ENABLE;
-    	}
+        ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
     }
 
-    // Mark the item as successfully opened.
-    item->ufs = ufs;
-    item->err = UFS_ERROR_NONE;
-    if(item->info.comp.name.extention[0] != 0x00)
+    // The new cluster takes the place of the old one, the chain on the device changes before the old cluster is released
+    ufs_MapSetEntry(ufs, fresh, ufs_MapGetEntry(ufs, old));
+    if (cluster_index > 0)
     {
-    	item->status = UFS_FILE_EXIST;
+        ufs_MapSetEntry(ufs, ufs_ExtentCluster(&file->clusters, cluster_index - 1, NULL), fresh);
     }
-    else
+    ufs_MapCacheFlush(ufs);
+    if (cluster_index == 0)
     {
-    	item->status = UFS_FOLDER_EXIST;
+        file->info.comp.first_cluster = fresh;
+        ufs_UpdateItemInfo(ufs, file);
     }
+    ufs_MapSetEntry(ufs, old, release);
+
+    // Resolve the chain again as far as it was resolved
+    uint16_t length = file->clusters.length;
+    ufs_ExtentFree(&file->clusters);
+    ufs_RecentForget(ufs, ufs_ItemSlot(file));
+    ufs_ReturnType result = ufs_GetListCluster(ufs, file, length);
 
     // Unlock the mutex after the file operation (check UnlockMutex and mutex)
     if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
     {
         ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
     }
-    return UFS_OK;
+
+    return result;
 }
 
 /**
- * @brief Closes a UFS item and releases allocated memory.
+ * @brief   Writes data at a position of a file in UFS.
  *
- * This function frees memory associated with the cluster list of the item
- * and resets all relevant fields to indicate that the item is no longer in use.
+ * Only the sectors holding the bytes from `position` to `position + length`
+ * are read and programmed, the rest of the file and of its cluster chain is
+ * left alone. Bytes whose new value only clears bits are programmed in place,
+ * with WritePartial when the device provides it. A cluster where a bit would
+ * have to go from 0 to 1 is copied to a free cluster with the new bytes and
+ * linked in place of the old one. The bytes past the end of the file, if
+ * any, are appended with ufs_WriteAppendFile(). The CRC of the file is
+ * updated from the old and new bytes without reading the rest of the file.
  *
- * @param[in] item Pointer to the UFS item structure.
+ * @param[in]   file        Pointer to the UFS file structure.
+ * @param[in]   position    File position of the first byte to write, at most the size of the file.
+ * @param[in]   data        Pointer to the data buffer to be written.
+ * @param[in]   length      The number of bytes to write.
+ * @param[in]   sumEnable   Verifies the programmed data (CHECKSUM_ENABLE/CHECKSUM_DISABLE), unless UFS_WRITE_VERIFY is UFS_VERIFY_NONE.
  *
- * @return ufs_ReturnType UFS_OK on success, UFS_NOT_OK if the item is invalid.
+ * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK on failure.
  */
-ufs_ReturnType ufs_CloseItem(ufs_Item_Type *item)
+__fast
+ufs_ReturnType ufs_WriteAt(ufs_Item_Type *file, uint32_t position, uint8_t *data, uint32_t length, ufs_CheckSumStatus sumEnable)
 {
-    if (item == NULL)
+    if (file->ufs == NULL || file->err != UFS_ERROR_NONE)
     {
-        item->err = UFS_ERROR_ALLOCATE_MEM;
         return UFS_NOT_OK;
     }
 
-    // Free the cluster list and reset length
-    free(item->clusters.value);
-    item->clusters.length = 0;
+    if (file->status != UFS_FILE_EXIST)
+    {
+        file->err = UFS_ERROR_ITEM_NOT_FILE;
+        return UFS_NOT_OK;
+    }
 
-    // Reset item info to default values
-    item->info.data[0] = UFS_ITEM_FREE;
-    item->info.comp.name.length = 0;
-    item->info.comp.size = 0;
-    item->info.comp.first_cluster.sector_id = 0xFFFF;
-    item->info.comp.first_cluster.position = 0;
+    // The data cannot start past the end of the file, it would leave a hole
+    uint32_t size = file->info.comp.size;
+    if (position > size)
+    {
+        return UFS_NOT_OK;
+    }
 
-    // Reset item location
-    item->location.sector_id = 0xFFFF;
-    item->location.position = 0;
+    // Bytes inside the file are replaced, the others are appended
+    uint32_t inside = (length < size - position) ? length : (size - position);
+    if (inside == 0)
+    {
+        return ufs_WriteAppendFile(file, data, length, sumEnable);
+    }
 
-    // Mark the item as free and detach it from UFS
-    item->status = UFS_ITEM_FREE;
-    item->ufs = NULL;
+    UFS *ufs = file->ufs;
+    uint16_t sector_size = UFS_SECTOR_SIZE(ufs);
+    uint32_t cluster_size = sector_size * UFS_CLUSTER_SECTORS(ufs);
+    uint8_t codec = (file->EncodeEnable == UFS_ENCODE_ENABLE) ? (ufs->DeviceId[0] | BYTE_CODEC_DEFAULT) : 0x00;
+    uint8_t verify = (sumEnable == CHECKSUM_ENABLE && UFS_WRITE_VERIFY != UFS_VERIFY_NONE);
+    uint32_t crc = file->info.comp.crc;
+    uint32_t crcOld = 0;     // CRC of the bytes replaced
+    uint32_t crcNew = 0;     // CRC of the bytes written over them
+    uint32_t done = 0;       // Bytes of data already in place
+    ufs_ReturnType result = UFS_OK;
+
+    uint8_t *buffer = ufs_ScratchBorrow(ufs);
+    if (buffer == NULL)
+    {
+        file->err = UFS_ERROR_ALLOCATE_MEM;
+        return UFS_NOT_OK;
+    }
 
-    return UFS_OK;
-}
+    // Keep readers and other writers of the file out until the write is done
+    ufs_FileLock(ufs, ufs_ItemSlot(file), 1);
 
-/**
- * @brief Deletes a file from the UFS system.
- *
- * This function cleans the cluster list associated with the file and resets
- * the item fields, marking it as deleted in the UFS.
- *
- * @param[in] item Pointer to the UFS item structure.
- *
- * @return ufs_ReturnType UFS_OK on success, UFS_NOT_OK if the item is invalid.
- */
-ufs_ReturnType ufs_DeleteItem(ufs_Item_Type *item)
-{
-    if (item == NULL || item->ufs == NULL)
+    // Lock the mutex to ensure thread safety (check LockMutex and mutex)
+    if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
     {
-        item->err = UFS_ERROR_ALLOCATE_MEM;
-        return UFS_NOT_OK;
+        ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
     }
 
-    if(item->err != UFS_ERROR_NONE)
+    // Only the chain up to the last byte replaced is needed
+    if (ufs_GetListCluster(ufs, file, (position + inside - 1) / cluster_size + 1) != UFS_OK)
     {
-    	item->err = UFS_ERROR_NOT_EXISTED;
-    	return UFS_NOT_OK;
+        result = UFS_NOT_OK;
+    }
+    else if (crc != 0)
+    {
+        // The content changes before the new CRC is known, a power loss must not leave the old one
+        file->info.comp.crc = 0;
+        ufs_UpdateItemInfo(ufs, file);
     }
 
-    // Update cluter  list
-    ufs_GetListCluster(item->ufs, item);
+    // Cached file sectors are outdated from now on
+    ufs->DataVersion++;
 
-    // Clean up the cluster list
-    ufs_CleanClusters(item->ufs, item->clusters.value, item->clusters.length);
+    // The chain is resolved, the data is programmed without the mutex
+    if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+    }
 
-    free(item->clusters.value);
-    item->clusters.length = 0;
+    while (result == UFS_OK && done < inside)
+    {
+        uint16_t cluster_index = (position + done) / cluster_size;
+        uint16_t cluster = ufs_ExtentCluster(&file->clusters, cluster_index, NULL);
+        uint16_t release = UFS_CLUSTER_FREE;
+        uint32_t counted = 0;
+
+        // Bytes of data that fall in this cluster
+        uint32_t cluster_end = (uint32_t)(cluster_index + 1) * cluster_size - position;
+        if (cluster_end > inside)
+        {
+            cluster_end = inside;
+        }
 
-    // Reset item info to indicate deletion
-    item->info.data[0] = UFS_ITEM_FREE;
-    item->info.comp.name.length = 0;
-    item->info.comp.size = 0;
-    item->info.comp.first_cluster.sector_id = 0xFFFF;
-    item->info.comp.first_cluster.position = 0;
+        // Program the sectors in place as long as only bits set to 1 have to be cleared
+        while (done < cluster_end)
+        {
+            uint32_t at = position + done;
+            uint16_t offset = at % sector_size;
+            uint32_t sectorID = ufs->ClusterDataZoneFirstSector + (uint32_t)cluster * UFS_CLUSTER_SECTORS(ufs) +
+                                (at % cluster_size) / sector_size;
+            uint32_t chunk = sector_size - offset;
+            if (chunk > cluster_end - done)
+            {
+                chunk = cluster_end - done;
+            }
 
-    // Update UFS with the changes
-    ufs_UpdateItemInfo(item->ufs, item);
+            // Read the bytes to replace, from the start of the sector when the whole sector is programmed
+            uint8_t *current = buffer;
+            if (ufs->conf->api->WritePartial != NULL && ufs->conf->api->ReadRange != NULL)
+            {
+                ufs->conf->api->ReadRange(sectorID, offset, buffer, chunk);
+            }
+            else
+            {
+                ufs->conf->api->ReadSector(sectorID, buffer, offset + chunk);
+                current = &buffer[offset];
+            }
 
-    // Reset item location
-    item->location.sector_id = 0xFFFF;
-    item->location.position = 0;
+            if (ufs_KernelProgrammable(current, &data[done], chunk, codec) != UFS_OK)
+            {
+                break;
+            }
 
-    // Mark the item as free and detach it from UFS
-    item->status = UFS_ITEM_FREE;
-    item->ufs = NULL;
+            // Keep the CRCs of both versions, then replace the bytes
+            ufs_KernelXor(current, current, chunk, codec);
+            crcOld = ufs_KernelCrc32(crcOld, current, chunk);
+            crcNew = ufs_KernelCrc32(crcNew, &data[done], chunk);
+            ufs_KernelXor(current, &data[done], chunk, codec);
 
-    return UFS_OK;
+            if (ufs->conf->api->WritePartial != NULL)
+            {
+                ufs->conf->api->WritePartial(sectorID, offset, current, chunk);
+            }
+            else
+            {
+                // Bytes before the range are programmed with the value they already have
+                ufs->conf->api->WriteSector(sectorID, buffer, offset + chunk);
+            }
+            done += chunk;
+
+            // A sector that fails here has lost its old bytes, the cluster is moved and retired
+            if (verify && ufs_VerifyProgram(ufs, sectorID, offset, &data[done - chunk], chunk, codec, buffer) != UFS_OK)
+            {
+                done -= chunk;
+                counted = position + done + chunk;
+                release = UFS_CLUSTER_BAD;
+                break;
+            }
+        }
+
+        // Move the cluster when the rest of its range cannot be programmed in place
+        if (done < cluster_end)
+        {
+            result = ufs_RelocateCluster(file, cluster_index, position + done, position + cluster_end, &data[done],
+                                         (counted != 0) ? counted : (position + done), release, sumEnable,
+                                         buffer, &crcOld, &crcNew);
+            done = cluster_end;
+        }
+    }
+
+    ufs_ScratchReturn(ufs, buffer);
+
+    // Lock the mutex to record the new metadata
+    if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
+    }
+
+    // The CRC follows the replaced bytes, the rest of the file does not have to be read
+    if (result == UFS_OK && crc != 0)
+    {
+        file->info.comp.crc = crc ^ ufs_KernelCrc32Shift(crcOld ^ crcNew, size - position - inside);
+        ufs_DeferItemInfo(ufs, file, inside);
+    }
+
+    // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+    if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+    }
+    ufs_FileUnlock(ufs, ufs_ItemSlot(file));
+
+    // Append what goes past the end of the file
+    if (result == UFS_OK && inside < length)
+    {
+        result = ufs_WriteAppendFile(file, &data[inside], length - inside, sumEnable);
+    }
+
+    return result;
 }
 
 /**
- * @brief   Counts the number of used items in the UFS item zone.
- *
- * This function iterates over the sectors in the item zone and counts
- * the number of non-free items. The item zone is specified by the
- * starting and ending sector numbers defined in the UFS structure.
+ * @brief   Number of sectors in the ring of a stream, the full sectors kept back plus the one being staged.
+ */
+#define UFS_STREAM_SLOTS    (UFS_WRITE_BEHIND_SECTORS + 1)
+
+/**
+ * @brief   Reads back the sectors a stream programmed since its last verify.
  *
- * @param[in]   ufs   Pointer to the UFS (Universal File System) structure.
- *                    It contains configuration and function pointers for accessing
- *                    the hardware API and memory mapping.
+ * Used with UFS_VERIFY_DEFERRED, the sectors are checked against the
+ * checksums kept when they were programmed. A sector failing the check
+ * fails the stream and its cluster is marked bad on ufs_StreamClose().
  *
- * @return      uint16_t  The number of used items found in the UFS item zone.
- *                        Returns 0 if there was an error (e.g., memory allocation failure).
+ * @param[in]   stream   Pointer to an open stream.
  *
- * @note        The function allocates memory dynamically for sector data. Ensure
- *              that there is enough system memory available, and the allocated memory
- *              is properly freed after usage.
+ * @return      ufs_ReturnType  UFS_OK if every sector matches, UFS_NOT_OK otherwise.
  */
-uint16_t ufs_CountItem(UFS *ufs)
+static ufs_ReturnType ufs_StreamVerify(ufs_Stream_Type *stream)
 {
-    uint16_t count = 0;
-    // Allocate memory for one sector worth of data
-    uint8_t data_sector[ufs->conf->api->u16numberByteOfSector];
+    UFS *ufs = stream->file->ufs;
+    uint16_t sector_size = UFS_SECTOR_SIZE(ufs);
+    uint8_t *readback = ufs_ScratchBorrow(ufs);
 
-    uint16_t totalSectors = ufs->ClusterMappingZoneFirstSector - ufs->ItemZoneFirstSector;
-    uint16_t itemsPerSector = ufs->conf->api->u16numberByteOfSector / sizeof(ufs_ItemInfo_Type);
+    if (readback == NULL)
+    {
+        stream->file->err = UFS_ERROR_ALLOCATE_MEM;
+        return UFS_NOT_OK;
+    }
 
-    for (uint16_t sector = 0; sector < totalSectors; sector ++)
+    for (; stream->verified < stream->sectors; stream->verified++)
     {
-        // Read sector data into the allocated memory
-        ufs->conf->api->ReadSector(ufs->ItemZoneFirstSector + sector, data_sector, ufs->conf->api->u16numberByteOfSector);
-        for(uint16_t countByte = 0; countByte < ufs->conf->api->u16numberByteOfSector; countByte ++)
-        {
-        	if(data_sector[countByte] != 0x00)
-        	{
-        		data_sector[countByte] ^= BYTE_CODEC_DEFAULT;
-        	}
-        }
+        uint16_t cluster = ufs_ExtentCluster(&stream->clusters, stream->verified / UFS_CLUSTER_SECTORS(ufs), NULL);
+        uint32_t sectorID = ufs->ClusterDataZoneFirstSector +
+                            (uint32_t)cluster * UFS_CLUSTER_SECTORS(ufs) +
+                            stream->verified % UFS_CLUSTER_SECTORS(ufs);
 
-        // Iterate through each item in the sector
-        for (uint16_t segment = 0; segment < itemsPerSector; segment++)
+        ufs->conf->api->ReadSector(sectorID, readback, sector_size);
+        if (stream->sums[stream->verified % UFS_VERIFY_BATCH_SECTORS] != ufs_CheckSum(readback, sector_size))
         {
-            uint8_t  itemStatus = data_sector[segment * sizeof(ufs_ItemInfo_Type)];
-            uint16_t parent = data_sector[segment * sizeof(ufs_ItemInfo_Type) + 24u];
-
-            // If the item is not free, count it
-            if (itemStatus != UFS_ITEM_FREE && parent == ufs->path.id)
-            {
-                count++;
-            }
+            stream->badCluster = cluster;
+            stream->file->err = UFS_ERROR_SUM_SECTOR_FAIL;
+            ufs_ScratchReturn(ufs, readback);
+            return UFS_NOT_OK;
         }
     }
 
-    return count;       // Return the count of items
+    ufs_ScratchReturn(ufs, readback);
+    return UFS_OK;
 }
 
 /**
- * @brief Checks the existence of a directory or file within the currently mounted folder in UFS.
+ * @brief   Programs the oldest staging sector of a stream into its next sector.
  *
- * This function scans the item zone in the UFS to verify if a specified
- * directory or file name exists within the mounted folder. If found,
- * the provided item structure is populated with its details.
+ * Clusters are allocated UFS_STREAM_BLOCKS_AHEAD erase blocks at a time when the
+ * stream reaches the end of its chain. Bytes after `length` are padded with
+ * the erased value, so the sector can still be appended to later.
  *
- * @param[in] ufs    Pointer to the UFS structure.
- * @param[in] name   Name of the directory or file to check.
- * @param[out] item  Pointer to store detailed information of the item if found.
+ * @param[in]   stream   Pointer to an open stream.
+ * @param[in]   length   Number of bytes staged in the sector.
  *
- * @return ufs_ReturnType UFS_OK if the item exists within the mounted folder, UFS_NOT_OK otherwise.
+ * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK on failure.
  */
-ufs_ReturnType ufs_CheckExistence(UFS *ufs, uint8_t *name, ufs_Item_Type *item)
+static ufs_ReturnType ufs_StreamProgram(ufs_Stream_Type *stream, uint16_t length)
 {
-    uint8_t data_sector[ufs->conf->api->u16numberByteOfSector]; // Buffer for reading sector data
-
-    // Parse the file or directory name
-    ufs_ParseNameFile(name, &item->info.comp.name);
+    UFS *ufs = stream->file->ufs;
+    uint16_t sector_size = UFS_SECTOR_SIZE(ufs);
+    uint16_t cluster_index = stream->sectors / UFS_CLUSTER_SECTORS(ufs);
+    uint8_t *buffer = &stream->buffer[(uint32_t)stream->head * sector_size];
 
-    item->err = UFS_ERROR_NONE;
-    // Traverse each sector in the item zone to search for the item
-    for (uint16_t countSector = 0; countSector < (ufs->ClusterMappingZoneFirstSector - ufs->ItemZoneFirstSector); countSector++)
+    // Extend the chain when the stream reaches its end, the new clusters are linked after its tail
+    if (cluster_index >= stream->clusters.length)
     {
-        // Read data from the current sector
-        ufs->conf->api->ReadSector(ufs->ItemZoneFirstSector + countSector, data_sector, ufs->conf->api->u16numberByteOfSector);
-
-        // Decode the sector data
-        for (uint16_t countByte = 0; countByte < ufs->conf->api->u16numberByteOfSector; countByte++)
+        if (ufs_OrderClusters(ufs, &stream->clusters, UFS_STREAM_BLOCKS_AHEAD * ufs_ClustersOfBlock(ufs)) != UFS_OK)
         {
-            if (data_sector[countByte] != 0x00)
-            {
-                data_sector[countByte] ^= BYTE_CODEC_DEFAULT;
-            }
+            stream->file->err = UFS_ERROR_FULL_MEM;
+            return UFS_NOT_OK;
         }
+    }
 
-        // Traverse each segment within the sector
-        for (uint16_t countSegment = 0; countSegment < (ufs->conf->api->u16numberByteOfSector / sizeof(ufs_ItemInfo_Type)); countSegment++)
-        {
-            // Retrieve the path ID of the current segment
-            uint16_t *path_id = (uint16_t *)&data_sector[countSegment * sizeof(ufs_ItemInfo_Type) + 24u];
+    uint16_t cluster = ufs_ExtentCluster(&stream->clusters, cluster_index, NULL);
+    uint32_t sectorID = ufs->ClusterDataZoneFirstSector +
+                        (uint32_t)cluster * UFS_CLUSTER_SECTORS(ufs) +
+                        stream->sectors % UFS_CLUSTER_SECTORS(ufs);
 
-            // Compare the item name, type, and path ID to check for a match within the mounted folder
-            if (
-                UFS_OK == ufs_BytesCmp(item->info.comp.name.head, &data_sector[countSegment * sizeof(ufs_ItemInfo_Type)], item->info.comp.name.length) &&
-                UFS_OK == ufs_BytesCmp(item->info.comp.name.extention, &data_sector[countSegment * sizeof(ufs_ItemInfo_Type) + MAX_NAME_LENGTH], 3) &&
-				item->info.comp.name.length == data_sector[countSegment * sizeof(ufs_ItemInfo_Type) + MAX_NAME_LENGTH + 3] &&
-                ufs->path.id == *path_id)
-            {
-                // Populate the item structure with details of the found item
-                item->location.sector_id = countSector;
-                item->location.position = countSegment;
-                item->status = (item->info.comp.name.extention[0] == 0x00) ? UFS_FOLDER_EXIST : UFS_FILE_EXIST;
-                item->err = UFS_ERROR_NONE;
-                item->ufs = ufs;
-                memcpy(item->info.data, &data_sector[countSegment * sizeof(ufs_ItemInfo_Type)], sizeof(ufs_ItemInfo_Type));
-                return UFS_OK;
-            }
+    // Pad the rest of the sector with the erased value
+    memset(&buffer[length], UFS_BYTE_VALUE_AFTER_ERASE, sector_size - length);
+
+    // Keep the checksum of the sector until its batch is read back
+    if (UFS_VERIFY_LATER(stream->sumEnable))
+    {
+        stream->sums[stream->sectors % UFS_VERIFY_BATCH_SECTORS] = ufs_CheckSum(buffer, sector_size);
+    }
+
+    ufs->conf->api->WriteSector(sectorID, buffer, sector_size);
+    ufs->DataVersion++;
+
+    // Read back the staged bytes just programmed, the ring slot still holds them
+    if (UFS_VERIFY_NOW(stream->sumEnable))
+    {
+        uint8_t *readback = ufs_ScratchBorrow(ufs);
+        ufs_ReturnType result = (readback == NULL) ? UFS_NOT_OK :
+                                ufs_VerifyProgram(ufs, sectorID, 0, buffer, length, 0x00, readback);
+        ufs_ScratchReturn(ufs, readback);
+
+        if (result != UFS_OK)
+        {
+            stream->badCluster = cluster;
+            stream->file->err = UFS_ERROR_SUM_SECTOR_FAIL;
+            return UFS_NOT_OK;
         }
     }
 
-    // If the item was not found, mark it as not existing and return failure
-    item->location.sector_id = 0xFFFF;
-    item->location.position = 0xFFFF;
-    item->status = UFS_ITEM_FREE;
-    item->err = UFS_ERROR_NOT_EXISTED;
-    return UFS_NOT_OK;
-}
+    // Release the ring slot
+    stream->sectors++;
+    stream->head = (stream->head + 1) % UFS_STREAM_SLOTS;
 
-/**
- * @brief   Retrieves a list of used items from the UFS item zone.
- *
- * This function reads sectors from the item zone and copies the information of
- * non-free items into the provided array of `ufs_ItemInfo_Type`. It stops when
- * the specified number of items (`length`) has been read or when there are no
- * more items in the item zone.
- *
- * @param[in]   ufs         Pointer to the UFS (Universal File System) structure,
- *                          which contains configuration and hardware API details.
- *
- * @param[out]  item_info   Pointer to an array of `ufs_ItemInfo_Type` structures
- *                          where the retrieved item information will be stored.
- *
- * @param[in]   length      The maximum number of items to retrieve. This determines
- *                          how many items will be copied to the `item_info` array.
+    // Read the batch back once it is complete
+    if (UFS_VERIFY_LATER(stream->sumEnable) && stream->sectors - stream->verified == UFS_VERIFY_BATCH_SECTORS)
+    {
+        return ufs_StreamVerify(stream);
+    }
+
+    return UFS_OK;
+}
+
+/**
+ * @brief   Programs the full sectors waiting in the ring of a stream.
  *
- * @return      uint16_t    The number of items successfully read and copied into
- *                          the `item_info` array.
+ * @param[in]   stream   Pointer to an open stream.
+ * @param[in]   budget   Maximum number of sectors to program, 0 programs all of them.
  *
- * @note        The function allocates memory for sector data and frees it after
- *              use. Ensure that the `item_info` array is large enough to hold the
- *              number of items specified by `length`.
+ * @return      uint16_t  Number of sectors programmed.
  */
-uint16_t ufs_GetListItem(UFS *ufs, ufs_ItemInfo_Type *item_info, uint16_t length)
+static uint16_t ufs_StreamDrain(ufs_Stream_Type *stream, uint16_t budget)
 {
-    uint16_t item_read = 0;
-    // Allocate memory for one sector worth of data
-    uint8_t data_sector[ufs->conf->api->u16numberByteOfSector];
+    uint16_t number = 0;
 
-    uint16_t totalSectors = ufs->ClusterMappingZoneFirstSector - ufs->ItemZoneFirstSector;
-    uint16_t itemsPerSector = ufs->conf->api->u16numberByteOfSector / sizeof(ufs_ItemInfo_Type);
-
-    for (uint16_t sector = 0; sector < totalSectors; sector++)
+    while (stream->queued > 0 && stream->file->err == UFS_ERROR_NONE && (budget == 0 || number < budget))
     {
-        // Read sector data into the allocated memory
-        ufs->conf->api->ReadSector(ufs->ItemZoneFirstSector + sector, data_sector, ufs->conf->api->u16numberByteOfSector);
-        for(uint16_t countByte = 0; countByte < ufs->conf->api->u16numberByteOfSector; countByte ++)
-        {
-        	if(data_sector[countByte] != 0x00)
-        	{
-        		data_sector[countByte] ^= BYTE_CODEC_DEFAULT;
-        	}
-        }
-        // Iterate through each item in the sector
-        for (uint16_t segment = 0; segment < itemsPerSector; segment++)
+        if (ufs_StreamProgram(stream, UFS_SECTOR_SIZE(stream->file->ufs)) != UFS_OK)
         {
-            uint8_t itemStatus = data_sector[segment * sizeof(ufs_ItemInfo_Type)];
-            uint16_t parent = data_sector[segment * sizeof(ufs_ItemInfo_Type) + 24u];
-
-            // If the item is not free, copy its data
-            if (itemStatus != UFS_ITEM_FREE &&  parent == ufs->path.id)
-            {
-                memcpy(item_info[item_read].data, &data_sector[segment * sizeof(ufs_ItemInfo_Type)], sizeof(ufs_ItemInfo_Type));
-
-                // If the desired number of items has been read, return immediately
-                if (++item_read == length)
-                {
-                    return length;
-                }
-            }
+            break;
         }
+        stream->queued--;
+        number++;
     }
 
-    return item_read;   // Return the actual number of items read
+    return number;
 }
 
 /**
- * @brief   Calculates the total used size in the UFS item zone.
+ * @brief   Returns the CRC32 of the content of a file.
  *
- * This function computes the total size used by items in the UFS item zone.
- * It first counts the number of non-free items, retrieves the list of items,
- * and then sums their sizes in terms of the number of sectors used.
+ * The CRC is kept up to date by ufs_WriteFile(), ufs_WriteAppendFile() and
+ * ufs_StreamClose() and stored with the item, so the call normally costs no
+ * flash access. It is the CRC-32 of zlib, over the data as written by the
+ * application (before encoding). Files written by older versions, or whose
+ * size was repaired at mount, have no CRC yet: their content is read once,
+ * and the CRC is stored with the next metadata commit.
  *
- * @param[in]   ufs     Pointer to the UFS (Universal File System) structure,
- *                      which contains configuration and hardware API details.
+ * @param[in]   file   Pointer to the UFS file structure.
+ * @param[out]  crc    CRC32 of the file content.
  *
- * @return      uint32_t    The total size of used items in bytes. If there is
- *                          an error (e.g., memory allocation failure), the function
- *                          will return the calculated size up to the failure point.
- *
- * @note        The function dynamically allocates memory for storing item information.
- *              Ensure sufficient memory is available.
+ * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK on failure.
  */
-uint32_t ufs_GetUsedSize(UFS *ufs)
+ufs_ReturnType ufs_GetFileCrc(ufs_Item_Type *file, uint32_t *crc)
 {
-    uint32_t used_size = 0;
-    ufs_ItemInfo_Type *items_info = NULL;
-
-    // Get the number of items in the item zone
-    uint16_t numberItem = ufs_CountItem(ufs);
-
-    // Allocate memory to store information about each item
-    items_info = (ufs_ItemInfo_Type *)calloc(numberItem, sizeof(ufs_ItemInfo_Type));
-    if (!items_info)
+    if (file == NULL || crc == NULL || file->ufs == NULL || file->err != UFS_ERROR_NONE)
     {
-        // Handle memory allocation failure
-        return used_size;
+        return UFS_NOT_OK;
     }
 
-    // Lock the mutex to ensure thread safety (check LockMutex and mutex)
-    if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
+    if (file->status != UFS_FILE_EXIST)
     {
-        ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
+        file->err = UFS_ERROR_ITEM_NOT_FILE;
+        return UFS_NOT_OK;
     }
 
-    // Retrieve the list of used items
-    ufs_GetListItem(ufs, items_info, numberItem);
+    UFS *ufs = file->ufs;
+    uint16_t sector_size = UFS_SECTOR_SIZE(ufs);
 
-    // Iterate through the items and calculate their used size
-    for (uint16_t countItem = 0; countItem < numberItem; countItem++)
+    // Keep writers out while the CRC is read or computed
+    ufs_FileLock(ufs, ufs_ItemSlot(file), 0);
+
+    // A CRC of 0 on a non-empty file means it is not known
+    uint32_t value = file->info.comp.crc;
+    uint32_t size = file->info.comp.size;
+    if (value != 0 || size == 0)
+    {
+        ufs_FileUnlock(ufs, ufs_ItemSlot(file));
+        *crc = value;
+        return UFS_OK;
+    }
+
+    uint8_t *buffer = ufs_ScratchBorrow(ufs);
+    if (buffer == NULL)
     {
-        uint32_t itemSize = items_info[countItem].comp.size;
-        uint32_t sectorSize = ufs->conf->api->u16numberByteOfSector;
+        ufs_FileUnlock(ufs, ufs_ItemSlot(file));
+        file->err = UFS_ERROR_ALLOCATE_MEM;
+        return UFS_NOT_OK;
+    }
 
-        // Calculate the total size for this item in terms of full sectors
-        used_size += ((itemSize / sectorSize) + 1) * sectorSize;
+    // Read the content once, a sector at a time
+    for (uint32_t position = 0; position < size; )
+    {
+        uint32_t chunk = (size - position < sector_size) ? (size - position) : sector_size;
+        if (ufs_ReadFile(file, position, buffer, chunk) != chunk)
+        {
+            ufs_ScratchReturn(ufs, buffer);
+            ufs_FileUnlock(ufs, ufs_ItemSlot(file));
+            return UFS_NOT_OK;
+        }
+        value = ufs_KernelCrc32(value, buffer, chunk);
+        position += chunk;
     }
+    ufs_ScratchReturn(ufs, buffer);
 
-    // Free the allocated memory for items_info
-    free(items_info);
+    // Lock the mutex to record the CRC
+    if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
+    }
 
-    ufs->UsedSize = used_size;
+    file->info.comp.crc = value;
+    ufs_DeferItemInfo(ufs, file, 0);
 
     // Unlock the mutex after the file operation (check UnlockMutex and mutex)
     if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
     {
         ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
     }
-    return used_size;
+    ufs_FileUnlock(ufs, ufs_ItemSlot(file));
+
+    *crc = value;
+    return UFS_OK;
 }
 
 /**
- * @brief   Retrieves the total usable size of the UFS device.
+ * @brief   Starts streaming new content into an open file.
  *
- * This function calculates the usable size of the device based on the number of
- * sectors available in the device, starting from the first data zone sector.
+ * The previous content of the file is kept until ufs_StreamClose() commits
+ * the new one. Data fed to the stream is staged in a ring of
+ * UFS_WRITE_BEHIND_SECTORS sectors and programmed sector by sector into
+ * clusters allocated ahead. The stream is registered with the UFS, so
+ * ufs_Drain() and ufs_Sync() can program the sectors it holds.
  *
- * @param[in]   ufs     Pointer to the UFS (Universal File System) structure,
- *                      which contains configuration and hardware API details.
+ * @param[out]  stream      Pointer to the stream structure.
+ * @param[in]   file        Pointer to an open file.
+ * @param[in]   sumEnable   Indicates if each programmed sector should be verified.
  *
- * @return      uint32_t    The total usable device size in bytes. If the input
- *                          `ufs` or `ufs->conf` is NULL, the function returns 0.
+ * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK on failure.
  */
-uint32_t ufs_GetDeviceSize(UFS *ufs)
+ufs_ReturnType ufs_StreamOpen(ufs_Stream_Type *stream, ufs_Item_Type *file, ufs_CheckSumStatus sumEnable)
 {
-    // Ensure the input pointers are valid
-    if (ufs != NULL && ufs->conf != NULL)
+    if (stream == NULL || file == NULL || file->ufs == NULL || file->err != UFS_ERROR_NONE)
     {
-        uint16_t sectorSize = ufs->conf->api->u16numberByteOfSector;
-        uint32_t totalSectors = ufs->conf->api->u32numberSectorOfDevice;
-        uint32_t dataZoneStartSector = ufs->ClusterDataZoneFirstSector;
+        return UFS_NOT_OK;
+    }
 
-        // Calculate the usable size starting from the data zone
-        return sectorSize * (totalSectors - dataZoneStartSector);
+    if (file->status != UFS_FILE_EXIST)
+    {
+        file->err = UFS_ERROR_ITEM_NOT_FILE;
+        return UFS_NOT_OK;
     }
 
-    // Return 0 if input pointers are invalid
-    return 0;
+    // Allocate the staging ring followed by the checksums of a deferred verify batch, the chain starts empty
+    stream->buffer = (uint8_t *)malloc((uint32_t)UFS_STREAM_SLOTS * UFS_SECTOR_SIZE(file->ufs) +
+                                       ((UFS_WRITE_VERIFY == UFS_VERIFY_DEFERRED) ? UFS_VERIFY_BATCH_SECTORS : 0));
+    if (stream->buffer == NULL)
+    {
+        stream->file = NULL;
+        file->err = UFS_ERROR_ALLOCATE_MEM;
+        return UFS_NOT_OK;
+    }
+
+    stream->clusters.extent = NULL;
+    stream->clusters.number = 0;
+    stream->clusters.capacity = 0;
+    stream->clusters.length = 0;
+    stream->file = file;
+    stream->head = 0;
+    stream->queued = 0;
+    stream->fill = 0;
+    stream->sectors = 0;
+    stream->size = 0;
+    stream->crc = 0;
+    stream->badCluster = 0xFFFF;
+    stream->sumEnable = sumEnable;
+    stream->verified = 0;
+    stream->sums = &stream->buffer[(uint32_t)UFS_STREAM_SLOTS * UFS_SECTOR_SIZE(file->ufs)];
+
+    // Lock the mutex to ensure thread safety (check LockMutex and mutex)
+    if (file->ufs->conf->api->LockMutex && file->ufs->conf->api->mutex)
+    {
+        file->ufs->conf->api->LockMutex((void *)file->ufs->conf->api->mutex);  // Lock the mutex
+    }
+
+    stream->next = file->ufs->Streams;
+    file->ufs->Streams = stream;
+
+    // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+    if (file->ufs->conf->api->UnlockMutex && file->ufs->conf->api->mutex)
+    {
+        file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);  // Unlock the mutex
+    }
+
+    return UFS_OK;
 }
 
 /**
- * @brief   Reads data from a file in UFS.
+ * @brief   Feeds data to a stream.
  *
- * This function reads data from the specified file, starting from the given position
- * and continuing for the specified length. The data is copied into the provided buffer.
+ * The data is encoded if needed and copied into the staging ring. Full
+ * sectors are left in the ring for ufs_Drain(), a sector is programmed here
+ * only when the ring has no free slot left, so the call returns without
+ * touching the flash as long as the drain keeps up. A program or verify
+ * failure of a drained sector is reported by the next call.
  *
- * @param[in]   file      Pointer to the UFS file structure.
- * @param[in]   position  The starting position within the file from where to begin reading.
- * @param[out]  data      Pointer to the buffer where the read data will be stored.
- * @param[in]   length    The number of bytes to read from the file.
+ * @param[in]   stream   Pointer to an open stream.
+ * @param[in]   data     Pointer to the data buffer.
+ * @param[in]   length   Number of bytes to write.
  *
- * @return      uint32_t  The number of bytes successfully read from the file.
+ * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK on failure.
  */
 __fast
-uint32_t ufs_ReadFile(ufs_Item_Type *file, uint32_t position, uint8_t *data, uint32_t length)
+ufs_ReturnType ufs_StreamFeed(ufs_Stream_Type *stream, uint8_t *data, uint32_t length)
 {
-	if(file->ufs == NULL || file->err != UFS_ERROR_NONE)
-	{
-		 return UFS_NOT_OK;
-	}
-
-    if(file->status != UFS_FILE_EXIST)
+    if (stream == NULL || stream->file == NULL || stream->file->err != UFS_ERROR_NONE)
     {
-    	file->err = UFS_ERROR_ITEM_NOT_FILE;
-    	return UFS_NOT_OK;
+        return UFS_NOT_OK;
     }
 
-    uint32_t bytes_read = 0;
-    uint32_t cluster_index = position / (file->ufs->conf->api->u16numberByteOfSector * file->ufs->NumberSectorOfCluster);
-    uint32_t offset_within_cluster = position % (file->ufs->conf->api->u16numberByteOfSector * file->ufs->NumberSectorOfCluster);
-
-    uint8_t data_sector[file->ufs->conf->api->u16numberByteOfSector];
+    UFS *ufs = stream->file->ufs;
+    uint16_t sector_size = UFS_SECTOR_SIZE(ufs);
+    uint8_t codec = (stream->file->EncodeEnable == UFS_ENCODE_ENABLE) ? (ufs->DeviceId[0] | BYTE_CODEC_DEFAULT) : 0x00;
 
     // Lock the mutex to ensure thread safety (check LockMutex and mutex)
-    if (file->ufs->conf->api->LockMutex && file->ufs->conf->api->mutex)
+    if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
     {
-        file->ufs->conf->api->LockMutex((void *)file->ufs->conf->api->mutex);  // Lock the mutex
+        ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
     }
 
-    // Loop through clusters and sectors to read the requested data
-    while (bytes_read < length && cluster_index < file->clusters.length)
+    while (length > 0)
     {
-        // Read each sector in the current cluster
-    	uint16_t sector_start = offset_within_cluster / file->ufs->conf->api->u16numberByteOfSector;
-    	uint16_t offset_within_sector = offset_within_cluster % file->ufs->conf->api->u16numberByteOfSector;
-
-        for (uint16_t sector_in_cluster = sector_start; sector_in_cluster < file->ufs->NumberSectorOfCluster; sector_in_cluster++)
+        uint8_t *buffer = &stream->buffer[(uint32_t)((stream->head + stream->queued) % UFS_STREAM_SLOTS) * sector_size];
+        uint32_t chunk = sector_size - stream->fill;
+        if (chunk > length)
         {
-            // Read the current sector into the buffer
-            file->ufs->conf->api->ReadSector(file->ufs->ClusterDataZoneFirstSector + file->clusters.value[cluster_index] * file->ufs->NumberSectorOfCluster + sector_in_cluster,
-                                             data_sector,
-                                             file->ufs->conf->api->u16numberByteOfSector);
+            chunk = length;
+        }
 
-            // Copy data from sector to the output buffer
-            for (uint16_t countByte = offset_within_sector; countByte < file->ufs->conf->api->u16numberByteOfSector; countByte++)
-            {
-                data[bytes_read] = data_sector[countByte];
-                if(file->EncodeEnable == UFS_ENCODE_ENABLE)
-                {
-                	data[bytes_read] ^= file->ufs->DeviceId[0] |  BYTE_CODEC_DEFAULT;
-                }
-                bytes_read++;
+        // Stage the data, applying encoding if enabled
+        ufs_KernelXor(&buffer[stream->fill], data, chunk, codec);
+        stream->crc = ufs_KernelCrc32(stream->crc, data, chunk);
 
-                if (bytes_read == length || bytes_read == file->info.comp.size)  // Stop reading once we've read the requested amount
-                {
-                    // Unlock the mutex after the file operation (check UnlockMutex and mutex)
-                    if (file->ufs->conf->api->UnlockMutex && file->ufs->conf->api->mutex)
-                    {
-                        file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);  // Unlock the mutex
-                    }
-                    return bytes_read;
-                }
-            }
+        stream->fill += chunk;
+        stream->size += chunk;
+        data += chunk;
+        length -= chunk;
 
-            // Reset the offset for the next sector
-            offset_within_sector =  0;
+        if (stream->fill == sector_size)
+        {
+            stream->queued++;
+            stream->fill = 0;
         }
-        offset_within_cluster = 0;
 
-        // Move to the next cluster
-        cluster_index++;
+        // Program the oldest sector once the ring has no free slot left
+        if (stream->queued == UFS_STREAM_SLOTS && ufs_StreamDrain(stream, 1) == 0)
+        {
+            // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+            if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+            {
+                ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+            }
+            return UFS_NOT_OK;
+        }
     }
 
     // Unlock the mutex after the file operation (check UnlockMutex and mutex)
-    if (file->ufs->conf->api->UnlockMutex && file->ufs->conf->api->mutex)
+    if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
     {
-        file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);  // Unlock the mutex
+        ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
     }
-    return bytes_read;  // Return the number of bytes successfully read
+    return UFS_OK;
 }
 
 /**
- * @brief   Writes data to a file in UFS.
+ * @brief   Finishes a stream and commits the new file content.
  *
- * This function writes the provided data to the specified file. It clears the old
- * clusters, reallocates memory for new clusters if needed, and writes the data
- * into the sectors of the file. If new clusters are required, they will be allocated
- * accordingly. The file's metadata, including the cluster count and size, will be updated.
+ * The sectors waiting in the ring and the staged bytes are programmed, unused
+ * clusters are released and the file size and first cluster are written once. The previous content of the file
+ * is released only after the new one is committed. On failure the new chain
+ * is released and the previous content of the file is kept.
  *
- * @param[in]   file    Pointer to the UFS file structure.
- * @param[in]   data    Pointer to the data buffer to be written.
- * @param[in]   length  Length of the data to be written (in bytes).
+ * @param[in]   stream   Pointer to an open stream.
  *
  * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK on failure.
  */
-__fast
-ufs_ReturnType ufs_WriteFile(ufs_Item_Type *file, uint8_t *data, uint32_t length, ufs_CheckSumStatus sumEnable)
+ufs_ReturnType ufs_StreamClose(ufs_Stream_Type *stream)
 {
-	if(file->ufs == NULL || file->err != UFS_ERROR_NONE)
-	{
-		 return UFS_NOT_OK;
-	}
-
-    if(file->status != UFS_FILE_EXIST)
+    if (stream == NULL || stream->file == NULL)
     {
-    	file->err = UFS_ERROR_ITEM_NOT_FILE;
-    	return UFS_NOT_OK;
+        return UFS_NOT_OK;
     }
 
-    uint32_t cluster_size = file->ufs->conf->api->u16numberByteOfSector * file->ufs->NumberSectorOfCluster;
-    uint32_t number_clusters = (length + cluster_size - 1) / cluster_size + 1;  // Calculate number of clusters needed
-    uint16_t cluster_index = 0;
-    uint32_t bytes_written = 0;
+    ufs_Item_Type *file = stream->file;
+    UFS *ufs = file->ufs;
+    ufs_ReturnType result = UFS_OK;
 
-    uint8_t sumSector      = 0;
-    uint8_t sector_buffer[file->ufs->conf->api->u16numberByteOfSector];
+    // The previous content is swapped out, wait for the reads in progress on the file
+    ufs_FileLock(ufs, ufs_ItemSlot(file), 1);
 
     // Lock the mutex to ensure thread safety (check LockMutex and mutex)
-    if (file->ufs->conf->api->LockMutex && file->ufs->conf->api->mutex)
+    if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
     {
-        file->ufs->conf->api->LockMutex((void *)file->ufs->conf->api->mutex);  // Lock the mutex
+        ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
     }
 
-    // Clean up any old clusters used by the file
-    ufs_CleanClusters(file->ufs, file->clusters.value, file->clusters.length);
+    // Program the waiting sectors, then the last, partially filled one (an empty file still owns one cluster)
+    ufs_StreamDrain(stream, 0);
+    if (file->err == UFS_ERROR_NONE && (stream->fill > 0 || stream->sectors == 0))
+    {
+        ufs_StreamProgram(stream, stream->fill);
+    }
 
-    // Reallocate memory for the new cluster list
-    file->clusters.value = (uint16_t *)realloc(file->clusters.value, number_clusters * sizeof(uint16_t));
-    if (file->clusters.value == NULL)
+    // Read back the sectors of the last, incomplete batch before the new content is committed
+    if (UFS_VERIFY_LATER(stream->sumEnable) && file->err == UFS_ERROR_NONE)
     {
-        // Memory allocation failure
-        file->err = UFS_ERROR_ALLOCATE_MEM;
+        ufs_StreamVerify(stream);
+    }
 
-        // Unlock the mutex after the file operation (check UnlockMutex and mutex)
-        if (file->ufs->conf->api->UnlockMutex && file->ufs->conf->api->mutex)
+    // Unregister the stream
+    for (ufs_Stream_Type **link = &ufs->Streams; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == stream)
         {
-            file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);  // Unlock the mutex
+            *link = stream->next;
+            break;
         }
-        return UFS_NOT_OK;
     }
 
-    // Update the cluster length to reflect the new number of clusters
-    file->clusters.length = number_clusters;
-
-    // Order the clusters for the new data
-    if (ufs_OrderClusters(file->ufs, file->clusters.value, number_clusters) != UFS_OK)
+    if (file->err == UFS_ERROR_NONE)
     {
-        // Cluster allocation failure
-        file->err = UFS_ERROR_FULL_MEM;
+        // Release the clusters allocated ahead but not used
+        uint16_t used = (stream->sectors + UFS_CLUSTER_SECTORS(ufs) - 1) / UFS_CLUSTER_SECTORS(ufs);
+        if (used < stream->clusters.length)
+        {
+            ufs_CleanClusters(ufs, &stream->clusters, used);
+        }
 
-        // Unlock the mutex after the file operation (check UnlockMutex and mutex)
-        if (file->ufs->conf->api->UnlockMutex && file->ufs->conf->api->mutex)
+        // Commit the new content, the previous chain stays allocated until the item points at the new one
+        uint16_t previous = file->info.comp.first_cluster;
+        ufs_ExtentFree(&file->clusters);
+        ufs_RecentForget(ufs, ufs_ItemSlot(file));
+
+        file->clusters = stream->clusters;
+        file->info.comp.size = stream->size;
+        file->info.comp.crc = stream->crc;
+        file->info.comp.first_cluster = file->clusters.extent[0].start;
+        if (ufs_UpdateItemInfo(ufs, file) == UFS_OK)
         {
-            file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);  // Unlock the mutex
+            // Then release the previous one, a power loss before that leaves an orphan the next mount reclaims
+            ufs_ReclaimPush(ufs, previous);
+        }
+        else
+        {
+            result = UFS_NOT_OK;
         }
-        return UFS_NOT_OK;
     }
-
-    // Start writing the data to the file's clusters
-    for (cluster_index = 0; cluster_index < number_clusters; cluster_index++)
+    else
     {
-        for (uint16_t sector_in_cluster = 0; sector_in_cluster < file->ufs->NumberSectorOfCluster; sector_in_cluster++)
+        // Drop the new content and keep the bad cluster out of use
+        ufs_CleanClusters(ufs, &stream->clusters, 0);
+        if (stream->badCluster != 0xFFFF)
         {
-            uint32_t cluster_offset = file->ufs->ClusterDataZoneFirstSector +
-                                      (file->clusters.value[cluster_index] * file->ufs->NumberSectorOfCluster) + sector_in_cluster;
+            ufs_MapSetEntry(ufs, stream->badCluster, UFS_CLUSTER_BAD);
+        }
+        ufs_ExtentFree(&stream->clusters);
+        result = UFS_NOT_OK;
+    }
 
-            // Write data into the buffer, one sector at a time
-            for (uint16_t byte_in_sector = 0; byte_in_sector < file->ufs->conf->api->u16numberByteOfSector; byte_in_sector++)
-            {
-                if (bytes_written < length)
-                {
-                    sector_buffer[byte_in_sector] = data[bytes_written++];
-                    if(file->EncodeEnable == UFS_ENCODE_ENABLE)
-                    {
-                    	sector_buffer[byte_in_sector] ^= file->ufs->DeviceId[0] | BYTE_CODEC_DEFAULT;
-                    }
-                }
-                else
-                {
-                    sector_buffer[byte_in_sector] = UFS_BYTE_VALUE_AFTER_ERASE;  // Pad remaining sector bytes with 0 if needed
-                }
-            }
+    ufs_MapCacheFlush(ufs);
 
-            if(sumEnable == CHECKSUM_ENABLE)
-            {
-            	sumSector = ufs_CheckSum(sector_buffer, file->ufs->conf->api->u16numberByteOfSector);
-            }
+    free(stream->buffer);
+    stream->buffer = NULL;
+    stream->sums = NULL;
+    stream->next = NULL;
+    stream->queued = 0;
+    stream->fill = 0;
+    stream->clusters.extent = NULL;
+    stream->clusters.number = 0;
+    stream->clusters.capacity = 0;
+    stream->clusters.length = 0;
+    stream->file = NULL;
 
-            // Write the buffer to the current sector
-            file->ufs->conf->api->WriteSector(cluster_offset, sector_buffer, file->ufs->conf->api->u16numberByteOfSector);
+    // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+    if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+    }
+    ufs_FileUnlock(ufs, ufs_ItemSlot(file));
+    return result;
+}
 
-            if(sumEnable == CHECKSUM_ENABLE)
-            {
-            	file->ufs->conf->api->ReadSector(cluster_offset, sector_buffer, file->ufs->conf->api->u16numberByteOfSector);
-            	if(sumSector != ufs_CheckSum(sector_buffer, file->ufs->conf->api->u16numberByteOfSector))
-            	{
-            		file->info.comp.size += bytes_written;
-            		ufs_CleanClusters(file->ufs, &file->clusters.value[cluster_index], number_clusters - cluster_index);
-            		ufs_SetClusterMap(file->ufs ,file->clusters.value[cluster_index], UFS_CLUSTER_BAD);
-            	    file->err = UFS_ERROR_SUM_SECTOR_FAIL;
+/**
+ * @brief   Programs sectors left in RAM by open streams.
+ *
+ * Each call programs at most `budget` full sectors, taken from the open
+ * streams in turn, and is meant to be called from a storage task or while
+ * the device is idle, so ufs_StreamFeed() returns without waiting for the
+ * flash. A failure is kept in the stream file and reported by its next
+ * ufs_StreamFeed() or ufs_StreamClose().
+ *
+ * @param[in]   ufs      Pointer to the UFS structure.
+ * @param[in]   budget   Maximum number of sectors to program, 0 programs all of them.
+ *
+ * @return      uint16_t  Number of sectors programmed.
+ */
+uint16_t ufs_Drain(UFS *ufs, uint16_t budget)
+{
+    uint16_t number = 0;
 
-            	    // Unlock the mutex after the file operation
-            	    if (file->ufs->conf->api->UnlockMutex && file->ufs->conf->api->mutex)
-            	    {
-            	        file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);
-            	    }
-            	    return UFS_NOT_OK;
-            	}
-            }
+    if (ufs == NULL)
+    {
+        return 0;
+    }
 
-            if (bytes_written == length)  // Stop if all data has been written
-            {
-                break;
-            }
-        }
+    // Lock the mutex to ensure thread safety (check LockMutex and mutex)
+    if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
+    }
 
-        if (bytes_written == length)
-        {
-            break;
-        }
+    for (ufs_Stream_Type *stream = ufs->Streams; stream != NULL && (budget == 0 || number < budget); stream = stream->next)
+    {
+        number += ufs_StreamDrain(stream, (budget == 0) ? 0 : budget - number);
     }
+    ufs->stats.DataDrain += number;
 
-    // Update file metadata to reflect the new size
-    file->info.comp.size = length;
-    file->info.comp.first_cluster.sector_id = file->clusters.value[0] / (file->ufs->conf->api->u16numberByteOfSector / 2);
-    file->info.comp.first_cluster.position = file->clusters.value[0] % (file->ufs->conf->api->u16numberByteOfSector / 2);
+    // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+    if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+    }
+    return number;
+}
+
+/**
+ * @brief   Queues a request behind the waiting requests of the same or a higher priority.
+ *
+ * @param[in]   ufs       Pointer to the UFS structure.
+ * @param[in]   request   Pointer to the request.
+ */
+static void ufs_RequestInsert(UFS *ufs, ufs_Request_Type *request)
+{
+    ufs_Request_Type **link = &ufs->Requests;
 
-    // Write updated metadata to the file system
-    ufs_UpdateItemInfo(file->ufs, file);
+    // Lock the mutex to ensure thread safety (check LockMutex and mutex)
+    if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
+    }
 
-    // Unlock the mutex after the file operation (check UnlockMutex and mutex)
-    if (file->ufs->conf->api->UnlockMutex && file->ufs->conf->api->mutex)
+    while (*link != NULL && (*link)->priority >= request->priority)
     {
-        file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);  // Unlock the mutex
+        link = &(*link)->next;
     }
+    request->next = *link;
+    *link = request;
 
-    return UFS_OK;
+    // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+    if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+    {
+        ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
+    }
 }
 
 /**
- * @brief   Appends data to the end of a file in UFS.
+ * @brief   Runs one step of a request.
  *
- * This function appends the provided data to the specified file. It manages clusters
- * by extending the cluster list if necessary and writing the new data to the correct
- * sectors. The function also handles partially filled clusters, writing to the free
- * space in the last cluster if available.
+ * Reads and writes move at most UFS_REQUEST_SLICE_BYTES bytes per step, a
+ * write request replaces the file content on its first step and appends on
+ * the following ones.
  *
- * @param[in]   file        Pointer to the UFS file structure.
- * @param[in]   data        Pointer to the data buffer to be appended.
- * @param[in]   length      The number of bytes to append to the file.
- * @param[in]   sumEnable   Indicates if checksum should be enabled (CHECKSUM_ENABLE/CHECKSUM_DISABLE).
+ * @param[in]   ufs       Pointer to the UFS structure.
+ * @param[in]   request   Pointer to the request.
  *
- * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK on failure.
+ * @return      uint8_t  1 when the request needs another step, 0 when it is complete.
  */
-__fast
-ufs_ReturnType ufs_WriteAppendFile(ufs_Item_Type *file, uint8_t *data, uint32_t length, ufs_CheckSumStatus sumEnable)
+static uint8_t ufs_RequestStep(UFS *ufs, ufs_Request_Type *request)
 {
-    if(file->ufs == NULL || file->err != UFS_ERROR_NONE)
-	{
-		return UFS_NOT_OK;
-	}
+    uint32_t chunk = request->length - request->done;
 
-    if(file->status != UFS_FILE_EXIST)
-    {
-    	file->err = UFS_ERROR_ITEM_NOT_FILE;
-    	return UFS_NOT_OK;
-    }
-
-    uint32_t current_file_size = file->info.comp.size;  // Get current file size
-    uint32_t new_size = current_file_size + length;     // Calculate new size after appending
-    uint32_t bytes_written = 0;                         // Track how many bytes have been written
-    uint32_t cluster_size = file->ufs->conf->api->u16numberByteOfSector * file->ufs->NumberSectorOfCluster; // Calculate total cluster size
-    uint16_t cluster_index = 0;
-    uint32_t offset_within_cluster = current_file_size % cluster_size;  // Get the offset within the last cluster
-    uint8_t sumSector = 0;  // Variable to store the checksum of the sector
-
-    // Calculate current and new number of clusters required
-    uint16_t current_cluster_count = (current_file_size + cluster_size - 1) / cluster_size + 1;
-    uint16_t new_cluster_count = (new_size + cluster_size - 1) / cluster_size + 1;
-
-    // Allocate memory for sector-level buffer
-    uint8_t data_sector[file->ufs->conf->api->u16numberByteOfSector];
-
-    // Lock mutex for thread safety
-    if (file->ufs->conf->api->LockMutex && file->ufs->conf->api->mutex)
+    if (UFS_REQUEST_SLICE_BYTES > 0 && chunk > UFS_REQUEST_SLICE_BYTES)
     {
-        file->ufs->conf->api->LockMutex((void *)file->ufs->conf->api->mutex);  // Lock the mutex
+        chunk = UFS_REQUEST_SLICE_BYTES;
     }
 
-    // If new clusters are needed, expand the file->clusters.value array
-    if (new_cluster_count > current_cluster_count)
+    switch (request->op)
     {
-        uint16_t additional_clusters = new_cluster_count - current_cluster_count + 1;
-
-        // Reallocate memory for the new clusters
-        file->clusters.value = (uint16_t *)realloc(file->clusters.value, new_cluster_count * sizeof(uint16_t));
-        if (file->clusters.value == NULL)
+        case UFS_REQUEST_READ:
         {
-            file->err = UFS_ERROR_ALLOCATE_MEM;  // Handle memory allocation failure
-            if (file->ufs->conf->api->LockMutex != NULL && file->ufs->conf->api->mutex)
+            // ufs_ReadFile returns UFS_NOT_OK on error, which cannot be told
+            // apart from a one byte read, the item state tells the two apart
+            if (request->item->ufs == NULL || request->item->err != UFS_ERROR_NONE)
             {
-            	file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);  // Unlock the mutex
+                request->result = UFS_NOT_OK;
+                return 0;
             }
-            return UFS_NOT_OK;
-        }
 
-        // Allocate new clusters for the file
-        if (ufs_OrderClusters(file->ufs, &file->clusters.value[current_cluster_count - 1], additional_clusters) != UFS_OK)
-        {
-            file->err = UFS_ERROR_FULL_MEM;  // Handle cluster allocation failure
-            if (file->ufs->conf->api->LockMutex != NULL && file->ufs->conf->api->mutex)
+            uint32_t bytes_read = ufs_ReadFile(request->item, request->position + request->done, &request->data[request->done], chunk);
+            if (request->item->err != UFS_ERROR_NONE)
             {
-            	file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);  // Unlock the mutex
+                request->result = UFS_NOT_OK;
+                return 0;
             }
-            return UFS_NOT_OK;
+            request->done += bytes_read;
+
+            // A short read stops at the end of the file
+            return (bytes_read == chunk && request->done < request->length) ? 1 : 0;
         }
 
-        // Set cluster map to link the newly allocated clusters
-        ufs_SetClusterMap(file->ufs, file->clusters.value[current_cluster_count - 2], file->clusters.value[current_cluster_count - 1]);
+        case UFS_REQUEST_WRITE:
+        case UFS_REQUEST_APPEND:
+            if (request->op == UFS_REQUEST_WRITE && request->done == 0)
+            {
+                request->result = ufs_WriteFile(request->item, request->data, chunk, request->sumEnable);
+            }
+            else
+            {
+                request->result = ufs_WriteAppendFile(request->item, &request->data[request->done], chunk, request->sumEnable);
+            }
 
-        // Update the cluster length
-        file->clusters.length = new_cluster_count;
-    }
+            if (request->result != UFS_OK)
+            {
+                return 0;
+            }
+            request->done += chunk;
+            return (request->done < request->length) ? 1 : 0;
 
-    // Start writing data from the last cluster
-    cluster_index = current_file_size / cluster_size;
-    offset_within_cluster = current_file_size % cluster_size;
+        case UFS_REQUEST_OPEN:
+            request->result = ufs_OpenItem(ufs, request->name, request->item);
+            return 0;
 
-    // Write data to the last cluster if it has available space
-    if (offset_within_cluster > 0)
-    {
-        uint16_t sector_offset = offset_within_cluster / file->ufs->conf->api->u16numberByteOfSector;  // Calculate sector offset
-        uint32_t cluster_offset = file->ufs->ClusterDataZoneFirstSector +
-                                  file->clusters.value[cluster_index] * file->ufs->NumberSectorOfCluster + sector_offset;
-        uint32_t cluster_offset_old = cluster_offset;
+        case UFS_REQUEST_DELETE:
+            request->result = ufs_DeleteItem(request->item);
+            return 0;
 
-        // Read the sector to update the existing data
-        file->ufs->conf->api->ReadSector(cluster_offset, data_sector, file->ufs->conf->api->u16numberByteOfSector);
+        default:
+            request->result = UFS_NOT_OK;
+            return 0;
+    }
+}
 
-        // Write data into the free space of the last sector
-        for (uint32_t countByte = offset_within_cluster; countByte < cluster_size && bytes_written < length; countByte++)
-        {
-            sector_offset = countByte / file->ufs->conf->api->u16numberByteOfSector;
-            cluster_offset = file->ufs->ClusterDataZoneFirstSector + file->clusters.value[cluster_index] * file->ufs->NumberSectorOfCluster + sector_offset;
+/**
+ * @brief   Queues a request for the task running ufs_Serve().
+ *
+ * The request is inserted behind the waiting requests of the same or a
+ * higher priority and must not be modified until it completes. Buffers and
+ * items it points to must stay valid until then.
+ *
+ * @param[in]   ufs       Pointer to the UFS structure.
+ * @param[in]   request   Pointer to the request.
+ *
+ * @return      ufs_ReturnType  UFS_OK when the request is queued, UFS_NOT_OK if it is invalid or already pending.
+ */
+ufs_ReturnType ufs_Submit(UFS *ufs, ufs_Request_Type *request)
+{
+    if (ufs == NULL || request == NULL || request->item == NULL || request->pending)
+    {
+        return UFS_NOT_OK;
+    }
 
-            if (cluster_offset != cluster_offset_old)
-            {
-                // Write the old sector before moving to a new one
-                if (sumEnable == CHECKSUM_ENABLE)
-                {
-                    sumSector = ufs_CheckSum(data_sector, file->ufs->conf->api->u16numberByteOfSector);  // Calculate checksum for the sector
-                }
+    if (request->op == UFS_REQUEST_OPEN && request->name == NULL)
+    {
+        return UFS_NOT_OK;
+    }
 
-                file->ufs->conf->api->WriteSector(cluster_offset_old, data_sector, file->ufs->conf->api->u16numberByteOfSector);
+    request->done = 0;
+    request->result = UFS_OK;
+    request->pending = 1;
+    ufs_RequestInsert(ufs, request);
 
-                if (sumEnable == CHECKSUM_ENABLE)
-                {
-                    file->ufs->conf->api->ReadSector(cluster_offset_old, data_sector, file->ufs->conf->api->u16numberByteOfSector);
-                    if (sumSector != ufs_CheckSum(data_sector, file->ufs->conf->api->u16numberByteOfSector))
-                    {
-                        file->info.comp.size += bytes_written;  // Update file size to account for the error
-                        ufs_CleanClusters(file->ufs, &file->clusters.value[cluster_index], file->clusters.length - cluster_index);  // Clean the bad clusters
-                        ufs_SetClusterMap(file->ufs, file->clusters.value[cluster_index], UFS_CLUSTER_BAD);  // Mark as bad
-                        file->err = UFS_ERROR_SUM_SECTOR_FAIL;  // Set error for checksum failure
-
-                        // Unlock the mutex after the file operation
-                        if (file->ufs->conf->api->UnlockMutex && file->ufs->conf->api->mutex)
-                        {
-                            file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);
-                        }
-                        return UFS_NOT_OK;
-                    }
-                }
+    return UFS_OK;
+}
 
-                cluster_offset_old = cluster_offset;
-                file->ufs->conf->api->ReadSector(cluster_offset, data_sector, file->ufs->conf->api->u16numberByteOfSector);
-            }
+/**
+ * @brief   Serves queued requests.
+ *
+ * Each step takes the first request of the queue and runs it through the
+ * synchronous API, so the mutex is only held for one step at a time. A read
+ * or write longer than UFS_REQUEST_SLICE_BYTES is put back in the queue after
+ * each step, which lets a request of a higher priority, or an earlier one of
+ * the same priority, run in between. When a request completes, `pending` is
+ * cleared and its completion callback is called from this task.
+ *
+ * @param[in]   ufs      Pointer to the UFS structure.
+ * @param[in]   budget   Maximum number of steps to run, 0 runs until the queue is empty.
+ *
+ * @return      uint16_t  Number of steps run.
+ */
+uint16_t ufs_Serve(UFS *ufs, uint16_t budget)
+{
+    uint16_t number = 0;
 
-            // Write the data into the buffer
-            data_sector[countByte % file->ufs->conf->api->u16numberByteOfSector] = data[bytes_written++];
+    if (ufs == NULL)
+    {
+        return 0;
+    }
 
-            // Apply encoding if enabled
-            if (file->EncodeEnable == UFS_ENCODE_ENABLE)
-            {
-                data_sector[countByte % file->ufs->conf->api->u16numberByteOfSector] ^= file->ufs->DeviceId[0] | BYTE_CODEC_DEFAULT;
-            }
+    while (budget == 0 || number < budget)
+    {
+        // Lock the mutex to ensure thread safety (check LockMutex and mutex)
+        if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
+        {
+            ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
         }
 
-        if (sumEnable == CHECKSUM_ENABLE)
+        ufs_Request_Type *request = ufs->Requests;
+        if (request != NULL)
         {
-            sumSector = ufs_CheckSum(data_sector, file->ufs->conf->api->u16numberByteOfSector);  // Calculate final checksum for the sector
+            ufs->Requests = request->next;
+            request->next = NULL;
         }
 
-        // Write back the sector after appending data
-        file->ufs->conf->api->WriteSector(cluster_offset, data_sector, file->ufs->conf->api->u16numberByteOfSector);
-
-        // Verify the written data with checksum
-        if (sumEnable == CHECKSUM_ENABLE)
+        // Unlock the mutex after the file operation (check UnlockMutex and mutex)
+        if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
         {
-            file->ufs->conf->api->ReadSector(cluster_offset, data_sector, file->ufs->conf->api->u16numberByteOfSector);
-            if (sumSector != ufs_CheckSum(data_sector, file->ufs->conf->api->u16numberByteOfSector))
-            {
-                file->info.comp.size += bytes_written;
-                ufs_CleanClusters(file->ufs, &file->clusters.value[cluster_index], file->clusters.length - cluster_index);
-                ufs_SetClusterMap(file->ufs, file->clusters.value[cluster_index], UFS_CLUSTER_BAD);
-                file->err = UFS_ERROR_SUM_SECTOR_FAIL;
-
-                // Unlock the mutex after the file operation
-                if (file->ufs->conf->api->UnlockMutex && file->ufs->conf->api->mutex)
-                {
-                    file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);
-                }
-                return UFS_NOT_OK;
-            }
+            ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);  // Unlock the mutex
         }
 
-        // If all data has been written, clean up and return success
-        if (bytes_written == length)
+        if (request == NULL)
         {
-            file->info.comp.size = new_size;  // Update the file size
-            ufs_UpdateItemInfo(file->ufs, file);  // Update file metadata
-
-            // Unlock the mutex after completing the file operation
-            if (file->ufs->conf->api->UnlockMutex && file->ufs->conf->api->mutex)
-            {
-                file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);
-            }
-
-            return UFS_OK;
+            break;
         }
-    }
 
-    // Write remaining data into new clusters
-    for (cluster_index = (current_cluster_count - 1); cluster_index < file->clusters.length; cluster_index++)
-    {
-        // Check if the cluster is valid
-        if (file->clusters.value[cluster_index] == UFS_CLUSTER_END || file->clusters.value[cluster_index] == UFS_CLUSTER_BAD)
+        if (ufs_RequestStep(ufs, request))
         {
-            ufs_CleanClusters(file->ufs, &file->clusters.value[cluster_index], new_cluster_count - current_cluster_count + 1);
-            file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);  // Unlock the mutex before returning
-
-            // Unlock the mutex after the file operation
-            if (file->ufs->conf->api->UnlockMutex && file->ufs->conf->api->mutex)
-            {
-                file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);
-            }
-            return UFS_NOT_OK;
+            ufs_RequestInsert(ufs, request);
         }
-
-        // Write data into each sector of the cluster
-        for (uint16_t sector_in_cluster = 0; sector_in_cluster < file->ufs->NumberSectorOfCluster; sector_in_cluster++)
+        else
         {
-            uint32_t cluster_offset = file->ufs->ClusterDataZoneFirstSector +
-                                      file->clusters.value[cluster_index] * file->ufs->NumberSectorOfCluster + sector_in_cluster;
-
-            // Write the data to the sector buffer
-            for (uint16_t countByte = 0; countByte < file->ufs->conf->api->u16numberByteOfSector; countByte++)
-            {
-                if (bytes_written < length)
-                {
-                    data_sector[countByte] = data[bytes_written++];  // Write data to the buffer
-
-                    // Apply encoding if enabled
-                    if (file->EncodeEnable == UFS_ENCODE_ENABLE)
-                    {
-                        data_sector[countByte] ^= file->ufs->DeviceId[0] | BYTE_CODEC_DEFAULT;
-                    }
-                }
-                else
-                {
-                	data_sector[countByte] = UFS_BYTE_VALUE_AFTER_ERASE;
-                }
-            }
-
-            // If checksum is enabled, calculate and verify it
-            if (sumEnable == CHECKSUM_ENABLE)
-            {
-                sumSector = ufs_CheckSum(data_sector, file->ufs->conf->api->u16numberByteOfSector);
-            }
-
-            // Write the buffer back to the current sector
-            file->ufs->conf->api->WriteSector(cluster_offset, data_sector, file->ufs->conf->api->u16numberByteOfSector);
-
-            if (sumEnable == CHECKSUM_ENABLE)
-            {
-                file->ufs->conf->api->ReadSector(cluster_offset, data_sector, file->ufs->conf->api->u16numberByteOfSector);
-                if (sumSector != ufs_CheckSum(data_sector, file->ufs->conf->api->u16numberByteOfSector))
-                {
-                    file->info.comp.size += bytes_written;  // Update file size to account for failure
-                    ufs_CleanClusters(file->ufs, &file->clusters.value[cluster_index], file->clusters.length - cluster_index);  // Clean bad clusters
-                    ufs_SetClusterMap(file->ufs, file->clusters.value[cluster_index], UFS_CLUSTER_BAD);  // Mark the cluster as bad
-                    file->err = UFS_ERROR_SUM_SECTOR_FAIL;  // Set error for checksum failure
-
-                    if (file->ufs->conf->api->UnlockMutex && file->ufs->conf->api->mutex)
-                    {
-                        file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);
-                    }
-                    return UFS_NOT_OK;
-                }
-            }
-
-            // Stop writing if all data is written
-            if (bytes_written >= length)
+            request->pending = 0;
+            if (request->Complete)
             {
-                break;
+                request->Complete(request);
             }
         }
-
-        // Stop if all data is written
-        if (bytes_written >= length)
-        {
-            break;
-        }
-    }
-
-    // Update the file's size and metadata after writing all data
-    file->info.comp.size = new_size;
-    ufs_UpdateItemInfo(file->ufs, file);
-
-    // Unlock the mutex after the file operation
-    if (file->ufs->conf->api->UnlockMutex && file->ufs->conf->api->mutex)
-    {
-        file->ufs->conf->api->UnlockMutex((void *)file->ufs->conf->api->mutex);
+        number++;
     }
 
-    return UFS_OK;
+    return number;
 }
 
 /**
  * @brief   Renames an item in the UFS (Universal File System).
  *
- * This function renames a given item in the UFS by searching through the item zone
- * and checking if the desired name already exists. If the name exists, the function
- * returns an error. If not, it updates the item's name and metadata.
+ * This function renames a given item in the UFS by checking in the item index
+ * if the desired name already exists in the item's folder. If the name exists, the
+ * function returns an error. If not, it updates the item's name and metadata.
  *
  * @param[in]   item      Pointer to the UFS item structure.
  * @param[in]   strName   New name for the item.
@@ -1911,43 +5248,19 @@ ufs_ReturnType ufs_RenameItem(ufs_Item_Type *item, uint8_t *strName)
 
     ufs_Name_Type nameChecker;  // Temporary storage for the parsed name
 
-    // Allocate memory for sector-level buffer to read item zone data
-    uint8_t data_sector[item->ufs->conf->api->u16numberByteOfSector];
-
     // Parse the new name to check if it is valid
     ufs_ParseNameFile(strName, &nameChecker);
 
-    // Iterate through the item zone to find if the new name already exists
-    for (uint16_t countSector = 0; countSector < (item->ufs->ClusterMappingZoneFirstSector - item->ufs->ItemZoneFirstSector); countSector++)
+    // Check if the new name already exists in the same folder
+    if (ufs_IndexFind(item->ufs, item->info.comp.parent, &nameChecker) != 0xFFFF)
     {
-        // Read the sector from the item zone
-        item->ufs->conf->api->ReadSector(item->ufs->ItemZoneFirstSector + countSector, data_sector, item->ufs->conf->api->u16numberByteOfSector);
-        for(uint16_t countByte = 0; countByte < item->ufs->conf->api->u16numberByteOfSector; countByte ++)
-        {
-        	if(data_sector[countByte] != 0x00)
-        	{
-        		data_sector[countByte] ^= BYTE_CODEC_DEFAULT;
-        	}
-        }
-        // Iterate through the segments in the sector
-        for (uint16_t countSegment = 0; countSegment < (item->ufs->conf->api->u16numberByteOfSector / sizeof(ufs_ItemInfo_Type)); countSegment++)
-        {
-            // Check if the file name and extension match any existing file in the segment
-            if (
-                UFS_OK == ufs_BytesCmp(nameChecker.head, &data_sector[countSegment * sizeof(ufs_ItemInfo_Type)], nameChecker.length) &&
-                UFS_OK == ufs_BytesCmp(nameChecker.extention, &data_sector[countSegment * sizeof(ufs_ItemInfo_Type) + MAX_NAME_LENGTH], 3) &&
-                nameChecker.length == data_sector[countSegment * sizeof(ufs_ItemInfo_Type) + MAX_NAME_LENGTH + 3]
-            )
-            {
-                // File with the same name exists, return error
-                item->err = UFS_ERROR_EXISTED;
-                return UFS_NOT_OK;
-            }
-        }
+        // File with the same name exists, return error
+        item->err = UFS_ERROR_EXISTED;
+        return UFS_NOT_OK;
     }
 
     // If no existing file with the same name, update the item's name
-    ufs_ParseNameFile(strName, &item->info.comp.name);
+    memcpy(&item->info.comp.name, &nameChecker, sizeof(ufs_Name_Type));
     ufs_UpdateItemInfo(item->ufs, item);  // Update item information in the system
 
     // Return success
@@ -2083,7 +5396,7 @@ ufs_ReturnType ufs_ParsePath(const uint8_t *path, ufs_PathNode **head, int max_p
 /**
  * @brief   Finds an available slot in the storage area for a new item.
  *
- * This function scans through the item storage area and returns the first available
+ * This function searches the in-RAM item index and returns the first available
  * `slotID` for storing a new item.
  *
  * @param[in]  ufs     Pointer to the UFS structure.
@@ -2093,46 +5406,19 @@ ufs_ReturnType ufs_ParsePath(const uint8_t *path, ufs_PathNode **head, int max_p
  */
 ufs_ReturnType ufs_FindFreeSlot(UFS *ufs, ufs_Location_Type *slotID)
 {
-    // Allocate memory to hold data for one sector
-    uint8_t data_sector[ufs->conf->api->u16numberByteOfSector];
-
-    // Calculate the total number of sectors in the item zone
-    uint16_t totalSectors = ufs->ClusterMappingZoneFirstSector - ufs->ItemZoneFirstSector;
-    uint16_t itemsPerSector = ufs->conf->api->u16numberByteOfSector / sizeof(ufs_ItemInfo_Type);
+    uint16_t itemsPerSector = UFS_SECTOR_SIZE(ufs) / sizeof(ufs_ItemInfo_Type);
+    uint16_t slot = ufs_IndexFreeSlot(ufs);
 
-    // Iterate through each sector to locate a free slot
-    for (uint16_t sector = 0; sector < totalSectors; sector++)
+    if (slot == 0xFFFF)
     {
-        // Read data from the current sector
-        ufs->conf->api->ReadSector(ufs->ItemZoneFirstSector + sector, data_sector, ufs->conf->api->u16numberByteOfSector);
-
-        // Decode Header
-        for(uint16_t countByte = 0; countByte < ufs->conf->api->u16numberByteOfSector; countByte ++)
-        {
-        	if(data_sector[countByte] != 0x00)
-        	{
-        		data_sector[countByte] ^= BYTE_CODEC_DEFAULT;
-        	}
-        }
-
-        // Traverse each segment within the sector to find an available slot
-        for (uint16_t segment = 0; segment < itemsPerSector; segment++)
-        {
-            uint8_t itemStatus = data_sector[segment * sizeof(ufs_ItemInfo_Type)];
-
-            // Check if the current item slot is free
-            if (itemStatus == UFS_ITEM_FREE)
-            {
-                // Save the available slot's location in `slotID`
-                slotID->sector_id = sector;
-                slotID->position = segment;
-
-                return UFS_OK;
-            }
-        }
+        return UFS_NOT_OK; // No available slot found
     }
 
-    return UFS_NOT_OK; // No available slot found
+    // Save the available slot's location in `slotID`
+    slotID->sector_id = slot / itemsPerSector;
+    slotID->position = slot % itemsPerSector;
+
+    return UFS_OK;
 }
 
 /**
@@ -2267,7 +5553,7 @@ ufs_ReturnType ufs_Mount(UFS *ufs, const uint8_t *path)
         }
 
         // Update the current path ID in UFS to navigate through subdirectories
-        ufs->path.id = (item.location.sector_id * (ufs->conf->api->u16numberByteOfSector / sizeof(ufs_ItemInfo_Type))) + item.location.position;
+        ufs->path.id = (item.location.sector_id * (UFS_SECTOR_SIZE(ufs) / sizeof(ufs_ItemInfo_Type))) + item.location.position;
 
         // Move to the next directory in the path
         current = current->next;
@@ -2285,6 +5571,48 @@ ufs_ReturnType ufs_Mount(UFS *ufs, const uint8_t *path)
     return UFS_OK;
 }
 
+/**
+ * @brief   Takes the exclusive lock of every file of a folder subtree, or of none.
+ *
+ * Called with the mutex held. The locks are only tried: when one is busy the
+ * locks already taken are released, so the mutex is never held while waiting
+ * for a file lock.
+ *
+ * @param[in]   ufs      Pointer to the UFS structure.
+ * @param[in]   inside   State of each slot, 1 for the items of the subtree.
+ *
+ * @return      uint8_t  1 when every file of the subtree is locked, 0 when one is busy.
+ */
+static uint8_t ufs_SubtreeLock(UFS *ufs, const uint8_t *inside)
+{
+    ufs_ItemIndex_Type *index = &ufs->ItemIndex;
+
+    for (uint16_t slot = 1; slot < index->numberSlot; slot++)
+    {
+        if (inside[slot] != 1 || index->info[slot].data[0] == UFS_ITEM_FREE ||
+            index->info[slot].comp.name.extention[0] == 0x00)
+        {
+            continue;
+        }
+
+        if (index->lock[slot] != 0)
+        {
+            // Release the files locked so far, they all come before this one
+            for (uint16_t countItem = 1; countItem < slot; countItem++)
+            {
+                if (inside[countItem] == 1 && index->info[countItem].data[0] != UFS_ITEM_FREE &&
+                    index->info[countItem].comp.name.extention[0] != 0x00)
+                {
+                    index->lock[countItem] = 0;
+                }
+            }
+            return 0;
+        }
+        index->lock[slot] = -1;
+    }
+    return 1;
+}
+
 /**
  * @brief Deletes a folder and all its contents, including the folder itself.
  *
@@ -2311,120 +5639,165 @@ ufs_ReturnType ufs_Mount(UFS *ufs, const uint8_t *path)
  * @brief Recursively deletes a folder and all its contents.
  *
  * This function deletes the target directory and all sub-items, including subfolders and files.
- * After all contents are deleted, the directory itself is also removed.
+ * The whole subtree is collected in one pass over the in-RAM item index, every item of it is
+ * marked deleted, the chains of its files are queued for the reclaimer and the touched item
+ * sectors are written once. The directory itself is removed too, unless it is the root.
+ * Nothing is deleted while a stream is open on a file of the subtree.
  *
  * @param[in] ufs         Pointer to the UFS object.
  * @param[in] directory   Path of the directory to delete.
  *
- * @return ufs_ReturnType UFS_OK if deletion is successful, UFS_NOT_OK if deletion fails.
+ * @return ufs_ReturnType UFS_OK if deletion is successful, UFS_BUSY if a stream is open on a
+ *                        file of the folder, UFS_NOT_OK if deletion fails.
  */
 ufs_ReturnType ufs_DeleteFolder(UFS *ufs, uint8_t *directory)
 {
-    ufs_Item_Type item;
+    ufs_ItemIndex_Type *index = &ufs->ItemIndex;
+    uint16_t itemsPerSector = UFS_SECTOR_SIZE(ufs) / sizeof(ufs_ItemInfo_Type);
     ufs_ReturnType result;
+    uint8_t *inside;
 
-    /* Backup the current path information */
-    ufs_Path_Type path_backup = ufs->path;
-
-    // Lock mutex for thread safety
-    if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
-    {
-        ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
-    }
-
-    /* Normalize the directory path to ensure it's valid */
-    uint8_t full_path[MAX_PATH_LENGTH];
-    snprintf((char *)full_path, sizeof(full_path), "%s/%s", ufs->path.name, directory);
-    ufs_NormalizePath(full_path);
-
-    /* Mount to the target directory */
-    result = ufs_Mount(ufs, full_path);
-    if (result != UFS_OK)
+    /* Collect the subtree and lock its files, again from the start while one of them is busy */
+    while (1)
     {
-        // Unlock the mutex after the file operation
-        if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+        // Lock mutex for thread safety
+        if (ufs->conf->api->LockMutex && ufs->conf->api->mutex)
         {
-            ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);
+            ufs->conf->api->LockMutex((void *)ufs->conf->api->mutex);  // Lock the mutex
         }
-        /* Return error if mounting fails */
-        return UFS_NOT_OK;
-    }
 
-    /* Count the number of items in the directory */
-    uint16_t item_count = ufs_CountItem(ufs);
-    if (item_count > 0)
-    {
-        /* Allocate memory to store the list of directory items */
-        ufs_ItemInfo_Type *items_info = malloc(item_count * sizeof(ufs_ItemInfo_Type));
-        if (items_info == NULL)
-        {
-            /* Restore the original path before returning */
-            ufs->path = path_backup;
+        /* Backup the current path information */
+        ufs_Path_Type path_backup = ufs->path;
+
+        /* Normalize the directory path to ensure it's valid */
+        uint8_t full_path[MAX_PATH_LENGTH];
+        snprintf((char *)full_path, sizeof(full_path), "%s/%s", ufs->path.name, directory);
+        ufs_NormalizePath(full_path);
+
+        /* Mount to the target directory to find its path id, then restore the original path */
+        result = ufs_Mount(ufs, full_path);
+        uint16_t folder = ufs->path.id;
+        ufs->path = path_backup;
 
+        /* State of each slot: 0 not visited yet, 1 inside the folder, 2 outside */
+        inside = (result == UFS_OK) ? (uint8_t *)calloc(index->numberSlot, sizeof(uint8_t)) : NULL;
+        if (inside == NULL)
+        {
             // Unlock the mutex after the file operation
             if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
             {
                 ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);
             }
+            /* Return error if mounting fails */
             return UFS_NOT_OK;
         }
+        inside[folder] = 1;
+        if (folder != 0)
+        {
+            inside[0] = 2;
+        }
 
-        /* Retrieve the list of items in the directory */
-        ufs_GetListItem(ufs, items_info, item_count);
-
-        /* Recursively delete each item */
-        for (uint16_t i = 0; i < item_count; i++)
+        /* Collect the subtree in one pass, each item climbs its parents until a known one */
+        for (uint16_t slot = 1; slot < index->numberSlot; slot++)
         {
-            /* Check if the item is a subdirectory (no extension) */
-            if (items_info[i].comp.name.extention[0] == 0x00)
+            uint16_t parent = slot;
+            for (uint16_t depth = 0; inside[parent] == 0 && depth < index->numberSlot; depth++)
             {
-                /* Recursively delete the subdirectory */
-                result = ufs_DeleteFolder(ufs, items_info[i].comp.name.head);
-                if (result != UFS_OK)
+                if (index->info[parent].data[0] == UFS_ITEM_FREE || index->info[parent].comp.parent >= index->numberSlot)
                 {
-                    /* Free allocated memory and restore path on error */
-                    free(items_info);
-                    ufs->path = path_backup;
-
-                    // Unlock the mutex after the file operation
-                    if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
-                    {
-                        ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);
-                    }
-                    return UFS_NOT_OK;
+                    break;  // Detached item, it is outside the folder
                 }
+                parent = index->info[parent].comp.parent;
             }
-            else /* Item is a file */
+
+            /* Record the state along the climbed path, so every item is climbed once */
+            uint8_t state = (inside[parent] == 1) ? 1 : 2;
+            for (uint16_t countItem = slot; inside[countItem] == 0; countItem = index->info[countItem].comp.parent)
+            {
+                inside[countItem] = state;
+                if (index->info[countItem].data[0] == UFS_ITEM_FREE || index->info[countItem].comp.parent >= index->numberSlot)
+                {
+                    break;
+                }
+            }
+        }
+
+        /* A stream would program and commit clusters of a deleted file, the folder is kept whole */
+        for (ufs_Stream_Type *stream = ufs->Streams; stream != NULL; stream = stream->next)
+        {
+            if (inside[ufs_ItemSlot(stream->file)] == 1)
             {
-                /* Build the file name with extension */
-                uint8_t file_name[MAX_NAME_LENGTH + 4];
-                snprintf((char *)file_name, sizeof(file_name), "%s.%s", items_info[i].comp.name.head, items_info[i].comp.name.extention);
-                file_name[items_info[i].comp.name.length + 4] = '\0';
+                free(inside);
 
-                /* Open and delete the file */
-                result = ufs_CheckExistence(ufs, file_name, &item);
-                if (result == UFS_OK)
+                // Unlock the mutex after the file operation
+                if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
                 {
-                    ufs_DeleteItem(&item);
+                    ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);
                 }
+                return UFS_BUSY;
             }
         }
-        /* Free allocated memory after processing items */
-        free(items_info);
-    }
 
-    /* Restore the original path after deletion */
-    ufs->path = path_backup;
-    uint8_t dir_clean[MAX_NAME_LENGTH];
-    ufs_GetCleanDirectoryName((const uint8_t *)directory, dir_clean, MAX_NAME_LENGTH);
+        /* Readers and writers of the files finish first, the mutex is not held while waiting for them */
+        if (ufs_SubtreeLock(ufs, inside))
+        {
+            break;
+        }
+        free(inside);
+
+        // Unlock the mutex after the file operation
+        if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
+        {
+            ufs->conf->api->UnlockMutex((void *)ufs->conf->api->mutex);
+        }
 
-    /* Delete the target directory itself */
-    result = ufs_CheckExistence(ufs, dir_clean, &item);
-    if (result == UFS_OK)
+        // Let the holder finish
+        if (ufs->conf->api->Yield)
+        {
+            ufs->conf->api->Yield();
+        }
+    }
+
+    /* Delete every item of the subtree, and the folder itself unless it is the root */
+    for (uint16_t slot = 1; slot < index->numberSlot; slot++)
     {
-        ufs_DeleteItem(&item);
+        ufs_ItemInfo_Type info = index->info[slot];
+
+        if (inside[slot] != 1 || info.data[0] == UFS_ITEM_FREE)
+        {
+            continue;
+        }
+
+        uint8_t isFile = (info.comp.name.extention[0] != 0x00);
+        uint16_t first_cluster = info.comp.first_cluster;
+
+        /* Handles of the open-file table on a deleted item are released */
+        ufs_HandleRelease(ufs, slot, NULL);
+        if (isFile)
+        {
+            ufs_RecentForget(ufs, slot);
+        }
+
+        /* Mark the item deleted, its sector is written once below, and drop the lock taken above */
+        index->lock[slot] = 0;
+        memset(info.data, 0x00, sizeof(ufs_ItemInfo_Type));
+        info.comp.first_cluster = 0xFFFF;
+        ufs_IndexUpdate(ufs, slot, &info);
+        index->dirty[slot / itemsPerSector] = 1;
+
+        /* Queue the chain of a file, a folder owns no cluster */
+        if (isFile)
+        {
+            ufs_ReclaimPush(ufs, first_cluster);
+        }
     }
 
+    /* Commit the deleted items, the chains are released by the reclaimer */
+    ufs_MapCacheFlush(ufs);
+    ufs_ItemFlush(ufs);
+
+    free(inside);
+
     // Unlock the mutex after the file operation
     if (ufs->conf->api->UnlockMutex && ufs->conf->api->mutex)
     {
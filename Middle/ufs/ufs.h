@@ -38,8 +38,9 @@ ufs_ReturnType ufs_FastFormat(UFS *ufs);
  * @brief Opens a file in the UFS system.
  *
  * This function opens a file in the UFS by searching for the file name in the item zone.
- * If the file exists, it retrieves the necessary metadata and cluster information.
- * If the file doesn't exist, it creates a new entry if there's available space.
+ * If the file exists, it retrieves the necessary metadata, its cluster chain is only
+ * resolved by the first read or write. If the file doesn't exist, it creates a new
+ * entry if there's available space.
  *
  * @param[in]  ufs        Pointer to the UFS structure.
  * @param[in]  name_file  Pointer to the file name string.
@@ -52,13 +53,16 @@ __fast ufs_ReturnType ufs_OpenItem(UFS *ufs, uint8_t *name_file, ufs_Item_Type *
 /**
  * @brief Deletes a file from the UFS system.
  *
- * This function removes a file from the UFS by cleaning the cluster list and
- * marking the file as free in the item zone. All associated data is erased
- * from the file system.
+ * This function marks the item as free in the item index and queues the
+ * cluster chain of a file for the reclaimer, so it returns without touching
+ * the cluster map. The chain is released by ufs_Reclaim(), ufs_Sync(), or
+ * when an allocation runs short of free clusters. A file with an open stream
+ * is not deleted until ufs_StreamClose(), the item and its handle are left
+ * as they are.
  *
  * @param[in]  item  Pointer to the UFS item structure that describes the file to be deleted.
  *
- * @return ufs_ReturnType UFS_OK on success, UFS_NOT_OK on failure.
+ * @return ufs_ReturnType UFS_OK on success, UFS_BUSY if a stream is open on the file, UFS_NOT_OK on failure.
  */
 ufs_ReturnType ufs_DeleteItem(ufs_Item_Type *item);
 
@@ -67,7 +71,8 @@ ufs_ReturnType ufs_DeleteItem(ufs_Item_Type *item);
  *
  * This function releases the resources associated with a UFS item, including
  * freeing the allocated memory for its cluster list and resetting its metadata
- * fields. It ensures that the item is no longer used after closing.
+ * fields. It ensures that the item is no longer used after closing. Pending
+ * data and metadata are written back with ufs_Sync() before it returns.
  *
  * @param[in]   item    Pointer to the UFS item structure to be closed.
  *
@@ -75,6 +80,120 @@ ufs_ReturnType ufs_DeleteItem(ufs_Item_Type *item);
  */
 ufs_ReturnType ufs_CloseItem(ufs_Item_Type *item);
 
+/**
+ * @brief   Opens a file through the open-file table.
+ *
+ * Returns the handle already holding the file, or opens it in a free handle
+ * with ufs_OpenItem(). The cluster extents of a recently closed file are
+ * reused, so reopening it costs no flash read. Handles must be closed with
+ * ufs_FileClose().
+ *
+ * @param[in]   ufs         Pointer to the UFS structure.
+ * @param[in]   name_file   Pointer to the file name string.
+ *
+ * @return      ufs_Item_Type*  Handle of the file, or NULL on failure.
+ */
+ufs_Item_Type *ufs_FileOpen(UFS *ufs, uint8_t *name_file);
+
+/**
+ * @brief   Closes a handle of the open-file table.
+ *
+ * The handle is released by its last holder and the file is kept among the
+ * UFS_RECENT_FILES most recently closed files.
+ *
+ * @param[in]   file    Handle returned by ufs_FileOpen().
+ *
+ * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK if the handle is not open.
+ */
+ufs_ReturnType ufs_FileClose(ufs_Item_Type *file);
+
+/**
+ * @brief   Reads from a handle at its cursor and moves the cursor past the data read.
+ *
+ * @param[in]   file    Handle returned by ufs_FileOpen().
+ * @param[out]  data    Pointer to the buffer where the read data will be stored.
+ * @param[in]   length  The number of bytes to read.
+ *
+ * @return      uint32_t  The number of bytes read.
+ */
+uint32_t ufs_FileRead(ufs_Item_Type *file, uint8_t *data, uint32_t length);
+
+/**
+ * @brief   Moves the cursor of a handle.
+ *
+ * @param[in]   file        Handle returned by ufs_FileOpen().
+ * @param[in]   position    New cursor position, at most the size of the file.
+ *
+ * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK on failure.
+ */
+ufs_ReturnType ufs_FileSeek(ufs_Item_Type *file, uint32_t position);
+
+/**
+ * @brief   Writes all cached UFS metadata back to the device.
+ *
+ * Cluster map updates are kept in a RAM cache and only written back when a
+ * cached sector is evicted, or on ufs_CloseItem(), ufs_Sync() and ufs_Unmount().
+ * The sectors held in RAM by open streams are programmed and the chains queued
+ * by deletes are released first.
+ *
+ * @param[in]   ufs     Pointer to the UFS structure.
+ *
+ * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK if the UFS is invalid.
+ */
+ufs_ReturnType ufs_Sync(UFS *ufs);
+
+/**
+ * @brief   Programs sectors left in RAM by open streams.
+ *
+ * With UFS_WRITE_BEHIND_SECTORS set, ufs_StreamFeed() only copies data into
+ * RAM. Call this from a storage task or while the device is idle to program
+ * the full sectors in the background.
+ *
+ * @param[in]   ufs      Pointer to the UFS structure.
+ * @param[in]   budget   Maximum number of sectors to program, 0 programs all of them.
+ *
+ * @return      uint16_t  Number of sectors programmed.
+ */
+uint16_t ufs_Drain(UFS *ufs, uint16_t budget);
+
+/**
+ * @brief   Erases free clusters ahead of time.
+ *
+ * Call it from a low priority task or while the device is idle. Clusters it
+ * erased are marked clean and taken first by the allocator, so writes that
+ * land in them only program the flash.
+ *
+ * @param[in]   ufs      Pointer to the UFS structure.
+ * @param[in]   budget   Maximum number of runs to erase in this call.
+ *
+ * @return      uint16_t  Number of erase operations issued, 0 when every free cluster is already erased.
+ */
+uint16_t ufs_PreErase(UFS *ufs, uint16_t budget);
+
+/**
+ * @brief   Releases the cluster chains of deleted files.
+ *
+ * Deletes only queue the chains of the deleted files. Call this from a low
+ * priority task or while the device is idle to release them in one batch.
+ *
+ * @param[in]   ufs   Pointer to the UFS structure.
+ *
+ * @return      uint32_t  Number of clusters released.
+ */
+uint32_t ufs_Reclaim(UFS *ufs);
+
+/**
+ * @brief   Flushes and releases a UFS instance.
+ *
+ * This function writes all cached metadata back to the device and frees the
+ * memory allocated by newUFS(). The instance must not be used afterwards.
+ *
+ * @param[in]   ufs     Pointer to the UFS structure.
+ *
+ * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK if the UFS is invalid.
+ */
+ufs_ReturnType ufs_Unmount(UFS *ufs);
+
 /**
  * @brief   Counts the number of items in the UFS file system.
  *
@@ -117,10 +236,10 @@ ufs_ReturnType ufs_CheckExistence(UFS *ufs, uint8_t *name, ufs_Item_Type *item);
 uint16_t ufs_GetListItem(UFS *ufs, ufs_ItemInfo_Type *item_info, uint16_t length);
 
 /**
- * @brief   Calculates the total used space in the UFS file system.
+ * @brief   Retrieves the space used by allocated clusters.
  *
- * This function calculates the total space occupied by used items (files) in the
- * UFS file system, by summing the size of each used item.
+ * The value is maintained on every cluster allocation and release, so this
+ * call does not touch the device.
  *
  * @param[in]   ufs     Pointer to the UFS structure.
  *
@@ -128,6 +247,15 @@ uint16_t ufs_GetListItem(UFS *ufs, ufs_ItemInfo_Type *item_info, uint16_t length
  */
 uint32_t ufs_GetUsedSize(UFS *ufs);
 
+/**
+ * @brief   Retrieves the space still available for file data.
+ *
+ * @param[in]   ufs     Pointer to the UFS structure.
+ *
+ * @return      uint32_t  The free size in bytes.
+ */
+uint32_t ufs_GetFreeSize(UFS *ufs);
+
 /**
  * @brief   Retrieves the total device size of the UFS file system.
  *
@@ -144,7 +272,8 @@ uint32_t ufs_GetDeviceSize(UFS *ufs);
  * @brief   Reads data from a file in the UFS file system.
  *
  * This function reads data from the specified file starting from a given position
- * and copies the requested number of bytes into the provided data buffer.
+ * and copies the requested number of bytes into the provided data buffer. The read
+ * stops at the end of the file.
  *
  * @param[in]   file      Pointer to the UFS file structure.
  * @param[in]   position  The position within the file to start reading.
@@ -162,9 +291,10 @@ __fast uint32_t ufs_ReadFile(ufs_Item_Type *file, uint32_t position, uint8_t *da
  * have enough space, new clusters will be allocated as needed. The data is written
  * starting from the current file position.
  *
- * @param[in]   file     Pointer to the UFS file structure.
- * @param[in]   data     Pointer to the data buffer to be written.
- * @param[in]   length   The number of bytes to write to the file.
+ * @param[in]   file        Pointer to the UFS file structure.
+ * @param[in]   data        Pointer to the data buffer to be written.
+ * @param[in]   length      The number of bytes to write to the file.
+ * @param[in]   sumEnable   Verifies the programmed data as selected by UFS_WRITE_VERIFY (CHECKSUM_ENABLE/CHECKSUM_DISABLE).
  *
  * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK on failure.
  */
@@ -177,14 +307,118 @@ __fast ufs_ReturnType ufs_WriteFile(ufs_Item_Type *file, uint8_t *data, uint32_t
  * does not have enough space, new clusters will be allocated as needed. The data
  * is appended starting from the file's end position.
  *
- * @param[in]   file     Pointer to the UFS file structure.
- * @param[in]   data     Pointer to the data buffer to be appended.
- * @param[in]   length   The number of bytes to append to the file.
+ * @param[in]   file        Pointer to the UFS file structure.
+ * @param[in]   data        Pointer to the data buffer to be appended.
+ * @param[in]   length      The number of bytes to append to the file.
+ * @param[in]   sumEnable   Verifies the programmed data as selected by UFS_WRITE_VERIFY (CHECKSUM_ENABLE/CHECKSUM_DISABLE).
  *
  * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK on failure.
  */
 __fast ufs_ReturnType ufs_WriteAppendFile(ufs_Item_Type *file, uint8_t *data, uint32_t length, ufs_CheckSumStatus sumEnable);
 
+/**
+ * @brief   Writes data at a position of a file in the UFS file system.
+ *
+ * Only the sectors holding the new bytes are read and programmed. Bytes that
+ * can be programmed over the old ones are written in place, a cluster that
+ * would need an erase is copied to a free cluster with the new bytes and the
+ * rest of the chain is kept. Bytes past the end of the file are appended.
+ *
+ * @param[in]   file        Pointer to the UFS file structure.
+ * @param[in]   position    File position of the first byte to write, at most the size of the file.
+ * @param[in]   data        Pointer to the data buffer to be written.
+ * @param[in]   length      The number of bytes to write.
+ * @param[in]   sumEnable   Verifies the programmed data unless UFS_WRITE_VERIFY is UFS_VERIFY_NONE (CHECKSUM_ENABLE/CHECKSUM_DISABLE).
+ *
+ * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK on failure.
+ */
+__fast ufs_ReturnType ufs_WriteAt(ufs_Item_Type *file, uint32_t position, uint8_t *data, uint32_t length, ufs_CheckSumStatus sumEnable);
+
+/**
+ * @brief   Returns the CRC32 of the content of a file.
+ *
+ * The CRC (as zlib, over the data before encoding) is kept up to date as the
+ * file is written and stored with the item, so it is returned without reading
+ * the file. A file written by an older version is read once to compute it.
+ *
+ * @param[in]   file   Pointer to the UFS file structure.
+ * @param[out]  crc    CRC32 of the file content.
+ *
+ * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK on failure.
+ */
+ufs_ReturnType ufs_GetFileCrc(ufs_Item_Type *file, uint32_t *crc);
+
+/**
+ * @brief   Starts streaming new content into an open file.
+ *
+ * The previous content of the file is kept until ufs_StreamClose() commits
+ * the new one. Data fed to the stream is staged in a ring of
+ * UFS_WRITE_BEHIND_SECTORS sectors and programmed sector by sector into
+ * clusters allocated ahead.
+ *
+ * @param[out]  stream      Pointer to the stream structure.
+ * @param[in]   file        Pointer to an open file.
+ * @param[in]   sumEnable   Verifies the programmed sectors as selected by UFS_WRITE_VERIFY.
+ *
+ * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK on failure.
+ */
+ufs_ReturnType ufs_StreamOpen(ufs_Stream_Type *stream, ufs_Item_Type *file, ufs_CheckSumStatus sumEnable);
+
+/**
+ * @brief   Feeds data to a stream.
+ *
+ * Full sectors wait in RAM for ufs_Drain(), the call only programs the flash
+ * when the ring is full. A failure of a drained sector is reported by the
+ * next call.
+ *
+ * @param[in]   stream   Pointer to an open stream.
+ * @param[in]   data     Pointer to the data buffer.
+ * @param[in]   length   Number of bytes to write.
+ *
+ * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK on failure.
+ */
+ufs_ReturnType ufs_StreamFeed(ufs_Stream_Type *stream, uint8_t *data, uint32_t length);
+
+/**
+ * @brief   Finishes a stream and commits the new file content.
+ *
+ * The sectors left in RAM are programmed, unused clusters are released and
+ * the file size and first cluster are written once. On failure the previous content of
+ * the file is kept.
+ *
+ * @param[in]   stream   Pointer to an open stream.
+ *
+ * @return      ufs_ReturnType  UFS_OK on success, UFS_NOT_OK on failure.
+ */
+ufs_ReturnType ufs_StreamClose(ufs_Stream_Type *stream);
+
+/**
+ * @brief   Queues a read, write, append, open or delete request.
+ *
+ * The request is run later by the task calling ufs_Serve(), which clears its
+ * `pending` flag and calls its completion callback, e.g. to notify the
+ * submitting task. Requests of a higher priority are served first.
+ *
+ * @param[in]   ufs       Pointer to the UFS structure.
+ * @param[in]   request   Pointer to the request, owned by UFS until it completes.
+ *
+ * @return      ufs_ReturnType  UFS_OK when the request is queued, UFS_NOT_OK if it is invalid or already pending.
+ */
+ufs_ReturnType ufs_Submit(UFS *ufs, ufs_Request_Type *request);
+
+/**
+ * @brief   Serves queued requests, from the storage task.
+ *
+ * Reads and writes are served UFS_REQUEST_SLICE_BYTES at a time, so a small
+ * request of a higher priority overtakes a bulk transfer already started.
+ *
+ * @param[in]   ufs      Pointer to the UFS structure.
+ * @param[in]   budget   Maximum number of steps to run, 0 runs until the queue is empty.
+ *
+ * @return      uint16_t  Number of steps run.
+ */
+uint16_t ufs_Serve(UFS *ufs, uint16_t budget);
+
 /**
  * @brief   Renames an item in the UFS (Universal File System).
  *
@@ -217,13 +451,17 @@ ufs_ReturnType ufs_Mount(UFS *ufs, const uint8_t *path);
 /**
  * @brief Deletes a folder and all its contents recursively.
  *
- * This function mounts to the specified folder path and recursively deletes
- * all items within, including subfolders and files.
+ * This function resolves the specified folder path and deletes all items
+ * within, including subfolders and files. The subtree is collected in one
+ * pass over the in-RAM item index and the chains of its files are queued for
+ * the reclaimer. Nothing is deleted while a stream is open on a file of the
+ * folder.
  *
  * @param[in] ufs         Pointer to the UFS instance.
  * @param[in] directory   Path of the folder to delete.
  *
- * @return ufs_ReturnType UFS_OK if deletion is successful, UFS_NOT_OK otherwise.
+ * @return ufs_ReturnType UFS_OK if deletion is successful, UFS_BUSY if a stream is open on
+ *                        a file of the folder, UFS_NOT_OK otherwise.
  */
 ufs_ReturnType ufs_DeleteFolder(UFS *ufs, uint8_t *directory);
 
@@ -0,0 +1,610 @@
+#include "ufs_kernel.h"
+#include <string.h>
+#if UFS_KERNEL_BENCH == UFS_OK
+#include <stdlib.h>
+#endif
+
+// Select the implementation, the SIMD kernels need the DSP extension of the core
+#if UFS_KERNEL == UFS_KERNEL_SIMD && defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#include "cmsis_compiler.h"
+#define UFS_KERNEL_USED     UFS_KERNEL_SIMD
+#elif UFS_KERNEL == UFS_KERNEL_REFERENCE
+#define UFS_KERNEL_USED     UFS_KERNEL_REFERENCE
+#else
+#define UFS_KERNEL_USED     UFS_KERNEL_WORD
+#endif
+
+#define UFS_WORD_BYTES      4u
+#define UFS_WORD_SPLAT(b)   ((uint32_t)(b) * 0x01010101u)   // Repeat a byte in every lane of a word
+
+// CRC-32 (IEEE 802.3, reflected, polynomial 0xEDB88320) of every byte value
+static const uint32_t UFS_CRC32_TABLE[256] =
+{
+    0x00000000u, 0x77073096u, 0xEE0E612Cu, 0x990951BAu, 0x076DC419u, 0x706AF48Fu,
+    0xE963A535u, 0x9E6495A3u, 0x0EDB8832u, 0x79DCB8A4u, 0xE0D5E91Eu, 0x97D2D988u,
+    0x09B64C2Bu, 0x7EB17CBDu, 0xE7B82D07u, 0x90BF1D91u, 0x1DB71064u, 0x6AB020F2u,
+    0xF3B97148u, 0x84BE41DEu, 0x1ADAD47Du, 0x6DDDE4EBu, 0xF4D4B551u, 0x83D385C7u,
+    0x136C9856u, 0x646BA8C0u, 0xFD62F97Au, 0x8A65C9ECu, 0x14015C4Fu, 0x63066CD9u,
+    0xFA0F3D63u, 0x8D080DF5u, 0x3B6E20C8u, 0x4C69105Eu, 0xD56041E4u, 0xA2677172u,
+    0x3C03E4D1u, 0x4B04D447u, 0xD20D85FDu, 0xA50AB56Bu, 0x35B5A8FAu, 0x42B2986Cu,
+    0xDBBBC9D6u, 0xACBCF940u, 0x32D86CE3u, 0x45DF5C75u, 0xDCD60DCFu, 0xABD13D59u,
+    0x26D930ACu, 0x51DE003Au, 0xC8D75180u, 0xBFD06116u, 0x21B4F4B5u, 0x56B3C423u,
+    0xCFBA9599u, 0xB8BDA50Fu, 0x2802B89Eu, 0x5F058808u, 0xC60CD9B2u, 0xB10BE924u,
+    0x2F6F7C87u, 0x58684C11u, 0xC1611DABu, 0xB6662D3Du, 0x76DC4190u, 0x01DB7106u,
+    0x98D220BCu, 0xEFD5102Au, 0x71B18589u, 0x06B6B51Fu, 0x9FBFE4A5u, 0xE8B8D433u,
+    0x7807C9A2u, 0x0F00F934u, 0x9609A88Eu, 0xE10E9818u, 0x7F6A0DBBu, 0x086D3D2Du,
+    0x91646C97u, 0xE6635C01u, 0x6B6B51F4u, 0x1C6C6162u, 0x856530D8u, 0xF262004Eu,
+    0x6C0695EDu, 0x1B01A57Bu, 0x8208F4C1u, 0xF50FC457u, 0x65B0D9C6u, 0x12B7E950u,
+    0x8BBEB8EAu, 0xFCB9887Cu, 0x62DD1DDFu, 0x15DA2D49u, 0x8CD37CF3u, 0xFBD44C65u,
+    0x4DB26158u, 0x3AB551CEu, 0xA3BC0074u, 0xD4BB30E2u, 0x4ADFA541u, 0x3DD895D7u,
+    0xA4D1C46Du, 0xD3D6F4FBu, 0x4369E96Au, 0x346ED9FCu, 0xAD678846u, 0xDA60B8D0u,
+    0x44042D73u, 0x33031DE5u, 0xAA0A4C5Fu, 0xDD0D7CC9u, 0x5005713Cu, 0x270241AAu,
+    0xBE0B1010u, 0xC90C2086u, 0x5768B525u, 0x206F85B3u, 0xB966D409u, 0xCE61E49Fu,
+    0x5EDEF90Eu, 0x29D9C998u, 0xB0D09822u, 0xC7D7A8B4u, 0x59B33D17u, 0x2EB40D81u,
+    0xB7BD5C3Bu, 0xC0BA6CADu, 0xEDB88320u, 0x9ABFB3B6u, 0x03B6E20Cu, 0x74B1D29Au,
+    0xEAD54739u, 0x9DD277AFu, 0x04DB2615u, 0x73DC1683u, 0xE3630B12u, 0x94643B84u,
+    0x0D6D6A3Eu, 0x7A6A5AA8u, 0xE40ECF0Bu, 0x9309FF9Du, 0x0A00AE27u, 0x7D079EB1u,
+    0xF00F9344u, 0x8708A3D2u, 0x1E01F268u, 0x6906C2FEu, 0xF762575Du, 0x806567CBu,
+    0x196C3671u, 0x6E6B06E7u, 0xFED41B76u, 0x89D32BE0u, 0x10DA7A5Au, 0x67DD4ACCu,
+    0xF9B9DF6Fu, 0x8EBEEFF9u, 0x17B7BE43u, 0x60B08ED5u, 0xD6D6A3E8u, 0xA1D1937Eu,
+    0x38D8C2C4u, 0x4FDFF252u, 0xD1BB67F1u, 0xA6BC5767u, 0x3FB506DDu, 0x48B2364Bu,
+    0xD80D2BDAu, 0xAF0A1B4Cu, 0x36034AF6u, 0x41047A60u, 0xDF60EFC3u, 0xA867DF55u,
+    0x316E8EEFu, 0x4669BE79u, 0xCB61B38Cu, 0xBC66831Au, 0x256FD2A0u, 0x5268E236u,
+    0xCC0C7795u, 0xBB0B4703u, 0x220216B9u, 0x5505262Fu, 0xC5BA3BBEu, 0xB2BD0B28u,
+    0x2BB45A92u, 0x5CB36A04u, 0xC2D7FFA7u, 0xB5D0CF31u, 0x2CD99E8Bu, 0x5BDEAE1Du,
+    0x9B64C2B0u, 0xEC63F226u, 0x756AA39Cu, 0x026D930Au, 0x9C0906A9u, 0xEB0E363Fu,
+    0x72076785u, 0x05005713u, 0x95BF4A82u, 0xE2B87A14u, 0x7BB12BAEu, 0x0CB61B38u,
+    0x92D28E9Bu, 0xE5D5BE0Du, 0x7CDCEFB7u, 0x0BDBDF21u, 0x86D3D2D4u, 0xF1D4E242u,
+    0x68DDB3F8u, 0x1FDA836Eu, 0x81BE16CDu, 0xF6B9265Bu, 0x6FB077E1u, 0x18B74777u,
+    0x88085AE6u, 0xFF0F6A70u, 0x66063BCAu, 0x11010B5Cu, 0x8F659EFFu, 0xF862AE69u,
+    0x616BFFD3u, 0x166CCF45u, 0xA00AE278u, 0xD70DD2EEu, 0x4E048354u, 0x3903B3C2u,
+    0xA7672661u, 0xD06016F7u, 0x4969474Du, 0x3E6E77DBu, 0xAED16A4Au, 0xD9D65ADCu,
+    0x40DF0B66u, 0x37D83BF0u, 0xA9BCAE53u, 0xDEBB9EC5u, 0x47B2CF7Fu, 0x30B5FFE9u,
+    0xBDBDF21Cu, 0xCABAC28Au, 0x53B39330u, 0x24B4A3A6u, 0xBAD03605u, 0xCDD70693u,
+    0x54DE5729u, 0x23D967BFu, 0xB3667A2Eu, 0xC4614AB8u, 0x5D681B02u, 0x2A6F2B94u,
+    0xB40BBE37u, 0xC30C8EA1u, 0x5A05DF1Bu, 0x2D02EF8Du
+};
+
+#if UFS_KERNEL_USED != UFS_KERNEL_REFERENCE
+
+// Buffers come from callers and are not word aligned, the Cortex-M4 loads and stores words at any address
+#if defined(__GNUC__)
+typedef struct __attribute__((packed, may_alias))
+{
+    uint32_t v;
+} ufs_Word_Type;
+
+static inline uint32_t ufs_WordLoad(const uint8_t *p)
+{
+    return ((const ufs_Word_Type *)(const void *)p)->v;
+}
+
+static inline void ufs_WordStore(uint8_t *p, uint32_t value)
+{
+    ((ufs_Word_Type *)(void *)p)->v = value;
+}
+#else
+static inline uint32_t ufs_WordLoad(const uint8_t *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline void ufs_WordStore(uint8_t *p, uint32_t value)
+{
+    memcpy(p, &value, sizeof(value));
+}
+#endif
+
+#endif
+
+/**
+ * @brief   Sums a byte array modulo 256.
+ *
+ * The SIMD kernel adds the four bytes of a word with one USADA8. The word kernel
+ * adds the even and the odd bytes of a word into two 16-bit lanes, which are
+ * folded before they can overflow.
+ *
+ * @param[in]   data    Pointer to the byte array.
+ * @param[in]   length  Number of bytes to sum.
+ *
+ * @return      uint8_t  Sum of the bytes, modulo 256.
+ */
+uint8_t ufs_KernelSum(const uint8_t *data, uint32_t length)
+{
+    uint32_t sum = 0;
+    uint32_t countByte = 0;
+
+#if UFS_KERNEL_USED == UFS_KERNEL_SIMD
+    for (; countByte + UFS_WORD_BYTES <= length; countByte += UFS_WORD_BYTES)
+    {
+        sum = __USADA8(ufs_WordLoad(&data[countByte]), 0, sum);
+    }
+#elif UFS_KERNEL_USED == UFS_KERNEL_WORD
+    while (countByte + UFS_WORD_BYTES <= length)
+    {
+        // A lane takes at most 2 * 255 per word, 128 words stay below 65536
+        uint32_t lanes = 0;
+        for (uint8_t countWord = 0; countWord < 128 && countByte + UFS_WORD_BYTES <= length; countWord++)
+        {
+            uint32_t word = ufs_WordLoad(&data[countByte]);
+            lanes += (word & 0x00FF00FFu) + ((word >> 8) & 0x00FF00FFu);
+            countByte += UFS_WORD_BYTES;
+        }
+        sum += lanes + (lanes >> 16);
+    }
+#endif
+
+    // Remaining bytes
+    for (; countByte < length; countByte++)
+    {
+        sum += data[countByte];
+    }
+
+    return (uint8_t)sum;
+}
+
+/**
+ * @brief   Copies a byte array while XORing every byte with a key.
+ *
+ * @param[out]  dest    Pointer to the destination array, may be src.
+ * @param[in]   src     Pointer to the source array.
+ * @param[in]   length  Number of bytes to process.
+ * @param[in]   key     Byte XORed with every byte, 0 makes a plain copy.
+ */
+void ufs_KernelXor(uint8_t *dest, const uint8_t *src, uint32_t length, uint8_t key)
+{
+    uint32_t countByte = 0;
+
+#if UFS_KERNEL_USED != UFS_KERNEL_REFERENCE
+    uint32_t keyWord = UFS_WORD_SPLAT(key);
+    for (; countByte + UFS_WORD_BYTES <= length; countByte += UFS_WORD_BYTES)
+    {
+        ufs_WordStore(&dest[countByte], ufs_WordLoad(&src[countByte]) ^ keyWord);
+    }
+#endif
+
+    // Remaining bytes
+    for (; countByte < length; countByte++)
+    {
+        dest[countByte] = src[countByte] ^ key;
+    }
+}
+
+/**
+ * @brief   XORs every non-zero byte of an array with a key, in place.
+ *
+ * The SIMD kernel lets UADD8 set the GE flag of every non-zero byte and SEL
+ * picks the key for those bytes. The word kernel builds the same mask from
+ * the carry of adding 0x7F to the low seven bits of each byte.
+ *
+ * @param[in,out]   data    Pointer to the byte array.
+ * @param[in]       length  Number of bytes to process.
+ * @param[in]       key     Byte XORed with every non-zero byte.
+ */
+void ufs_KernelXorNonZero(uint8_t *data, uint32_t length, uint8_t key)
+{
+    uint32_t countByte = 0;
+
+#if UFS_KERNEL_USED != UFS_KERNEL_REFERENCE
+    uint32_t keyWord = UFS_WORD_SPLAT(key);
+    for (; countByte + UFS_WORD_BYTES <= length; countByte += UFS_WORD_BYTES)
+    {
+        uint32_t word = ufs_WordLoad(&data[countByte]);
+#if UFS_KERNEL_USED == UFS_KERNEL_SIMD
+        // byte + 0xFF carries out of the lane exactly when the byte is not 0
+        (void)__UADD8(word, 0xFFFFFFFFu);
+        uint32_t mask = __SEL(keyWord, 0);
+#else
+        // Bit 7 of each lane is set when the byte is not 0, spread it over the lane
+        uint32_t nonZero = (((word & 0x7F7F7F7Fu) + 0x7F7F7F7Fu) | word) & 0x80808080u;
+        uint32_t mask = ((nonZero >> 7) * 0xFFu) & keyWord;
+#endif
+        ufs_WordStore(&data[countByte], word ^ mask);
+    }
+#endif
+
+    // Remaining bytes
+    for (; countByte < length; countByte++)
+    {
+        if (data[countByte] != 0x00)
+        {
+            data[countByte] ^= key;
+        }
+    }
+}
+
+/**
+ * @brief   Compares two byte arrays for equality.
+ *
+ * @param[in]   a       Pointer to the first array.
+ * @param[in]   b       Pointer to the second array.
+ * @param[in]   length  Number of bytes to compare.
+ *
+ * @return      ufs_ReturnType  UFS_OK if the arrays are equal, UFS_NOT_OK otherwise.
+ */
+ufs_ReturnType ufs_KernelCompare(const uint8_t *a, const uint8_t *b, uint32_t length)
+{
+    uint32_t countByte = 0;
+
+#if UFS_KERNEL_USED != UFS_KERNEL_REFERENCE
+    for (; countByte + UFS_WORD_BYTES <= length; countByte += UFS_WORD_BYTES)
+    {
+        if (ufs_WordLoad(&a[countByte]) != ufs_WordLoad(&b[countByte]))
+        {
+            return UFS_NOT_OK;
+        }
+    }
+#endif
+
+    // Remaining bytes
+    for (; countByte < length; countByte++)
+    {
+        if (a[countByte] != b[countByte])
+        {
+            return UFS_NOT_OK;
+        }
+    }
+
+    return UFS_OK;
+}
+
+/**
+ * @brief   Finds the end of the data in a byte array filled with a value.
+ *
+ * The array is scanned backwards, a word at a time once the remaining length
+ * is a whole number of words. The word that differs is then resolved byte by byte.
+ *
+ * @param[in]   data    Pointer to the byte array.
+ * @param[in]   length  Number of bytes to look at.
+ * @param[in]   value   Fill value.
+ *
+ * @return      uint32_t  Offset after the last byte different from value, 0 if every byte equals value.
+ */
+uint32_t ufs_KernelDataEnd(const uint8_t *data, uint32_t length, uint8_t value)
+{
+    uint32_t end = length;
+
+#if UFS_KERNEL_USED != UFS_KERNEL_REFERENCE
+    uint32_t fillWord = UFS_WORD_SPLAT(value);
+
+    // Bytes past the last whole word
+    for (; end % UFS_WORD_BYTES != 0; end--)
+    {
+        if (data[end - 1] != value)
+        {
+            return end;
+        }
+    }
+
+    while (end >= UFS_WORD_BYTES && ufs_WordLoad(&data[end - UFS_WORD_BYTES]) == fillWord)
+    {
+        end -= UFS_WORD_BYTES;
+    }
+#endif
+
+    // Resolve the word that differs, or scan everything in the reference kernel
+    for (; end > 0; end--)
+    {
+        if (data[end - 1] != value)
+        {
+            return end;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief   Continues a CRC-32 over a byte array.
+ *
+ * The CRC is the one of zlib and Ethernet (IEEE 802.3), so a running value can
+ * be checked on the host with any standard CRC-32 routine.
+ *
+ * @param[in]   crc     CRC of the bytes before data, 0 for the first call.
+ * @param[in]   data    Pointer to the byte array.
+ * @param[in]   length  Number of bytes to add.
+ *
+ * @return      uint32_t  CRC of the bytes before data followed by data.
+ */
+uint32_t ufs_KernelCrc32(uint32_t crc, const uint8_t *data, uint32_t length)
+{
+    crc = ~crc;
+
+    for (uint32_t countByte = 0; countByte < length; countByte++)
+    {
+        crc = UFS_CRC32_TABLE[(crc ^ data[countByte]) & 0xFFu] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+/**
+ * @brief   Multiplies two polynomials modulo the CRC-32 polynomial.
+ *
+ * Both values are bit reflected like the CRC itself, bit 31 is x^0.
+ *
+ * @param[in]   a   First factor.
+ * @param[in]   b   Second factor.
+ *
+ * @return      uint32_t  Product of a and b modulo the polynomial.
+ */
+static uint32_t ufs_Crc32Multiply(uint32_t a, uint32_t b)
+{
+    uint32_t product = 0;
+
+    for (uint32_t mask = 0x80000000u; mask != 0; mask >>= 1)
+    {
+        if (a & mask)
+        {
+            product ^= b;
+        }
+        b = (b & 1u) ? ((b >> 1) ^ 0xEDB88320u) : (b >> 1);
+    }
+
+    return product;
+}
+
+/**
+ * @brief   Carries the difference of two CRC-32 over bytes that follow both messages.
+ *
+ * The CRC is linear, so the bytes that follow cancel out and the difference
+ * is only multiplied by x^(8 * length), with one square per bit of length
+ * instead of one step per byte.
+ *
+ * @param[in]   crc     XOR of the CRCs of the two messages.
+ * @param[in]   length  Number of bytes that follow the messages.
+ *
+ * @return      uint32_t  XOR of the CRCs of the longer messages.
+ */
+uint32_t ufs_KernelCrc32Shift(uint32_t crc, uint32_t length)
+{
+    uint32_t power = 0x00800000u;   // x^8, one byte
+
+    for (; length != 0; length >>= 1)
+    {
+        if (length & 1u)
+        {
+            crc = ufs_Crc32Multiply(power, crc);
+        }
+        power = ufs_Crc32Multiply(power, power);
+    }
+
+    return crc;
+}
+
+/**
+ * @brief   Checks that a byte array can be programmed over the current content of the device.
+ *
+ * @param[in]   current  Bytes read from the device.
+ * @param[in]   data     Bytes to program, before encoding.
+ * @param[in]   length   Number of bytes to check.
+ * @param[in]   key      Byte the data is XORed with before it is programmed.
+ *
+ * @return      ufs_ReturnType  UFS_OK if no bit has to go from 0 to 1, UFS_NOT_OK otherwise.
+ */
+ufs_ReturnType ufs_KernelProgrammable(const uint8_t *current, const uint8_t *data, uint32_t length, uint8_t key)
+{
+    uint32_t countByte = 0;
+
+#if UFS_KERNEL_USED != UFS_KERNEL_REFERENCE
+    uint32_t keyWord = UFS_WORD_SPLAT(key);
+    for (; countByte + UFS_WORD_BYTES <= length; countByte += UFS_WORD_BYTES)
+    {
+        if (((ufs_WordLoad(&data[countByte]) ^ keyWord) & ~ufs_WordLoad(&current[countByte])) != 0)
+        {
+            return UFS_NOT_OK;
+        }
+    }
+#endif
+
+    // Remaining bytes
+    for (; countByte < length; countByte++)
+    {
+        if (((data[countByte] ^ key) & ~current[countByte] & 0xFFu) != 0)
+        {
+            return UFS_NOT_OK;
+        }
+    }
+
+    return UFS_OK;
+}
+
+#if UFS_KERNEL_BENCH == UFS_OK
+
+#define UFS_BENCH_ROUNDS    8u   // Calls timed per kernel
+
+// Byte-at-a-time loops of UFS_KERNEL_REFERENCE, the baseline of ufs_KernelBench()
+static uint8_t ufs_BenchSum(const uint8_t *data, uint32_t length)
+{
+    uint32_t sum = 0;
+    for (uint32_t countByte = 0; countByte < length; countByte++)
+    {
+        sum += data[countByte];
+    }
+    return (uint8_t)sum;
+}
+
+static void ufs_BenchXor(uint8_t *dest, const uint8_t *src, uint32_t length, uint8_t key)
+{
+    for (uint32_t countByte = 0; countByte < length; countByte++)
+    {
+        dest[countByte] = src[countByte] ^ key;
+    }
+}
+
+static void ufs_BenchXorNonZero(uint8_t *data, uint32_t length, uint8_t key)
+{
+    for (uint32_t countByte = 0; countByte < length; countByte++)
+    {
+        if (data[countByte] != 0x00)
+        {
+            data[countByte] ^= key;
+        }
+    }
+}
+
+static ufs_ReturnType ufs_BenchCompare(const uint8_t *a, const uint8_t *b, uint32_t length)
+{
+    for (uint32_t countByte = 0; countByte < length; countByte++)
+    {
+        if (a[countByte] != b[countByte])
+        {
+            return UFS_NOT_OK;
+        }
+    }
+    return UFS_OK;
+}
+
+static uint32_t ufs_BenchDataEnd(const uint8_t *data, uint32_t length, uint8_t value)
+{
+    for (uint32_t end = length; end > 0; end--)
+    {
+        if (data[end - 1] != value)
+        {
+            return end;
+        }
+    }
+    return 0;
+}
+
+static ufs_ReturnType ufs_BenchProgrammable(const uint8_t *current, const uint8_t *data, uint32_t length, uint8_t key)
+{
+    for (uint32_t countByte = 0; countByte < length; countByte++)
+    {
+        if (((data[countByte] ^ key) & ~current[countByte] & 0xFFu) != 0)
+        {
+            return UFS_NOT_OK;
+        }
+    }
+    return UFS_OK;
+}
+
+// Runs a call UFS_BENCH_ROUNDS times and stores its cycles per KB
+#define UFS_BENCH_TIME(field, call)                                                             \
+    do                                                                                          \
+    {                                                                                           \
+        uint32_t start = GetCycles();                                                           \
+        for (uint32_t countRound = 0; countRound < UFS_BENCH_ROUNDS; countRound++)              \
+        {                                                                                       \
+            call;                                                                               \
+        }                                                                                       \
+        (field) = (uint32_t)(((uint64_t)(GetCycles() - start) * 1024u) / ((uint64_t)length * UFS_BENCH_ROUNDS)); \
+    } while (0)
+
+/**
+ * @brief   Times the kernels of this build against the byte-at-a-time loops.
+ *
+ * The data is pseudo-random with zero bytes for the item codec and ends with a
+ * quarter of erased bytes for the blank check. The programmable case clears
+ * bits of the current content, so the whole array is checked.
+ *
+ * @param[in]   GetCycles  Cycle counter, e.g. Ufs_Cycles().
+ * @param[in]   length     Number of bytes per call, at least 4, e.g. one sector.
+ * @param[out]  result     Cycles per KB of each kernel and of its byte loop.
+ *
+ * @return      ufs_ReturnType  UFS_OK if every kernel matches its byte loop, UFS_NOT_OK otherwise or when out of memory.
+ */
+ufs_ReturnType ufs_KernelBench(uint32_t (*GetCycles)(void), uint32_t length, ufs_KernelBench_Type *result)
+{
+    if (GetCycles == NULL || result == NULL || length < UFS_WORD_BYTES)
+    {
+        return UFS_NOT_OK;
+    }
+
+    // One byte more than the length for the unaligned pass
+    uint8_t *data = (uint8_t *)malloc(length + 1);
+    uint8_t *kernelOut = (uint8_t *)malloc(length + 1);
+    uint8_t *referenceOut = (uint8_t *)malloc(length + 1);
+    volatile uint32_t sink = 0;   // Keeps the results of the timed calls alive
+
+    if (data == NULL || kernelOut == NULL || referenceOut == NULL)
+    {
+        free(data);
+        free(kernelOut);
+        free(referenceOut);
+        return UFS_NOT_OK;
+    }
+
+    memset(result, 0x00, sizeof(ufs_KernelBench_Type));
+    result->kernel = UFS_KERNEL_USED;
+
+    uint32_t seed = 0x2545F491u;
+    for (uint32_t countByte = 0; countByte <= length; countByte++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        data[countByte] = (uint8_t)(seed >> 16);
+        if ((data[countByte] & 0x0Fu) == 0)
+        {
+            data[countByte] = 0x00;
+        }
+    }
+    memset(&data[length - length / 4], UFS_BYTE_VALUE_AFTER_ERASE, length / 4 + 1);
+
+    // Same results as the byte loops, on an aligned and an unaligned buffer
+    for (uint8_t offset = 0; offset < 2; offset++)
+    {
+        const uint8_t *src = &data[offset];
+
+        result->mismatch |= (ufs_KernelSum(src, length) != ufs_BenchSum(src, length));
+
+        ufs_KernelXor(kernelOut, src, length, 0x5A);
+        ufs_BenchXor(referenceOut, src, length, 0x5A);
+        result->mismatch |= (memcmp(kernelOut, referenceOut, length) != 0);
+
+        memcpy(kernelOut, src, length);
+        memcpy(referenceOut, src, length);
+        ufs_KernelXorNonZero(kernelOut, length, 0x5A);
+        ufs_BenchXorNonZero(referenceOut, length, 0x5A);
+        result->mismatch |= (memcmp(kernelOut, referenceOut, length) != 0);
+
+        memcpy(kernelOut, src, length);
+        result->mismatch |= (ufs_KernelCompare(src, kernelOut, length) != ufs_BenchCompare(src, kernelOut, length));
+        kernelOut[length - 1] ^= 0x01;
+        result->mismatch |= (ufs_KernelCompare(src, kernelOut, length) != ufs_BenchCompare(src, kernelOut, length));
+
+        result->mismatch |= (ufs_KernelDataEnd(src, length, UFS_BYTE_VALUE_AFTER_ERASE) !=
+                             ufs_BenchDataEnd(src, length, UFS_BYTE_VALUE_AFTER_ERASE));
+
+        for (uint32_t countByte = 0; countByte < length; countByte++)
+        {
+            kernelOut[countByte] = src[countByte] & 0xF0u;
+        }
+        result->mismatch |= (ufs_KernelProgrammable(src, kernelOut, length, 0x00) !=
+                             ufs_BenchProgrammable(src, kernelOut, length, 0x00));
+        kernelOut[length - 1] = (uint8_t)~src[length - 1];
+        result->mismatch |= (ufs_KernelProgrammable(src, kernelOut, length, 0x00) !=
+                             ufs_BenchProgrammable(src, kernelOut, length, 0x00));
+    }
+
+    // Timings on the aligned buffer, the programmable case runs to the end of the array
+    for (uint32_t countByte = 0; countByte < length; countByte++)
+    {
+        kernelOut[countByte] = data[countByte] & 0xF0u;
+    }
+    memcpy(referenceOut, data, length);
+
+    UFS_BENCH_TIME(result->sum.reference, sink += ufs_BenchSum(data, length));
+    UFS_BENCH_TIME(result->sum.kernel, sink += ufs_KernelSum(data, length));
+    UFS_BENCH_TIME(result->xor.reference, ufs_BenchXor(referenceOut, data, length, 0x5A));
+    UFS_BENCH_TIME(result->xor.kernel, ufs_KernelXor(referenceOut, data, length, 0x5A));
+    UFS_BENCH_TIME(result->xorNonZero.reference, ufs_BenchXorNonZero(referenceOut, length, 0x5A));
+    UFS_BENCH_TIME(result->xorNonZero.kernel, ufs_KernelXorNonZero(referenceOut, length, 0x5A));
+    memcpy(referenceOut, data, length);
+    UFS_BENCH_TIME(result->compare.reference, sink += ufs_BenchCompare(data, referenceOut, length));
+    UFS_BENCH_TIME(result->compare.kernel, sink += ufs_KernelCompare(data, referenceOut, length));
+    UFS_BENCH_TIME(result->dataEnd.reference, sink += ufs_BenchDataEnd(data, length, UFS_BYTE_VALUE_AFTER_ERASE));
+    UFS_BENCH_TIME(result->dataEnd.kernel, sink += ufs_KernelDataEnd(data, length, UFS_BYTE_VALUE_AFTER_ERASE));
+    UFS_BENCH_TIME(result->programmable.reference, sink += ufs_BenchProgrammable(data, kernelOut, length, 0x00));
+    UFS_BENCH_TIME(result->programmable.kernel, sink += ufs_KernelProgrammable(data, kernelOut, length, 0x00));
+    (void)sink;
+
+    free(data);
+    free(kernelOut);
+    free(referenceOut);
+
+    return (result->mismatch == 0) ? UFS_OK : UFS_NOT_OK;
+}
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef _UFS_KERNEL_H_
+#define _UFS_KERNEL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "ufs_conf.h"
+#include "ufs_types.h"
+
+/**
+ * @brief Sums a byte array modulo 256.
+ *
+ * @param[in]  data    Pointer to the byte array.
+ * @param[in]  length  Number of bytes to sum.
+ *
+ * @return uint8_t     Sum of the bytes, modulo 256.
+ */
+uint8_t ufs_KernelSum(const uint8_t *data, uint32_t length);
+
+/**
+ * @brief Copies a byte array while XORing every byte with a key.
+ *
+ * The destination may be the source itself, other overlaps are not supported.
+ * A key of 0 makes a plain copy.
+ *
+ * @param[out] dest    Pointer to the destination array.
+ * @param[in]  src     Pointer to the source array.
+ * @param[in]  length  Number of bytes to process.
+ * @param[in]  key     Byte XORed with every byte.
+ */
+void ufs_KernelXor(uint8_t *dest, const uint8_t *src, uint32_t length, uint8_t key);
+
+/**
+ * @brief XORs every non-zero byte of an array with a key, in place.
+ *
+ * Zero bytes are left as they are. This is the codec of the item zone.
+ *
+ * @param[in,out] data    Pointer to the byte array.
+ * @param[in]     length  Number of bytes to process.
+ * @param[in]     key     Byte XORed with every non-zero byte.
+ */
+void ufs_KernelXorNonZero(uint8_t *data, uint32_t length, uint8_t key);
+
+/**
+ * @brief Compares two byte arrays for equality.
+ *
+ * @param[in]  a       Pointer to the first array.
+ * @param[in]  b       Pointer to the second array.
+ * @param[in]  length  Number of bytes to compare.
+ *
+ * @return ufs_ReturnType  UFS_OK if the arrays are equal, UFS_NOT_OK otherwise.
+ */
+ufs_ReturnType ufs_KernelCompare(const uint8_t *a, const uint8_t *b, uint32_t length);
+
+/**
+ * @brief Finds the end of the data in a byte array filled with a value.
+ *
+ * A blank check is a call that returns 0 with the erased value.
+ *
+ * @param[in]  data    Pointer to the byte array.
+ * @param[in]  length  Number of bytes to look at.
+ * @param[in]  value   Fill value, usually the value of an erased byte.
+ *
+ * @return uint32_t    Offset after the last byte different from value, 0 if every byte equals value.
+ */
+uint32_t ufs_KernelDataEnd(const uint8_t *data, uint32_t length, uint8_t value);
+
+/**
+ * @brief Continues a CRC-32 (IEEE 802.3, as zlib) over a byte array.
+ *
+ * @param[in]  crc     CRC of the bytes before data, 0 for the first call.
+ * @param[in]  data    Pointer to the byte array.
+ * @param[in]  length  Number of bytes to add.
+ *
+ * @return uint32_t    CRC of the bytes before data followed by data.
+ */
+uint32_t ufs_KernelCrc32(uint32_t crc, const uint8_t *data, uint32_t length);
+
+/**
+ * @brief Carries the difference of two CRC-32 over bytes that follow both messages.
+ *
+ * For two messages of the same length with CRCs a and b, followed by the same
+ * `length` bytes, the CRCs of the longer messages differ by
+ * ufs_KernelCrc32Shift(a ^ b, length).
+ *
+ * @param[in]  crc     XOR of the CRCs of the two messages.
+ * @param[in]  length  Number of bytes that follow the messages.
+ *
+ * @return uint32_t    XOR of the CRCs of the longer messages.
+ */
+uint32_t ufs_KernelCrc32Shift(uint32_t crc, uint32_t length);
+
+/**
+ * @brief Checks that a byte array can be programmed over the current content of the device.
+ *
+ * Programming only clears bits, so every bit set in the new data must be set
+ * in the current content.
+ *
+ * @param[in]  current  Bytes read from the device.
+ * @param[in]  data     Bytes to program, before encoding.
+ * @param[in]  length   Number of bytes to check.
+ * @param[in]  key      Byte the data is XORed with before it is programmed.
+ *
+ * @return ufs_ReturnType  UFS_OK if no bit has to go from 0 to 1, UFS_NOT_OK otherwise.
+ */
+ufs_ReturnType ufs_KernelProgrammable(const uint8_t *current, const uint8_t *data, uint32_t length, uint8_t key);
+
+#if UFS_KERNEL_BENCH == UFS_OK
+/**
+ * @brief Cycles per KB of one kernel and of the byte-at-a-time loop it replaces.
+ */
+typedef struct
+{
+    uint32_t reference;     /**< Byte-at-a-time loop, as built with UFS_KERNEL_REFERENCE. */
+    uint32_t kernel;        /**< Kernel of this build. */
+} ufs_KernelTiming_Type;
+
+/**
+ * @brief Result of ufs_KernelBench().
+ */
+typedef struct
+{
+    uint8_t                kernel;        /**< Implementation built, UFS_KERNEL_REFERENCE, UFS_KERNEL_WORD or UFS_KERNEL_SIMD. */
+    uint8_t                mismatch;      /**< Non-zero when a kernel result differs from the byte loop. */
+    ufs_KernelTiming_Type  sum;           /**< ufs_KernelSum(). */
+    ufs_KernelTiming_Type  xor;           /**< ufs_KernelXor(). */
+    ufs_KernelTiming_Type  xorNonZero;    /**< ufs_KernelXorNonZero(). */
+    ufs_KernelTiming_Type  compare;       /**< ufs_KernelCompare() on equal arrays. */
+    ufs_KernelTiming_Type  dataEnd;       /**< ufs_KernelDataEnd() on an array ending with erased bytes. */
+    ufs_KernelTiming_Type  programmable;  /**< ufs_KernelProgrammable() on programmable data. */
+} ufs_KernelBench_Type;
+
+/**
+ * @brief Times the kernels of this build against the byte-at-a-time loops.
+ *
+ * Both versions first run on an aligned and an unaligned buffer and their
+ * results are compared, then each one is timed over the same buffer.
+ *
+ * @param[in]  GetCycles  Cycle counter, e.g. Ufs_Cycles().
+ * @param[in]  length     Number of bytes per call, at least 4, e.g. one sector.
+ * @param[out] result     Cycles per KB of each kernel and of its byte loop.
+ *
+ * @return ufs_ReturnType  UFS_OK if every kernel matches its byte loop, UFS_NOT_OK otherwise or when out of memory.
+ */
+ufs_ReturnType ufs_KernelBench(uint32_t (*GetCycles)(void), uint32_t length, ufs_KernelBench_Type *result);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _UFS_KERNEL_H_ */
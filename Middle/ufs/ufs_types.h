@@ -14,12 +14,25 @@ extern "C"
 
 #define MAX_PATH_LENGTH     200u
 
+#define UFS_MAP_JOURNAL_LENGTH  16u  // Changed map entries tracked per cache slot for in-place programming
+
 // Return codes
 #define UFS_OK            0x00   // Operation was successful
 #define UFS_NOT_OK        0x01   // Operation failed
+#define UFS_BUSY          0x02   // The item is in use by an open stream, nothing was done
 
 #define UFS_SUPPORT_FOLDER   UFS_OK
 
+// Implementations of the checksum, codec, compare and blank-check kernels
+#define UFS_KERNEL_REFERENCE  0x00   // One byte at a time, portable
+#define UFS_KERNEL_WORD       0x01   // One 32-bit word at a time, portable
+#define UFS_KERNEL_SIMD       0x02   // Cortex-M4 SIMD instructions
+
+// Policies to verify the data programmed by writes made with CHECKSUM_ENABLE
+#define UFS_VERIFY_NONE       0x00   // Nothing is read back
+#define UFS_VERIFY_PROGRAMMED 0x01   // The programmed bytes are read back right after each program
+#define UFS_VERIFY_DEFERRED   0x02   // The programmed sectors are read back in batches, at the latest on close
+
 typedef uint8_t ufs_ReturnType;
 
 /**
@@ -44,6 +57,23 @@ typedef ufs_ReturnType (*ufs_Init(void));
  */
 typedef ufs_ReturnType (*ufs_WriteSector(uint16_t u16SectorNumb, uint8_t *pData, uint32_t u32Size));
 
+/**
+ * @brief Programs a byte range inside the specified sector without erasing it.
+ *
+ * The bytes are programmed page by page, so only bits that are 1 on the device
+ * can be cleared. The caller must make sure no bit has to go from 0 to 1.
+ *
+ * @param[in]  u16SectorNumb  The sector number to which data should be written.
+ * @param[in]  u32Offset      Offset of the first byte inside the sector.
+ * @param[in]  pData          Pointer to the data buffer to write.
+ * @param[in]  u32Size        The size of the data to be written (in bytes).
+ *
+ * @return ufs_ReturnType
+ *         - UFS_OK if the write operation was successful.
+ *         - UFS_NOT_OK if the write operation failed.
+ */
+typedef ufs_ReturnType (*ufs_WritePartial(uint16_t u16SectorNumb, uint32_t u32Offset, uint8_t *pData, uint32_t u32Size));
+
 /**
  * @brief Reads data from the specified sector in UFS.
  *
@@ -57,6 +87,23 @@ typedef ufs_ReturnType (*ufs_WriteSector(uint16_t u16SectorNumb, uint8_t *pData,
  */
 typedef ufs_ReturnType (*ufs_ReadSector(uint16_t u16SectorNumb, uint8_t *pData, uint32_t u32Size));
 
+/**
+ * @brief Reads a continuous byte range that may span several sectors.
+ *
+ * The range starts at the given offset of the given sector and continues
+ * into the following sectors in one transfer.
+ *
+ * @param[in]  u16SectorNumb  The sector number where the range starts.
+ * @param[in]  u32Offset      Offset of the first byte inside that sector.
+ * @param[out] pData          Pointer to the buffer where the read data will be stored.
+ * @param[in]  u32Size        The size of the range (in bytes).
+ *
+ * @return ufs_ReturnType
+ *         - UFS_OK if the read operation was successful.
+ *         - UFS_NOT_OK if the read operation failed.
+ */
+typedef ufs_ReturnType (*ufs_ReadRange(uint16_t u16SectorNumb, uint32_t u32Offset, uint8_t *pData, uint32_t u32Size));
+
 /**
  * @brief Erases the specified sector in UFS.
  *
@@ -114,6 +161,22 @@ typedef void (*ufs_LockMutex(void *mutex));
  */
 typedef void (*ufs_UnlockMutex(void *mutex));
 
+/**
+ * @brief Returns a free running millisecond tick.
+ *
+ * @return uint32_t  Current tick in milliseconds.
+ */
+typedef uint32_t ufs_GetTick(void);
+
+/**
+ * @brief Sleeps while a file lock is held by another task.
+ *
+ * The caller must be blocked for a while, e.g. vTaskDelay(1), so a holder of
+ * lower priority gets to run. Giving the processor only to tasks of the same
+ * priority, as taskYIELD() does, is not enough.
+ */
+typedef void ufs_Yield(void);
+
 /**
  * @brief Status of checksum in UFS.
  */
@@ -188,12 +251,23 @@ typedef struct ufs_PathNode
 #endif
 
 /**
- * @brief Structure for holding the cluster ID and its link to the next cluster.
+ * @brief Run of physically contiguous clusters in a cluster chain.
+ */
+typedef struct
+{
+    uint16_t start;   /**< First cluster of the run. */
+    uint16_t count;   /**< Number of clusters in the run. */
+} ufs_Extent_Type;
+
+/**
+ * @brief Cluster chain of a file, held as a list of contiguous runs.
  */
 typedef struct
 {
-    uint16_t *value;  /**< Cluster ID. */
-    uint16_t length;  /**< Link to the next cluster in the chain. */
+    ufs_Extent_Type *extent;    /**< Runs of the chain, in chain order. */
+    uint16_t        number;     /**< Number of runs in use. */
+    uint16_t        capacity;   /**< Number of runs allocated. */
+    uint16_t        length;     /**< Number of clusters in the chain. */
 } ufs_ListClusterID_Type;
 
 /**
@@ -223,14 +297,33 @@ typedef union
     struct
     {
         ufs_Name_Type       name;           /**< Name of the item. */
-        ufs_Location_Type   first_cluster;  /**< Location of the first cluster of the item. */
+        uint16_t            first_cluster;  /**< First cluster of the item, 0xFFFF when it has none. */
         uint16_t            parent;         /**< Parent directory/item. */
-        uint16_t            revert;         /**< Reserved field. */
+        uint32_t            crc;            /**< CRC32 of the file content, 0 when it is not known. */
         uint32_t            size;           /**< Size of the item in bytes. */
     } comp;  /**< Detailed item information. */
     uint8_t data[32];  /**< Raw data of the item. */
 } ufs_ItemInfo_Type;
 
+/**
+ * @brief Item information as written by UFS versions without file CRC.
+ *
+ * Entries in this layout are converted to ufs_ItemInfo_Type when the item
+ * zone is indexed at mount, and written back in the current layout.
+ */
+typedef union
+{
+    struct
+    {
+        ufs_Name_Type       name;           /**< Name of the item. */
+        ufs_Location_Type   first_cluster;  /**< Cluster map sector and entry of the first cluster. */
+        uint16_t            parent;         /**< Parent directory/item. */
+        uint16_t            revert;         /**< Reserved field. */
+        uint32_t            size;           /**< Size of the item in bytes. */
+    } comp;  /**< Detailed item information. */
+    uint8_t data[32];  /**< Raw data of the item. */
+} ufs_LegacyItemInfo_Type;
+
 /**
  * @brief Structure representing the UFS API and its function pointers.
  */
@@ -238,13 +331,17 @@ typedef struct
 {
     ufs_Init          *Init;               /**< Initialization function pointer. */
     ufs_WriteSector   *WriteSector;        /**< Write sector function pointer. */
+    ufs_WritePartial  *WritePartial;       /**< Optional in-place program of a byte range, NULL if not supported. */
     ufs_ReadSector    *ReadSector;         /**< Read sector function pointer. */
+    ufs_ReadRange     *ReadRange;          /**< Optional continuous read across sectors, NULL if not supported. */
     ufs_EraseSector   *EraseSector;        /**< Erase sector function pointer. */
     ufs_EraseBlock    *EraseBlock;         /**< Erase sector function pointer. */
     ufs_EraseChip     *EraseChip;          /**< Erase chip function pointer. */
     ufs_ReadUniqueID  *ReadUniqueID;       /**< Read unique ID function pointer. */
-    ufs_LockMutex     *LockMutex;          /**< Lock mutex function pointer. */
-    ufs_UnlockMutex   *UnlockMutex;        /**< Unlock mutex function pointer. */
+    ufs_LockMutex     *LockMutex;          /**< Lock function of the metadata mutex. */
+    ufs_UnlockMutex   *UnlockMutex;        /**< Unlock function of the metadata mutex. */
+    ufs_GetTick       *GetTick;            /**< Optional millisecond tick, NULL disables the time commit threshold. */
+    ufs_Yield         *Yield;              /**< Sleep while a file lock is busy, required when the mutex is set. */
     void              *mutex;              /**< Mutex pointer for synchronization. */
     uint16_t          u16numberByteOfSector;   /**< Number of bytes per sector. */
     uint16_t          u16numberSectorOfBlock;  /**< Number of Sector per Block. */
@@ -270,6 +367,59 @@ typedef struct
     ufs_ExtensionName_Type *pExtensionEncodeFileList;  /**< Pointer to the list of encoded file extensions. */
 } ufs_Cfg_Type;
 
+/**
+ * @brief One RAM copy of a sector of the cluster mapping zone.
+ */
+typedef struct
+{
+    uint8_t  *data;       /**< Sector content, newer than flash when dirty is set. */
+    uint16_t sector_id;   /**< Sector index inside the cluster mapping zone (0xFFFF = empty). */
+    uint8_t  dirty;       /**< Non-zero when the sector must be written back. */
+    uint8_t  needErase;   /**< Non-zero when the changes cannot be programmed in place. */
+    uint8_t  journalLength;                          /**< Number of entries in the journal. */
+    uint16_t journalPosition[UFS_MAP_JOURNAL_LENGTH]; /**< Changed entries of the sector. */
+    uint16_t journalValue[UFS_MAP_JOURNAL_LENGTH];    /**< Value of these entries on the device. */
+    uint16_t dirtyFirst;  /**< First changed entry of the sector. */
+    uint16_t dirtyLast;   /**< Last changed entry of the sector. */
+    uint32_t age;         /**< Last access stamp used for LRU replacement. */
+} ufs_MapCache_Type;
+
+/**
+ * @brief Flash traffic counters maintained by UFS.
+ */
+typedef struct
+{
+    uint32_t MapCacheHit;       /**< Cluster map accesses served from RAM. */
+    uint32_t MapCacheMiss;      /**< Cluster map accesses that had to read a sector. */
+    uint32_t MapSectorErase;    /**< Cluster map sectors erased during write-back. */
+    uint32_t MapSectorWrite;    /**< Cluster map sectors written during write-back. */
+    uint32_t MapSectorProgram;  /**< Cluster map write-backs done in place, without erase. */
+    uint32_t ItemSectorWrite;   /**< Item zone sectors erased and written. */
+    uint32_t DataErase;         /**< Data zone erases issued by the write path. */
+    uint32_t DataPreErase;      /**< Data zone erases issued by ufs_PreErase(). */
+    uint32_t DataDrain;         /**< Stream sectors programmed after their feed call returned. */
+    uint32_t ScratchMiss;       /**< Sector buffers allocated from the heap because the scratch pool was empty. */
+} ufs_Stats_Type;
+
+/**
+ * @brief In-RAM index of the item zone.
+ *
+ * Holds a decoded copy of every item slot, a hash table keyed by
+ * (parent id, name, extension) and one child list per folder. Slots are
+ * identified by their path id (sector * items per sector + position).
+ */
+typedef struct
+{
+    ufs_ItemInfo_Type *info;         /**< Decoded copy of every item slot. */
+    uint16_t          *bucket;       /**< First slot of each hash bucket, 0xFFFF if empty. */
+    uint16_t          *nextHash;     /**< Next slot in the same hash bucket. */
+    uint16_t          *firstChild;   /**< First child of each folder slot. */
+    uint16_t          *nextSibling;  /**< Next slot with the same parent. */
+    uint8_t           *dirty;        /**< Non-zero for each item sector newer in RAM than on the device. */
+    int8_t            *lock;         /**< File lock of each slot: number of readers, -1 while written. */
+    uint16_t          numberSlot;    /**< Number of item slots in the item zone. */
+} ufs_ItemIndex_Type;
+
 /**
  * @brief Structure representing UFS Path information.
  */
@@ -279,6 +429,38 @@ typedef struct
     uint8_t      *name;
 } ufs_Path_Type;
 
+/**
+ * @brief Read-ahead window of an open file.
+ *
+ * Holds the last sector read through ufs_ReadFile() and, when the file is
+ * read sequentially, the sector after it.
+ */
+typedef struct
+{
+    uint8_t  *buffer;     /**< Two-sector buffer, allocated on first use. */
+    uint32_t sector[2];   /**< Device sectors held in the buffer. */
+    uint8_t  count;       /**< Number of valid sectors in the buffer. */
+    uint32_t next;        /**< File position right after the previous read. */
+    uint32_t version;     /**< UFS data version the buffer was filled at. */
+} ufs_ReadWindow_Type;
+
+/**
+ * @brief Recently closed file kept by the open-file table.
+ *
+ * The resolved cluster extents and the read-ahead window of a file closed
+ * through ufs_FileClose() are kept here, so reopening it costs no flash read.
+ */
+typedef struct
+{
+    uint16_t               slot;           /**< Path id of the file, 0xFFFF when the entry is empty. */
+    uint16_t               first_cluster;  /**< First cluster of the file when it was closed. */
+    ufs_ListClusterID_Type clusters;       /**< Cluster extents resolved while the file was open. */
+    ufs_ReadWindow_Type    window;         /**< Read-ahead window of the file. */
+    uint32_t               age;            /**< Close stamp used for LRU replacement. */
+} ufs_RecentFile_Type;
+
+struct ufs_Item;
+
 /**
  * @brief Structure representing the UFS system.
  */
@@ -293,12 +475,32 @@ typedef struct
     ufs_Cfg_Type      *conf;                  /**< Pointer to the UFS configuration structure. */
     ufs_Location_Type latest_cluster;         /**< Location of the latest allocated cluster. */
     ufs_Path_Type     path;
+    ufs_MapCache_Type *MapCache;              /**< Write-back cache of the cluster mapping zone. */
+    uint32_t          MapCacheTick;           /**< Access counter feeding ufs_MapCache_Type::age. */
+    ufs_Stats_Type    stats;                  /**< Flash traffic counters. */
+    uint32_t          *FreeBitmap;            /**< One bit per cluster, set when the cluster is free. */
+    uint32_t          *CleanBitmap;           /**< One bit per cluster, set when the cluster is free and already erased. */
+    uint16_t          CleanCursor;            /**< Cluster ufs_PreErase() resumes its scan from. */
+    uint16_t          *ReclaimQueue;          /**< First clusters of the UFS_RECLAIM_QUEUE chains left by deleted files. */
+    uint16_t          ReclaimCount;           /**< Number of chains waiting in the reclaim queue. */
+    uint16_t          NumberCluster;          /**< Number of clusters in the cluster data zone. */
+    ufs_ItemIndex_Type ItemIndex;             /**< In-RAM index of the item zone. */
+    uint32_t          ItemPendingBytes;       /**< Bytes written to files since the item zone was last committed. */
+    uint32_t          ItemDirtyTick;          /**< Tick of the oldest item change not yet committed. */
+    uint32_t          DataVersion;            /**< Incremented on every file data write, invalidates read windows. */
+    struct ufs_Item   *Handle;                /**< Open-file table of UFS_OPEN_FILES handles. */
+    ufs_RecentFile_Type *Recent;              /**< UFS_RECENT_FILES files recently closed through the open-file table. */
+    uint32_t          RecentTick;             /**< Close counter feeding ufs_RecentFile_Type::age. */
+    struct ufs_Stream *Streams;               /**< Open streams, drained by ufs_Drain() and ufs_Sync(). */
+    struct ufs_Request *Requests;             /**< Requests waiting for ufs_Serve(), by decreasing priority. */
+    uint8_t           *Scratch;               /**< Pool of UFS_SCRATCH_SECTORS sector buffers. */
+    uint8_t           ScratchBusy;            /**< One bit per pool buffer, set while it is borrowed. */
 } UFS;
 
 /**
  * @brief Structure representing a file item in UFS.
  */
-typedef struct
+typedef struct ufs_Item
 {
     ufs_Location_Type      location;           /**< Location of the file in UFS. */
     ufs_ListClusterID_Type clusters;           /**< List of cluster IDs for the file. */
@@ -307,8 +509,73 @@ typedef struct
     ufs_ErrorCodes         err;                /**< Error codes for file operations. */
     UFS                    *ufs;               /**< Pointer to the UFS structure. */
     ufs_EncodeStatus       EncodeEnable;       /**< Encoding enabled flag (0 = disabled, 1 = enabled). */
+    ufs_ReadWindow_Type    window;             /**< Read-ahead window used by ufs_ReadFile(). */
+    uint32_t               cursor;             /**< Position of the next ufs_FileRead() on a handle. */
+    uint8_t                refs;               /**< Number of ufs_FileOpen() calls holding a handle. */
 } ufs_Item_Type;
 
+/**
+ * @brief Structure representing a streaming writer on an open file.
+ *
+ * The stream stages data in a ring of sectors, programs a sector only when
+ * it is full and commits the file size and first cluster once, on close.
+ * With UFS_WRITE_BEHIND_SECTORS set, full sectors wait in the ring until
+ * ufs_Drain(), ufs_Sync() or ufs_StreamClose() programs them.
+ */
+typedef struct ufs_Stream
+{
+    ufs_Item_Type          *file;          /**< File being written, NULL when the stream is closed. */
+    ufs_ListClusterID_Type clusters;       /**< Cluster chain of the new content. */
+    uint8_t                *buffer;        /**< Ring of staging sectors. */
+    uint16_t               head;           /**< Ring slot of the oldest sector waiting to be programmed. */
+    uint16_t               queued;         /**< Number of full sectors waiting to be programmed. */
+    uint16_t               fill;           /**< Number of bytes staged in the slot after the queued sectors. */
+    uint32_t               sectors;        /**< Number of sectors already programmed. */
+    uint32_t               size;           /**< Number of bytes accepted by the stream. */
+    uint32_t               crc;            /**< CRC32 of the bytes accepted by the stream. */
+    uint16_t               badCluster;     /**< Cluster that failed verification, 0xFFFF if none. */
+    ufs_CheckSumStatus     sumEnable;      /**< Verify each programmed sector. */
+    uint32_t               verified;       /**< Number of programmed sectors already verified. */
+    uint8_t                *sums;          /**< Checksums of the sectors waiting for a deferred verify, after the ring. */
+    struct ufs_Stream      *next;          /**< Next open stream of the same UFS. */
+} ufs_Stream_Type;
+
+/**
+ * @brief Enumeration of the operations a queued request can carry.
+ */
+typedef enum
+{
+    UFS_REQUEST_READ    = 0x00, /**< ufs_ReadFile() of `length` bytes at `position` into `data`. */
+    UFS_REQUEST_WRITE   = 0x01, /**< ufs_WriteFile() of `length` bytes from `data`. */
+    UFS_REQUEST_APPEND  = 0x02, /**< ufs_WriteAppendFile() of `length` bytes from `data`. */
+    UFS_REQUEST_OPEN    = 0x03, /**< ufs_OpenItem() of `name` into `item`. */
+    UFS_REQUEST_DELETE  = 0x04, /**< ufs_DeleteItem() of `item`. */
+} ufs_RequestOp;
+
+/**
+ * @brief Structure representing a request queued with ufs_Submit().
+ *
+ * The request is owned by UFS from ufs_Submit() until `pending` is cleared,
+ * right before `Complete` is called by the task running ufs_Serve().
+ */
+typedef struct ufs_Request
+{
+    ufs_RequestOp          op;             /**< Operation to run. */
+    uint8_t                priority;       /**< Higher priorities are served first, equal ones in submit order. */
+    ufs_Item_Type          *item;          /**< Item the operation runs on. */
+    uint8_t                *name;          /**< Writable name of the item to open, UFS_REQUEST_OPEN only. */
+    uint32_t               position;       /**< Offset of the first byte to read, UFS_REQUEST_READ only. */
+    uint8_t                *data;          /**< Buffer read into or written from. */
+    uint32_t               length;         /**< Number of bytes to read or write. */
+    ufs_CheckSumStatus     sumEnable;      /**< Verify the sectors written. */
+    uint32_t               done;           /**< Number of bytes read or written so far. */
+    ufs_ReturnType         result;         /**< Result of the operation, valid once `pending` is cleared. */
+    volatile uint8_t       pending;        /**< Set by ufs_Submit(), cleared when the request completes. */
+    void                   (*Complete)(struct ufs_Request *request);  /**< Completion callback, may be NULL. */
+    void                   *context;       /**< Caller data for the completion callback, e.g. a task to notify. */
+    struct ufs_Request     *next;          /**< Next queued request. */
+} ufs_Request_Type;
+
 #ifdef __cplusplus
 }
 #endif